@@ -1,6 +1,8 @@
 out vec2 fragColor;
 in vec2 texCoords;
 
+uniform int sampleCount;
+
 const float PI = 3.14159265359;
 // ----------------------------------------------------------------------------
 // http://holger.dammertz.org/stuff/notes_HammersleyOnHemisphere.html
@@ -77,7 +79,7 @@ vec2 IntegrateBRDF(float NdotV, float roughness)
 
     vec3 N = vec3(0.0, 0.0, 1.0);
     
-    const uint SAMPLE_COUNT = 1024u;
+    uint SAMPLE_COUNT = uint(sampleCount);
     for(uint i = 0u; i < SAMPLE_COUNT; ++i)
     {
         // generates a sample vector that's biased towards the
@@ -2,97 +2,35 @@ out vec4 fragColor;
 in vec3 dir;
 
 uniform samplerCube environmentMap;
-uniform float roughness;
-uniform float environmentMapResolution;
 
-// TODO: implement as define
-const float PI = 3.14159265359;
-
-float DistributionGGX(vec3 N, vec3 H, float roughness)
+// GGX importance samples for the roughness of the mip being rendered, built by BuildPrefilterSamples.
+// xyz: tangent space L (z is NdotL and the sample weight), w: source mip level.
+layout(std430, binding = 0) readonly buffer PrefilterSamples
 {
-    float a = roughness*roughness;
-    float a2 = a*a;
-    float NdotH = max(dot(N, H), 0.0);
-    float NdotH2 = NdotH*NdotH;
-
-    float nom   = a2;
-    float denom = (NdotH2 * (a2 - 1.0) + 1.0);
-    denom = PI * denom * denom;
-
-    return nom / denom;
-}
+    vec4 samples[];
+};
+uniform int sampleOffset;
+uniform int sampleCount;
 
-float RadicalInverse_VdC(uint bits) 
-{
-    bits = (bits << 16u) | (bits >> 16u);
-    bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
-    bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
-    bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
-    bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
-    return float(bits) * 2.3283064365386963e-10; // / 0x100000000
-}
-// ----------------------------------------------------------------------------
-vec2 Hammersley(uint i, uint N)
+// Pre-filter the environment with a GGX lobe around dir, assuming N = V = R
+void main()
 {
-    return vec2(float(i)/float(N), RadicalInverse_VdC(i));
-}  
+    vec3 N = normalize(dir);
 
-vec3 ImportanceSampleGGX(vec2 Xi, vec3 N, float roughness)
-{
-    float a = roughness*roughness;
-	
-    float phi = 2.0 * PI * Xi.x;
-    float cosTheta = sqrt((1.0 - Xi.y) / (1.0 + (a*a - 1.0) * Xi.y));
-    float sinTheta = sqrt(1.0 - cosTheta*cosTheta);
-	
-    // from spherical coordinates to cartesian coordinates
-    vec3 H;
-    H.x = cos(phi) * sinTheta;
-    H.y = sin(phi) * sinTheta;
-    H.z = cosTheta;
-	
-    // from tangent-space vector to world-space sample vector
     vec3 up        = abs(N.z) < 0.999 ? vec3(0.0, 0.0, 1.0) : vec3(1.0, 0.0, 0.0);
     vec3 tangent   = normalize(cross(up, N));
     vec3 bitangent = cross(N, tangent);
-	
-    vec3 sampleVec = tangent * H.x + bitangent * H.y + N * H.z;
-    return normalize(sampleVec);
-}  
 
-// Compute the irradiance from the hemisphere of directions centered at dir
-void main()
-{
-    vec3 N = normalize(dir);    
-    vec3 R = N;
-    vec3 V = R;
-    const uint SAMPLE_COUNT = 4096u;
-    float totalWeight = 0.0;   
-    vec3 prefilteredColor = vec3(0.0);     
-    for(uint i = 0u; i < SAMPLE_COUNT; ++i)
+    float totalWeight = 0.0;
+    vec3 prefilteredColor = vec3(0.0);
+    for(int i = sampleOffset; i < sampleOffset + sampleCount; ++i)
     {
-        vec2 Xi = Hammersley(i, SAMPLE_COUNT);
-        vec3 H  = ImportanceSampleGGX(Xi, N, roughness);
-        vec3 L  = normalize(2.0 * dot(V, H) * H - V);
-
-        float NdotL = max(dot(N, L), 0.0);
-        if(NdotL > 0.0)
-        {
-            float D   = DistributionGGX(N, H, roughness);
-            float NdotH = max(dot(N, H), 0.0);
-            float HdotV = max(dot(H, V), 0.0);
-            float pdf = D * NdotH / (4.0 * HdotV) + 0.0001; 
-
-            float saTexel  = 4.0 * PI / (6.0 * environmentMapResolution * environmentMapResolution);
-            float saSample = 1.0 / (float(SAMPLE_COUNT) * pdf + 0.0001);
-
-            float mipLevel = roughness == 0.0 ? 0.0 : 0.5 * log2(saSample / saTexel); 
-            
-            prefilteredColor += textureLod(environmentMap, L, mipLevel).rgb * NdotL;
-            totalWeight      += NdotL;
-        }
+        vec4 s = samples[i];
+        vec3 L = tangent * s.x + bitangent * s.y + N * s.z;
+        prefilteredColor += textureLod(environmentMap, L, s.w).rgb * s.z;
+        totalWeight      += s.z;
     }
     prefilteredColor = prefilteredColor / totalWeight;
 
     fragColor = vec4(prefilteredColor, 1.0);
-}
\ No newline at end of file
+}
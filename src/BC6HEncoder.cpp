@@ -0,0 +1,751 @@
+#include "BC6HEncoder.h"
+
+#include "Math.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#if defined(__AVX2__)
+#define IBL_AVX2 1
+#include <immintrin.h>
+#endif
+
+static const int indexWeights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+struct ModeInfo
+{
+    std::uint32_t modeBits;
+    int endpointBits;
+    int deltaBits; // 0 when the second endpoint is stored as is
+};
+
+// Modes 11 to 14, from least to most endpoint precision.
+static const ModeInfo modes[] = {
+    { 0x03, 10, 0 },
+    { 0x07, 11, 9 },
+    { 0x0B, 12, 8 },
+    { 0x0F, 16, 4 },
+};
+
+struct BlockTexels
+{
+    // Half bit patterns of each channel, which is what the decoder output is compared against.
+    alignas(32) float half[3][16];
+    // The same values in the 16 bit domain the decoder interpolates endpoints in.
+    float interpolated[3][16];
+};
+
+struct Encoding
+{
+    const ModeInfo* mode = nullptr;
+    int endpoints[2][3] = {};
+    std::uint8_t indices[16] = {};
+    float error = std::numeric_limits<float>::max();
+};
+
+static float ClampHalf(std::uint16_t half)
+{
+    if ((half & 0x8000) || half > 0x7C00)
+    {
+        return 0.0f; // negative or NaN
+    }
+    return (float)std::min<std::uint16_t>(half, 0x7BFF);
+}
+
+static int Unquantize(int value, int bits)
+{
+    if (bits >= 15)
+    {
+        return value;
+    }
+    if (value == 0)
+    {
+        return 0;
+    }
+    if (value == (1 << bits) - 1)
+    {
+        return 0xFFFF;
+    }
+    return ((value << 16) + 0x8000) >> bits;
+}
+
+static int Quantize(float value, int bits)
+{
+    int maxValue = (1 << bits) - 1;
+    int quantized = std::clamp((int)(value * (float)(1 << bits) / 65536.0f), 0, maxValue);
+    if (quantized < maxValue && std::abs(Unquantize(quantized + 1, bits) - value) < std::abs(Unquantize(quantized, bits) - value))
+    {
+        quantized++;
+    }
+    return quantized;
+}
+
+static bool DeltaFits(const ModeInfo& mode, const int endpoints[2][3])
+{
+    if (mode.deltaBits == 0)
+    {
+        return true;
+    }
+    int limit = 1 << (mode.deltaBits - 1);
+    for (int c = 0; c < 3; c++)
+    {
+        int delta = endpoints[1][c] - endpoints[0][c];
+        if (delta < -limit || delta >= limit)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Final decoded half bit pattern of every index, per channel.
+static void BuildPalette(const ModeInfo& mode, const int endpoints[2][3], float palette[3][16])
+{
+    for (int c = 0; c < 3; c++)
+    {
+        int a = Unquantize(endpoints[0][c], mode.endpointBits);
+        int b = Unquantize(endpoints[1][c], mode.endpointBits);
+        for (int i = 0; i < 16; i++)
+        {
+            int interpolated = (a * (64 - indexWeights[i]) + b * indexWeights[i] + 32) >> 6;
+            palette[c][i] = (float)((interpolated * 31) >> 6);
+        }
+    }
+}
+
+// Picks the closest palette entry for every texel and returns the summed squared error.
+static float SelectIndices(const BlockTexels& block, const float palette[3][16], std::uint8_t indices[16])
+{
+#if defined(IBL_AVX2)
+    __m256 total = _mm256_setzero_ps();
+    for (int t = 0; t < 16; t += 8)
+    {
+        __m256 r = _mm256_load_ps(&block.half[0][t]);
+        __m256 g = _mm256_load_ps(&block.half[1][t]);
+        __m256 b = _mm256_load_ps(&block.half[2][t]);
+        __m256 best = _mm256_set1_ps(std::numeric_limits<float>::max());
+        __m256 bestIndex = _mm256_setzero_ps();
+        for (int i = 0; i < 16; i++)
+        {
+            __m256 dr = _mm256_sub_ps(r, _mm256_set1_ps(palette[0][i]));
+            __m256 dg = _mm256_sub_ps(g, _mm256_set1_ps(palette[1][i]));
+            __m256 db = _mm256_sub_ps(b, _mm256_set1_ps(palette[2][i]));
+            __m256 error = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dr, dr), _mm256_mul_ps(dg, dg)), _mm256_mul_ps(db, db));
+            __m256 closer = _mm256_cmp_ps(error, best, _CMP_LT_OQ);
+            best = _mm256_min_ps(error, best);
+            bestIndex = _mm256_blendv_ps(bestIndex, _mm256_set1_ps((float)i), closer);
+        }
+        total = _mm256_add_ps(total, best);
+        alignas(32) std::int32_t lanes[8];
+        _mm256_store_si256((__m256i*)lanes, _mm256_cvttps_epi32(bestIndex));
+        for (int lane = 0; lane < 8; lane++)
+        {
+            indices[t + lane] = (std::uint8_t)lanes[lane];
+        }
+    }
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(total), _mm256_extractf128_ps(total, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    return _mm_cvtss_f32(sum);
+#elif defined(IBL_SSE2)
+    __m128 total = _mm_setzero_ps();
+    for (int t = 0; t < 16; t += 4)
+    {
+        __m128 r = _mm_load_ps(&block.half[0][t]);
+        __m128 g = _mm_load_ps(&block.half[1][t]);
+        __m128 b = _mm_load_ps(&block.half[2][t]);
+        __m128 best = _mm_set1_ps(std::numeric_limits<float>::max());
+        __m128 bestIndex = _mm_setzero_ps();
+        for (int i = 0; i < 16; i++)
+        {
+            __m128 dr = _mm_sub_ps(r, _mm_set1_ps(palette[0][i]));
+            __m128 dg = _mm_sub_ps(g, _mm_set1_ps(palette[1][i]));
+            __m128 db = _mm_sub_ps(b, _mm_set1_ps(palette[2][i]));
+            __m128 error = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(dg, dg)), _mm_mul_ps(db, db));
+            __m128 closer = _mm_cmplt_ps(error, best);
+            best = _mm_min_ps(error, best);
+            bestIndex = _mm_or_ps(_mm_and_ps(closer, _mm_set1_ps((float)i)), _mm_andnot_ps(closer, bestIndex));
+        }
+        total = _mm_add_ps(total, best);
+        alignas(16) std::int32_t lanes[4];
+        _mm_store_si128((__m128i*)lanes, _mm_cvttps_epi32(bestIndex));
+        for (int lane = 0; lane < 4; lane++)
+        {
+            indices[t + lane] = (std::uint8_t)lanes[lane];
+        }
+    }
+    alignas(16) float sums[4];
+    _mm_store_ps(sums, total);
+    return sums[0] + sums[1] + sums[2] + sums[3];
+#else
+    float total = 0.0f;
+    for (int t = 0; t < 16; t++)
+    {
+        float best = std::numeric_limits<float>::max();
+        for (int i = 0; i < 16; i++)
+        {
+            float dr = block.half[0][t] - palette[0][i];
+            float dg = block.half[1][t] - palette[1][i];
+            float db = block.half[2][t] - palette[2][i];
+            float error = dr * dr + dg * dg + db * db;
+            if (error < best)
+            {
+                best = error;
+                indices[t] = (std::uint8_t)i;
+            }
+        }
+        total += best;
+    }
+    return total;
+#endif
+}
+
+// Cheaper than SelectIndices: projects every texel onto the line between the first and last palette entries.
+static float ProjectIndices(const BlockTexels& block, const float palette[3][16], std::uint8_t indices[16])
+{
+    float direction[3];
+    float lengthSquared = 0.0f;
+    for (int c = 0; c < 3; c++)
+    {
+        direction[c] = palette[c][15] - palette[c][0];
+        lengthSquared += direction[c] * direction[c];
+    }
+    float scale = lengthSquared > 0.0f ? 15.0f / lengthSquared : 0.0f;
+
+    float total = 0.0f;
+    for (int t = 0; t < 16; t++)
+    {
+        float projection = 0.0f;
+        for (int c = 0; c < 3; c++)
+        {
+            projection += (block.half[c][t] - palette[c][0]) * direction[c];
+        }
+        int index = std::clamp((int)(projection * scale + 0.5f), 0, 15);
+        indices[t] = (std::uint8_t)index;
+        for (int c = 0; c < 3; c++)
+        {
+            float difference = block.half[c][t] - palette[c][index];
+            total += difference * difference;
+        }
+    }
+    return total;
+}
+
+// Texel 0 is the anchor, its index is stored without the top bit. Swapping the endpoints and mirroring the
+// indices decodes to the same palette.
+static bool FixAnchor(const ModeInfo& mode, Encoding& encoding)
+{
+    if (encoding.indices[0] < 8)
+    {
+        return true;
+    }
+    std::swap(encoding.endpoints[0], encoding.endpoints[1]);
+    for (std::uint8_t& index : encoding.indices)
+    {
+        index = (std::uint8_t)(15 - index);
+    }
+    return DeltaFits(mode, encoding.endpoints);
+}
+
+// Replaces best if the given quantized endpoints encode the block with less error.
+static void EvaluateEndpoints(const BlockTexels& block, const ModeInfo& mode, const int endpoints[2][3], bool fullSearch, Encoding& best)
+{
+    if (!DeltaFits(mode, endpoints))
+    {
+        return;
+    }
+
+    Encoding candidate;
+    candidate.mode = &mode;
+    std::memcpy(candidate.endpoints, endpoints, sizeof(candidate.endpoints));
+    float palette[3][16];
+    BuildPalette(mode, endpoints, palette);
+    candidate.error = fullSearch ? SelectIndices(block, palette, candidate.indices) : ProjectIndices(block, palette, candidate.indices);
+    if (candidate.error < best.error && FixAnchor(mode, candidate))
+    {
+        best = candidate;
+    }
+}
+
+// Quantizes unquantized line ends for the mode. With clampDelta the second endpoint is pulled in until the delta
+// fits, otherwise modes that cannot span the line are skipped.
+static void EvaluateMode(const BlockTexels& block, const ModeInfo& mode, const float lineEnds[2][3], bool fullSearch, bool clampDelta, Encoding& best)
+{
+    int endpoints[2][3];
+    for (int c = 0; c < 3; c++)
+    {
+        endpoints[0][c] = Quantize(lineEnds[0][c], mode.endpointBits);
+        endpoints[1][c] = Quantize(lineEnds[1][c], mode.endpointBits);
+        if (clampDelta && mode.deltaBits > 0)
+        {
+            int limit = 1 << (mode.deltaBits - 1);
+            endpoints[1][c] = std::clamp(endpoints[1][c], endpoints[0][c] - limit, endpoints[0][c] + limit - 1);
+            endpoints[1][c] = std::clamp(endpoints[1][c], 0, (1 << mode.endpointBits) - 1);
+        }
+    }
+    EvaluateEndpoints(block, mode, endpoints, fullSearch, best);
+}
+
+// Principal axis of the texels, clipped to their extent along it. The end nearest texel 0 comes first so the
+// anchor rarely needs flipping after quantization.
+static void FitLine(const BlockTexels& block, float lineEnds[2][3])
+{
+    float mean[3] = {};
+    for (int c = 0; c < 3; c++)
+    {
+        for (int t = 0; t < 16; t++)
+        {
+            mean[c] += block.interpolated[c][t];
+        }
+        mean[c] /= 16.0f;
+    }
+
+    float covariance[3][3] = {};
+    for (int t = 0; t < 16; t++)
+    {
+        float d[3];
+        for (int c = 0; c < 3; c++)
+        {
+            d[c] = block.interpolated[c][t] - mean[c];
+        }
+        for (int i = 0; i < 3; i++)
+        {
+            for (int j = 0; j < 3; j++)
+            {
+                covariance[i][j] += d[i] * d[j];
+            }
+        }
+    }
+
+    // Power iteration, starting from the column of the dominant channel.
+    int dominant = 0;
+    for (int c = 1; c < 3; c++)
+    {
+        if (covariance[c][c] > covariance[dominant][dominant])
+        {
+            dominant = c;
+        }
+    }
+    float axis[3] = { covariance[0][dominant], covariance[1][dominant], covariance[2][dominant] };
+    for (int iteration = 0; iteration < 8; iteration++)
+    {
+        float next[3];
+        for (int i = 0; i < 3; i++)
+        {
+            next[i] = covariance[i][0] * axis[0] + covariance[i][1] * axis[1] + covariance[i][2] * axis[2];
+        }
+        float length = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+        if (length < 1e-20f)
+        {
+            break;
+        }
+        for (int i = 0; i < 3; i++)
+        {
+            axis[i] = next[i] / length;
+        }
+    }
+    float axisLength = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+    if (axisLength < 1e-20f)
+    {
+        // Solid block.
+        for (int c = 0; c < 3; c++)
+        {
+            lineEnds[0][c] = lineEnds[1][c] = mean[c];
+        }
+        return;
+    }
+    for (int c = 0; c < 3; c++)
+    {
+        axis[c] /= axisLength;
+    }
+
+    float minProjection = std::numeric_limits<float>::max();
+    float maxProjection = -std::numeric_limits<float>::max();
+    float anchorProjection = 0.0f;
+    for (int t = 0; t < 16; t++)
+    {
+        float projection = 0.0f;
+        for (int c = 0; c < 3; c++)
+        {
+            projection += (block.interpolated[c][t] - mean[c]) * axis[c];
+        }
+        minProjection = std::min(minProjection, projection);
+        maxProjection = std::max(maxProjection, projection);
+        if (t == 0)
+        {
+            anchorProjection = projection;
+        }
+    }
+    if (anchorProjection > 0.5f * (minProjection + maxProjection))
+    {
+        std::swap(minProjection, maxProjection);
+    }
+    for (int c = 0; c < 3; c++)
+    {
+        lineEnds[0][c] = std::clamp(mean[c] + minProjection * axis[c], 0.0f, 65535.0f);
+        lineEnds[1][c] = std::clamp(mean[c] + maxProjection * axis[c], 0.0f, 65535.0f);
+    }
+}
+
+// Least squares endpoints for fixed indices, in the interpolation domain.
+static void RefineLine(const BlockTexels& block, const std::uint8_t indices[16], float lineEnds[2][3])
+{
+    float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+    float ax[3] = {}, bx[3] = {};
+    for (int t = 0; t < 16; t++)
+    {
+        float b = indexWeights[indices[t]] / 64.0f;
+        float a = 1.0f - b;
+        aa += a * a;
+        ab += a * b;
+        bb += b * b;
+        for (int c = 0; c < 3; c++)
+        {
+            ax[c] += a * block.interpolated[c][t];
+            bx[c] += b * block.interpolated[c][t];
+        }
+    }
+    float determinant = aa * bb - ab * ab;
+    if (determinant < 1e-6f)
+    {
+        return;
+    }
+    for (int c = 0; c < 3; c++)
+    {
+        lineEnds[0][c] = std::clamp((ax[c] * bb - bx[c] * ab) / determinant, 0.0f, 65535.0f);
+        lineEnds[1][c] = std::clamp((bx[c] * aa - ax[c] * ab) / determinant, 0.0f, 65535.0f);
+    }
+}
+
+// Hill climb over the quantized endpoints, one step of one channel at a time.
+static void PerturbEndpoints(const BlockTexels& block, Encoding& best)
+{
+    const ModeInfo& mode = *best.mode;
+    int maxValue = (1 << mode.endpointBits) - 1;
+    for (int pass = 0; pass < 4; pass++)
+    {
+        bool improved = false;
+        for (int e = 0; e < 2; e++)
+        {
+            for (int c = 0; c < 3; c++)
+            {
+                for (int step = -1; step <= 1; step += 2)
+                {
+                    int endpoints[2][3];
+                    std::memcpy(endpoints, best.endpoints, sizeof(endpoints));
+                    endpoints[e][c] += step;
+                    if (endpoints[e][c] < 0 || endpoints[e][c] > maxValue)
+                    {
+                        continue;
+                    }
+                    float previousError = best.error;
+                    EvaluateEndpoints(block, mode, endpoints, true, best);
+                    improved |= best.error < previousError;
+                }
+            }
+        }
+        if (!improved)
+        {
+            break;
+        }
+    }
+}
+
+struct BitWriter
+{
+    void Write(std::uint32_t value, int count)
+    {
+        for (int i = 0; i < count; i++, position++)
+        {
+            if ((value >> i) & 1)
+            {
+                bits[position >> 6] |= 1ull << (position & 63);
+            }
+        }
+    }
+
+    std::uint64_t bits[2] = {};
+    int position = 0;
+};
+
+static void WriteBlock(const Encoding& encoding, std::uint8_t* destination)
+{
+    const ModeInfo& mode = *encoding.mode;
+    BitWriter writer;
+    writer.Write(mode.modeBits, 5);
+    for (int c = 0; c < 3; c++)
+    {
+        writer.Write(encoding.endpoints[0][c] & 0x3FF, 10);
+    }
+    for (int c = 0; c < 3; c++)
+    {
+        if (mode.deltaBits == 0)
+        {
+            writer.Write(encoding.endpoints[1][c], 10);
+            continue;
+        }
+        writer.Write((encoding.endpoints[1][c] - encoding.endpoints[0][c]) & ((1 << mode.deltaBits) - 1), mode.deltaBits);
+        // Base endpoint bits above the first ten follow the delta, most significant first.
+        for (int bit = mode.endpointBits - 1; bit >= 10; bit--)
+        {
+            writer.Write((encoding.endpoints[0][c] >> bit) & 1, 1);
+        }
+    }
+    writer.Write(encoding.indices[0], 3);
+    for (int t = 1; t < 16; t++)
+    {
+        writer.Write(encoding.indices[t], 4);
+    }
+
+    for (int i = 0; i < 16; i++)
+    {
+        destination[i] = (std::uint8_t)(writer.bits[i / 8] >> ((i % 8) * 8));
+    }
+}
+
+void EncodeBlockBC6H(const std::uint16_t* texels, BC6HQuality quality, std::uint8_t* destination)
+{
+    BlockTexels block;
+    for (int t = 0; t < 16; t++)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            float half = ClampHalf(texels[t * 4 + c]);
+            block.half[c][t] = half;
+            // Centre of the range of interpolated values that decode to this half.
+            block.interpolated[c][t] = (half + 0.5f) * (64.0f / 31.0f);
+        }
+    }
+
+    float lineEnds[2][3];
+    FitLine(block, lineEnds);
+
+    Encoding best;
+    if (quality == BC6HQuality::Fast)
+    {
+        // Most precise mode whose delta can span the line. Mode 11 has no delta so it always fits.
+        for (int m = 3; m >= 0 && !best.mode; m--)
+        {
+            EvaluateMode(block, modes[m], lineEnds, false, false, best);
+        }
+    }
+    else
+    {
+        int refinements = quality == BC6HQuality::Slow ? 3 : 1;
+        for (const ModeInfo& mode : modes)
+        {
+            Encoding modeBest;
+            float modeLineEnds[2][3];
+            std::memcpy(modeLineEnds, lineEnds, sizeof(modeLineEnds));
+            EvaluateMode(block, mode, modeLineEnds, true, true, modeBest);
+            for (int i = 0; i < refinements && modeBest.mode; i++)
+            {
+                RefineLine(block, modeBest.indices, modeLineEnds);
+                EvaluateMode(block, mode, modeLineEnds, true, true, modeBest);
+            }
+            if (modeBest.error < best.error)
+            {
+                best = modeBest;
+            }
+        }
+        if (quality == BC6HQuality::Slow && best.mode)
+        {
+            PerturbEndpoints(block, best);
+        }
+    }
+
+    WriteBlock(best, destination);
+}
+
+// Decoder. Every mode is described by the runs of bits its header is made of, in the order they are stored, so
+// blocks from ISPCTextureCompressor's two region modes decode as well as the built-in encoder's.
+
+enum EndpointField : std::uint8_t
+{
+    RW, GW, BW, // region 0, first endpoint
+    RX, GX, BX, // region 0, second endpoint
+    RY, GY, BY, // region 1, first endpoint
+    RZ, GZ, BZ, // region 1, second endpoint
+    PARTITION
+};
+
+// Bits first to last of a field, stored in that order. Runs with first > last are stored most significant first.
+struct BitRun
+{
+    std::uint8_t field;
+    std::uint8_t first;
+    std::uint8_t last;
+};
+
+struct DecodeMode
+{
+    int regions;
+    bool transformed; // second and region 1 endpoints are deltas from the first
+    int endpointBits;
+    int deltaBits[3];
+    BitRun runs[26]; // the header after the mode bits
+    int runCount;
+};
+
+// Modes 1 to 14 of the D3D11 specification, in that order.
+static const DecodeMode decodeModes[] = {
+    { 2, true, 10, { 5, 5, 5 }, { { GY, 4, 4 }, { BY, 4, 4 }, { BZ, 4, 4 }, { RW, 0, 9 }, { GW, 0, 9 }, { BW, 0, 9 }, { RX, 0, 4 },
+        { GZ, 4, 4 }, { GY, 0, 3 }, { GX, 0, 4 }, { BZ, 0, 0 }, { GZ, 0, 3 }, { BX, 0, 4 }, { BZ, 1, 1 }, { BY, 0, 3 }, { RY, 0, 4 },
+        { BZ, 2, 2 }, { RZ, 0, 4 }, { BZ, 3, 3 }, { PARTITION, 0, 4 } }, 20 },
+    { 2, true, 7, { 6, 6, 6 }, { { GY, 5, 5 }, { GZ, 4, 4 }, { GZ, 5, 5 }, { RW, 0, 6 }, { BZ, 0, 0 }, { BZ, 1, 1 }, { BY, 4, 4 },
+        { GW, 0, 6 }, { BY, 5, 5 }, { BZ, 2, 2 }, { GY, 4, 4 }, { BW, 0, 6 }, { BZ, 3, 3 }, { BZ, 5, 5 }, { BZ, 4, 4 }, { RX, 0, 5 },
+        { GY, 0, 3 }, { GX, 0, 5 }, { GZ, 0, 3 }, { BX, 0, 5 }, { BY, 0, 3 }, { RY, 0, 5 }, { RZ, 0, 5 }, { PARTITION, 0, 4 } }, 24 },
+    { 2, true, 11, { 5, 4, 4 }, { { RW, 0, 9 }, { GW, 0, 9 }, { BW, 0, 9 }, { RX, 0, 4 }, { RW, 10, 10 }, { GY, 0, 3 }, { GX, 0, 3 },
+        { GW, 10, 10 }, { BZ, 0, 0 }, { GZ, 0, 3 }, { BX, 0, 3 }, { BW, 10, 10 }, { BZ, 1, 1 }, { BY, 0, 3 }, { RY, 0, 4 }, { BZ, 2, 2 },
+        { RZ, 0, 4 }, { BZ, 3, 3 }, { PARTITION, 0, 4 } }, 19 },
+    { 2, true, 11, { 4, 5, 4 }, { { RW, 0, 9 }, { GW, 0, 9 }, { BW, 0, 9 }, { RX, 0, 3 }, { RW, 10, 10 }, { GZ, 4, 4 }, { GY, 0, 3 },
+        { GX, 0, 4 }, { GW, 10, 10 }, { GZ, 0, 3 }, { BX, 0, 3 }, { BW, 10, 10 }, { BZ, 1, 1 }, { BY, 0, 3 }, { RY, 0, 3 }, { BZ, 0, 0 },
+        { BZ, 2, 2 }, { RZ, 0, 3 }, { GY, 4, 4 }, { BZ, 3, 3 }, { PARTITION, 0, 4 } }, 21 },
+    { 2, true, 11, { 4, 4, 5 }, { { RW, 0, 9 }, { GW, 0, 9 }, { BW, 0, 9 }, { RX, 0, 3 }, { RW, 10, 10 }, { BY, 4, 4 }, { GY, 0, 3 },
+        { GX, 0, 3 }, { GW, 10, 10 }, { BZ, 0, 0 }, { GZ, 0, 3 }, { BX, 0, 4 }, { BW, 10, 10 }, { BY, 0, 3 }, { RY, 0, 3 }, { BZ, 1, 1 },
+        { BZ, 2, 2 }, { RZ, 0, 3 }, { BZ, 4, 4 }, { BZ, 3, 3 }, { PARTITION, 0, 4 } }, 21 },
+    { 2, true, 9, { 5, 5, 5 }, { { RW, 0, 8 }, { BY, 4, 4 }, { GW, 0, 8 }, { GY, 4, 4 }, { BW, 0, 8 }, { BZ, 4, 4 }, { RX, 0, 4 },
+        { GZ, 4, 4 }, { GY, 0, 3 }, { GX, 0, 4 }, { BZ, 0, 0 }, { GZ, 0, 3 }, { BX, 0, 4 }, { BZ, 1, 1 }, { BY, 0, 3 }, { RY, 0, 4 },
+        { BZ, 2, 2 }, { RZ, 0, 4 }, { BZ, 3, 3 }, { PARTITION, 0, 4 } }, 20 },
+    { 2, true, 8, { 6, 5, 5 }, { { RW, 0, 7 }, { GZ, 4, 4 }, { BY, 4, 4 }, { GW, 0, 7 }, { BZ, 2, 2 }, { GY, 4, 4 }, { BW, 0, 7 },
+        { BZ, 3, 3 }, { BZ, 4, 4 }, { RX, 0, 5 }, { GY, 0, 3 }, { GX, 0, 4 }, { BZ, 0, 0 }, { GZ, 0, 3 }, { BX, 0, 4 }, { BZ, 1, 1 },
+        { BY, 0, 3 }, { RY, 0, 5 }, { RZ, 0, 5 }, { PARTITION, 0, 4 } }, 20 },
+    { 2, true, 8, { 5, 6, 5 }, { { RW, 0, 7 }, { BZ, 0, 0 }, { BY, 4, 4 }, { GW, 0, 7 }, { GY, 5, 5 }, { GY, 4, 4 }, { BW, 0, 7 },
+        { GZ, 5, 5 }, { BZ, 4, 4 }, { RX, 0, 4 }, { GZ, 4, 4 }, { GY, 0, 3 }, { GX, 0, 5 }, { GZ, 0, 3 }, { BX, 0, 4 }, { BZ, 1, 1 },
+        { BY, 0, 3 }, { RY, 0, 4 }, { BZ, 2, 2 }, { RZ, 0, 4 }, { BZ, 3, 3 }, { PARTITION, 0, 4 } }, 22 },
+    { 2, true, 8, { 5, 5, 6 }, { { RW, 0, 7 }, { BZ, 1, 1 }, { BY, 4, 4 }, { GW, 0, 7 }, { BY, 5, 5 }, { GY, 4, 4 }, { BW, 0, 7 },
+        { BZ, 5, 5 }, { BZ, 4, 4 }, { RX, 0, 4 }, { GZ, 4, 4 }, { GY, 0, 3 }, { GX, 0, 4 }, { BZ, 0, 0 }, { GZ, 0, 3 }, { BX, 0, 5 },
+        { BY, 0, 3 }, { RY, 0, 4 }, { BZ, 2, 2 }, { RZ, 0, 4 }, { BZ, 3, 3 }, { PARTITION, 0, 4 } }, 22 },
+    { 2, false, 6, { 6, 6, 6 }, { { RW, 0, 5 }, { GZ, 4, 4 }, { BZ, 0, 0 }, { BZ, 1, 1 }, { BY, 4, 4 }, { GW, 0, 5 }, { GY, 5, 5 },
+        { BY, 5, 5 }, { BZ, 2, 2 }, { GY, 4, 4 }, { BW, 0, 5 }, { GZ, 5, 5 }, { BZ, 3, 3 }, { BZ, 5, 5 }, { BZ, 4, 4 }, { RX, 0, 5 },
+        { GY, 0, 3 }, { GX, 0, 5 }, { GZ, 0, 3 }, { BX, 0, 5 }, { BY, 0, 3 }, { RY, 0, 5 }, { RZ, 0, 5 }, { PARTITION, 0, 4 } }, 24 },
+    { 1, false, 10, { 10, 10, 10 }, { { RW, 0, 9 }, { GW, 0, 9 }, { BW, 0, 9 }, { RX, 0, 9 }, { GX, 0, 9 }, { BX, 0, 9 } }, 6 },
+    { 1, true, 11, { 9, 9, 9 }, { { RW, 0, 9 }, { GW, 0, 9 }, { BW, 0, 9 }, { RX, 0, 8 }, { RW, 10, 10 }, { GX, 0, 8 }, { GW, 10, 10 },
+        { BX, 0, 8 }, { BW, 10, 10 } }, 9 },
+    { 1, true, 12, { 8, 8, 8 }, { { RW, 0, 9 }, { GW, 0, 9 }, { BW, 0, 9 }, { RX, 0, 7 }, { RW, 11, 10 }, { GX, 0, 7 }, { GW, 11, 10 },
+        { BX, 0, 7 }, { BW, 11, 10 } }, 9 },
+    { 1, true, 16, { 4, 4, 4 }, { { RW, 0, 9 }, { GW, 0, 9 }, { BW, 0, 9 }, { RX, 0, 3 }, { RW, 15, 10 }, { GX, 0, 3 }, { GW, 15, 10 },
+        { BX, 0, 3 }, { BW, 15, 10 } }, 9 },
+};
+
+// The first 32 two subset partitions of BC7, bit t set when texel t is in region 1, and the anchor texel of
+// region 1 in each.
+static const std::uint16_t partitions[32] = {
+    0xCCCC, 0x8888, 0xEEEE, 0xECC8, 0xC880, 0xFEEC, 0xFEC8, 0xEC80, 0xC800, 0xFFEC, 0xFE80, 0xE800, 0xFFE8, 0xFF00, 0xFFF0, 0xF000,
+    0xF710, 0x008E, 0x7100, 0x08CE, 0x008C, 0x7310, 0x3100, 0x8CCE, 0x088C, 0x3110, 0x6666, 0x366C, 0x17E8, 0x0FF0, 0x718E, 0x399C,
+};
+static const std::uint8_t partitionAnchors[32] = {
+    15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+    15, 2, 8, 2, 2, 8, 8, 15, 2, 8, 2, 2, 8, 8, 2, 2,
+};
+
+struct BitReader
+{
+    std::uint32_t Read(int count)
+    {
+        std::uint32_t value = 0;
+        for (int i = 0; i < count; i++, position++)
+        {
+            value |= (std::uint32_t)((bits[position >> 6] >> (position & 63)) & 1) << i;
+        }
+        return value;
+    }
+
+    std::uint64_t bits[2] = {};
+    int position = 0;
+};
+
+static int SignExtend(int value, int bits)
+{
+    return (value & (1 << (bits - 1))) ? value - (1 << bits) : value;
+}
+
+void DecodeBlockBC6H(const std::uint8_t* block, std::uint16_t* texels)
+{
+    BitReader reader;
+    for (int i = 0; i < 16; i++)
+    {
+        reader.bits[i / 8] |= (std::uint64_t)block[i] << ((i % 8) * 8);
+    }
+
+    // Modes 1 and 2 take two bits, the rest five.
+    int modeIndex = -1;
+    std::uint32_t modeBits = reader.Read(2);
+    if (modeBits < 2)
+    {
+        modeIndex = (int)modeBits;
+    }
+    else
+    {
+        modeBits |= reader.Read(3) << 2;
+        static const int fiveBitModes[32] = {
+            -1, -1, 2, 10, -1, -1, 3, 11, -1, -1, 4, 12, -1, -1, 5, 13,
+            -1, -1, 6, -1, -1, -1, 7, -1, -1, -1, 8, -1, -1, -1, 9, -1,
+        };
+        modeIndex = fiveBitModes[modeBits];
+    }
+    if (modeIndex < 0)
+    {
+        // Reserved mode.
+        for (int t = 0; t < 16; t++)
+        {
+            texels[t * 4 + 0] = texels[t * 4 + 1] = texels[t * 4 + 2] = 0;
+            texels[t * 4 + 3] = 0x3C00;
+        }
+        return;
+    }
+
+    const DecodeMode& mode = decodeModes[modeIndex];
+    int fields[13] = {};
+    for (int r = 0; r < mode.runCount; r++)
+    {
+        const BitRun& run = mode.runs[r];
+        int step = run.first <= run.last ? 1 : -1;
+        for (int bit = run.first;; bit += step)
+        {
+            fields[run.field] |= (int)reader.Read(1) << bit;
+            if (bit == run.last)
+            {
+                break;
+            }
+        }
+    }
+
+    // endpoints[region * 2 + end][channel]
+    int endpoints[4][3];
+    int mask = (1 << mode.endpointBits) - 1;
+    for (int e = 0; e < mode.regions * 2; e++)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            int value = fields[e * 3 + c];
+            if (mode.transformed && e > 0)
+            {
+                value = (fields[c] + SignExtend(value, mode.deltaBits[c])) & mask;
+            }
+            endpoints[e][c] = Unquantize(value, mode.endpointBits);
+        }
+    }
+
+    static const int threeBitWeights[8] = { 0, 9, 18, 27, 37, 46, 55, 64 };
+    const int* weights = mode.regions == 1 ? indexWeights : threeBitWeights;
+    int indexBits = mode.regions == 1 ? 4 : 3;
+    std::uint16_t partition = mode.regions == 1 ? 0 : partitions[fields[PARTITION]];
+    int anchor = mode.regions == 1 ? 0 : partitionAnchors[fields[PARTITION]];
+    for (int t = 0; t < 16; t++)
+    {
+        // Anchor texels drop the most significant index bit, which is always zero.
+        int index = (int)reader.Read(t == 0 || (mode.regions == 2 && t == anchor) ? indexBits - 1 : indexBits);
+        int region = (partition >> t) & 1;
+        const int* a = endpoints[region * 2];
+        const int* b = endpoints[region * 2 + 1];
+        for (int c = 0; c < 3; c++)
+        {
+            int interpolated = (a[c] * (64 - weights[index]) + b[c] * weights[index] + 32) >> 6;
+            texels[t * 4 + c] = (std::uint16_t)((interpolated * 31) >> 6);
+        }
+        texels[t * 4 + 3] = 0x3C00;
+    }
+}
@@ -0,0 +1,27 @@
+#ifndef BC6H_ENCODER_H
+#define BC6H_ENCODER_H
+
+#include <cstdint>
+
+// Speed/quality trade off of the BC6H compressor. Fast picks a single mode and projects texels onto the endpoint
+// line, Basic tries every mode with a full index search and one endpoint refinement, Slow adds more refinement and
+// a local search over the quantized endpoints.
+enum class BC6HQuality
+{
+    Fast,
+    Basic,
+    Slow
+};
+
+// Built-in BC6H_UF16 block encoder used when the project is not configured against ISPCTextureCompressor.
+// Only the single region modes (11 to 14) are emitted. Environment maps are smooth enough that the two region modes
+// rarely win, and leaving them out keeps the encoder small and fast.
+// texels holds the 16 RGBA16F texels of the block in row-major order, alpha is ignored. Negative values are
+// clamped to zero and infinities to the largest finite half. Writes 16 bytes to destination.
+void EncodeBlockBC6H(const std::uint16_t* texels, BC6HQuality quality, std::uint8_t* destination);
+
+// Decodes a 16 byte BC6H_UF16 block of any mode into 16 RGBA16F texels in row-major order, alpha 1, bit exact
+// with the D3D11 reference decoder. Reserved modes decode to black.
+void DecodeBlockBC6H(const std::uint8_t* block, std::uint16_t* texels);
+
+#endif // !BC6H_ENCODER_H
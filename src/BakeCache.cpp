@@ -0,0 +1,491 @@
+#include "BakeCache.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <initializer_list>
+#include <iostream>
+#include <random>
+#include <sstream>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__APPLE__)
+#include <mach-o/dyld.h>
+#endif
+
+#ifndef IBL_VERSION
+#define IBL_VERSION "unknown"
+#endif
+
+namespace fs = std::filesystem;
+
+void ContentHash::Update(const std::string& text)
+{
+    std::uint64_t length = text.size();
+    Update(&length, sizeof(length));
+    Update(text.data(), text.size());
+}
+
+bool ContentHash::UpdateFile(const std::string& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        return false;
+    }
+    std::vector<char> buffer(1 << 20);
+    while (file)
+    {
+        file.read(buffer.data(), buffer.size());
+        Update(buffer.data(), (size_t)file.gcount());
+    }
+    return file.eof();
+}
+
+std::string ContentHash::Hex() const
+{
+    char text[17];
+    std::snprintf(text, sizeof(text), "%016llx", (unsigned long long)hash);
+    return text;
+}
+
+// Path of the running executable, empty if the platform doesn't tell.
+static std::string ExecutablePath()
+{
+#if defined(_WIN32)
+    char path[MAX_PATH];
+    DWORD length = GetModuleFileNameA(nullptr, path, MAX_PATH);
+    return length > 0 && length < MAX_PATH ? std::string(path, length) : std::string();
+#elif defined(__APPLE__)
+    char path[4096];
+    std::uint32_t size = sizeof(path);
+    return _NSGetExecutablePath(path, &size) == 0 ? std::string(path) : std::string();
+#else
+    std::error_code error;
+    return fs::read_symlink("/proc/self/exe", error).string();
+#endif
+}
+
+std::string BuildIdentifier()
+{
+    static const std::string identifier = []
+    {
+        ContentHash hash;
+        std::string path = ExecutablePath();
+        if (path.empty() || !hash.UpdateFile(path))
+        {
+            std::cout << "Failed to read the executable, cache keys only hold the version " << IBL_VERSION << "\n";
+            return std::string(IBL_VERSION);
+        }
+        return std::string(IBL_VERSION) + "-" + hash.Hex();
+    }();
+    return identifier;
+}
+
+std::vector<std::string> ConvoluteOutputFiles(const ConvoluteSettings& settings)
+{
+    std::vector<std::string> files = { "envmap.cbmp" };
+    if (settings.irradianceMode != IrradianceMode::SHCoefficientsOnly)
+    {
+        files.push_back("irradiance.cbmp");
+    }
+    if (settings.irradianceMode != IrradianceMode::BruteForce)
+    {
+        files.push_back("irradiance.sh");
+    }
+    files.push_back("prefilter.cbmp");
+    if (settings.writeUncompressed)
+    {
+        for (size_t i = 0, count = files.size(); i < count; i++)
+        {
+            if (files[i].ends_with(".cbmp"))
+            {
+                files.push_back(UncompressedFileName(files[i]));
+            }
+        }
+    }
+    return files;
+}
+
+BakeCache::BakeCache(const std::string& directory, std::uint64_t maxBytes)
+    : directory(directory), maxBytes(maxBytes)
+{
+    std::error_code error;
+    fs::create_directories(directory, error);
+    if (error)
+    {
+        std::cout << "Failed to create cache directory '" << directory << "': " << error.message() << "\n";
+    }
+}
+
+std::string BakeCache::Key(const std::string& hdriPath, const ConvoluteSettings& settings, const char* backend)
+{
+    ContentHash hash;
+    std::ostringstream parameters;
+    // Floats as hex so that the key doesn't depend on decimal rounding.
+    parameters << std::hexfloat
+        << "build=" << BuildIdentifier()
+        << ";backend=" << backend
+        << ";resolution=" << settings.resolution
+        << ";maxRadiance=" << settings.maxRadiance
+        << ";irradiance=" << (int)settings.irradianceMode
+        << ";shBands=" << settings.shBands
+        << ";bc6h=" << (int)settings.compressionQuality
+        << ";irradianceResolution=" << settings.irradianceResolution
+        << ";prefilterResolution=" << settings.prefilterResolution
+        << ";prefilterMips=" << settings.prefilterMipLevels
+        << ";prefilterError=" << settings.prefilterErrorTarget
+        << ";pipeline=" << (int)settings.glPipeline
+        << ";equirectFilter=" << (int)settings.equirectFilter
+        << ";mipFilter=" << (int)settings.mipFilter
+        << ";stream=" << settings.streamHdri
+        << ";fileVersion=" << settings.fileVersion
+        << ";order=" << (int)settings.fileOrder
+        << ";supercompress=" << settings.supercompress
+        << ";uncompressed=" << settings.writeUncompressed;
+    hash.Update(parameters.str());
+
+    if (!hash.UpdateFile(hdriPath))
+    {
+        return std::string();
+    }
+
+    // The CPU backend doesn't read the shaders, and they are found relative to the working directory.
+    if (std::string(backend) != "gl")
+    {
+        return hash.Hex();
+    }
+    // Sorted, because directory iteration order is unspecified.
+    std::vector<fs::path> shaders;
+    std::error_code error;
+    for (const fs::directory_entry& entry : fs::directory_iterator("Shaders", error))
+    {
+        if (entry.is_regular_file())
+        {
+            shaders.push_back(entry.path());
+        }
+    }
+    std::sort(shaders.begin(), shaders.end());
+    for (const fs::path& shader : shaders)
+    {
+        hash.Update(shader.filename().string());
+        hash.UpdateFile(shader.string());
+    }
+    return hash.Hex();
+}
+
+std::string BakeCache::BrdfLutKey(const char* table, const BrdfLutSettings& settings, const char* backend)
+{
+    ContentHash hash;
+    std::ostringstream parameters;
+    parameters << table
+        << ";build=" << BuildIdentifier()
+        << ";backend=" << backend
+        << ";resolution=" << settings.resolution
+        << ";samples=" << settings.sampleCount
+        << ";format=" << (int)settings.format
+        << ";multiScatter=" << settings.multiScatter;
+    hash.Update(parameters.str());
+    if (std::string(backend) == "gl")
+    {
+        for (const char* shader : { "Shaders/fullscreen.vert", "Shaders/brdfLUT.frag" })
+        {
+            hash.Update(shader);
+            hash.UpdateFile(shader);
+        }
+    }
+    return hash.Hex();
+}
+
+bool BakeCache::Restore(const std::string& key, const ConvoluteSettings& settings)
+{
+    return Restore(key, ConvoluteOutputFiles(settings), settings.outputDirectory);
+}
+
+bool BakeCache::Restore(const std::string& key, const std::vector<std::string>& files, const std::string& outputDirectory)
+{
+    fs::path entry = fs::path(directory) / key;
+    std::error_code error;
+    if (!fs::is_directory(entry, error))
+    {
+        return false;
+    }
+    for (const std::string& file : files)
+    {
+        fs::copy_file(entry / file, fs::path(outputDirectory) / file, fs::copy_options::overwrite_existing, error);
+        if (error)
+        {
+            // Damaged or evicted under us; fall back to baking.
+            return false;
+        }
+    }
+    fs::last_write_time(entry, fs::file_time_type::clock::now(), error);
+    return true;
+}
+
+void BakeCache::Store(const std::string& key, const ConvoluteSettings& settings)
+{
+    Store(key, ConvoluteOutputFiles(settings), settings.outputDirectory);
+}
+
+void BakeCache::Store(const std::string& key, const std::vector<std::string>& files, const std::string& outputDirectory)
+{
+    fs::path entry = fs::path(directory) / key;
+    std::error_code error;
+    if (fs::is_directory(entry, error))
+    {
+        return;
+    }
+
+    std::random_device random;
+    fs::path staging = fs::path(directory) / (key + ".tmp" + std::to_string(random()));
+    fs::create_directories(staging, error);
+    for (const std::string& file : files)
+    {
+        if (!error)
+        {
+            fs::copy_file(fs::path(outputDirectory) / file, staging / file, error);
+        }
+    }
+    if (!error)
+    {
+        fs::rename(staging, entry, error);
+    }
+    if (error)
+    {
+        // Another bake may have published the same key first, which is fine.
+        fs::remove_all(staging, error);
+        return;
+    }
+    Evict(key);
+}
+
+void BakeCache::Evict(const std::string& keep)
+{
+    struct Entry
+    {
+        fs::path path;
+        fs::file_time_type lastUse;
+        std::uint64_t bytes;
+    };
+    std::vector<Entry> entries;
+    std::uint64_t totalBytes = 0;
+    std::error_code error;
+    for (const fs::directory_entry& entry : fs::directory_iterator(directory, error))
+    {
+        // Staging directories of bakes still in flight aren't counted or touched.
+        if (!entry.is_directory() || entry.path().filename().string().find(".tmp") != std::string::npos)
+        {
+            continue;
+        }
+        std::uint64_t bytes = 0;
+        for (const fs::directory_entry& file : fs::directory_iterator(entry.path(), error))
+        {
+            bytes += file.is_regular_file() ? file.file_size() : 0;
+        }
+        entries.push_back({ entry.path(), fs::last_write_time(entry.path(), error), bytes });
+        totalBytes += bytes;
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.lastUse < b.lastUse; });
+    for (const Entry& entry : entries)
+    {
+        if (totalBytes <= maxBytes)
+        {
+            break;
+        }
+        if (entry.path.filename() == keep)
+        {
+            continue;
+        }
+        fs::remove_all(entry.path, error);
+        if (!error)
+        {
+            totalBytes -= entry.bytes;
+        }
+    }
+}
+
+static const char* const stageNames[] = { "envmap", "irradiance", "prefilter" };
+
+// Hash of the stage's output files, so that base.key can't vouch for files another bake overwrote since. Empty if
+// one of them is missing.
+static std::string StageFileHash(const ConvoluteSettings& settings, IncrementalStage stage)
+{
+    ContentHash hash;
+    for (const std::string& file : ConvoluteOutputFiles(settings))
+    {
+        if (file.starts_with(stageNames[(int)stage]) && !hash.UpdateFile(settings.OutputPath(file.c_str())))
+        {
+            return std::string();
+        }
+    }
+    return hash.Hex();
+}
+
+// Shaders are only read by the gl backend, relative to the working directory.
+static void HashShaders(ContentHash& hash, const char* backend, std::initializer_list<const char*> shaders)
+{
+    if (std::string(backend) != "gl")
+    {
+        return;
+    }
+    for (const char* shader : shaders)
+    {
+        hash.Update(shader);
+        hash.UpdateFile(shader);
+    }
+}
+
+void IncrementalBase::Open(const char* hdriPath, const ConvoluteSettings& settings, const char* backend)
+{
+    if (!settings.incremental)
+    {
+        return;
+    }
+    this->settings = &settings;
+
+    ContentHash hash;
+    std::ostringstream parameters;
+    parameters << std::hexfloat
+        << "build=" << BuildIdentifier()
+        << ";backend=" << backend
+        << ";resolution=" << settings.resolution
+        << ";maxRadiance=" << settings.maxRadiance
+        << ";pipeline=" << (int)settings.glPipeline
+        << ";equirectFilter=" << (int)settings.equirectFilter
+        << ";mipFilter=" << (int)settings.mipFilter
+        << ";stream=" << settings.streamHdri;
+    hash.Update(parameters.str());
+    if (!hash.UpdateFile(hdriPath))
+    {
+        return;
+    }
+    HashShaders(hash, backend, { "Shaders/equirectToCubemap.vert", "Shaders/equirectToCubemap.frag", "Shaders/equirectToCubemap.comp" });
+    baseKey = hash.Hex();
+
+    // Every stage key extends the base key with what that stage's outputs depend on.
+    std::ostringstream fileParameters;
+    fileParameters << ";bc6h=" << (int)settings.compressionQuality
+        << ";fileVersion=" << settings.fileVersion
+        << ";order=" << (int)settings.fileOrder
+        << ";supercompress=" << settings.supercompress
+        << ";uncompressed=" << settings.writeUncompressed;
+
+    ContentHash envmapHash = hash;
+    envmapHash.Update("envmap" + fileParameters.str());
+    stageKeys[(int)IncrementalStage::Envmap] = envmapHash.Hex();
+
+    ContentHash irradianceHash = hash;
+    std::ostringstream irradianceParameters;
+    irradianceParameters << "irradiance" << fileParameters.str()
+        << ";irradiance=" << (int)settings.irradianceMode
+        << ";shBands=" << settings.shBands
+        << ";irradianceResolution=" << settings.irradianceResolution;
+    irradianceHash.Update(irradianceParameters.str());
+    HashShaders(irradianceHash, backend, { "Shaders/convolute.frag", "Shaders/convolute.comp" });
+    stageKeys[(int)IncrementalStage::Irradiance] = irradianceHash.Hex();
+
+    ContentHash prefilterHash = hash;
+    std::ostringstream prefilterParameters;
+    prefilterParameters << std::hexfloat << "prefilter" << fileParameters.str()
+        << ";prefilterResolution=" << settings.prefilterResolution
+        << ";prefilterMips=" << settings.prefilterMipLevels
+        << ";prefilterError=" << settings.prefilterErrorTarget;
+    prefilterHash.Update(prefilterParameters.str());
+    HashShaders(prefilterHash, backend, { "Shaders/prefilter.frag", "Shaders/prefilter.comp" });
+    stageKeys[(int)IncrementalStage::Prefilter] = prefilterHash.Hex();
+
+    std::string keyPath = settings.OutputPath("base.key");
+    std::ifstream keyFile(keyPath);
+    std::string label, storedBaseKey;
+    keyFile >> label >> storedBaseKey;
+    baseValid = label == "base" && storedBaseKey == baseKey;
+    std::string name, storedKey, storedFileHash;
+    while (baseValid && keyFile >> name >> storedKey >> storedFileHash)
+    {
+        for (int i = 0; i < stageCount; i++)
+        {
+            if (name == stageNames[i] && storedKey == stageKeys[i] && storedFileHash == StageFileHash(settings, (IncrementalStage)i))
+            {
+                stageValid[i] = true;
+                stageFileHashes[i] = storedFileHash;
+            }
+        }
+    }
+    keyFile.close();
+    if (!baseValid)
+    {
+        std::error_code error;
+        fs::remove(keyPath, error);
+    }
+}
+
+bool IncrementalBase::ReadBase(CubemapFile& base)
+{
+    if (baseValid && ReadCubemapFile(settings->OutputPath("base.cbmp"), base)
+        && base.header.pixelFormat == CubemapPixelFormat::RGBA16F && (int)base.header.resolution == settings->resolution
+        && (int)base.header.mipmapLevels == 1 + (int)std::log2(settings->resolution))
+    {
+        return true;
+    }
+    // The caller bakes from scratch, and reads the environment map back from that instead.
+    stageValid[(int)IncrementalStage::Envmap] = false;
+    stageFileHashes[(int)IncrementalStage::Envmap].clear();
+    return false;
+}
+
+std::uint64_t IncrementalBase::CommitBase(const CubemapFile* base)
+{
+    if (!settings || baseKey.empty())
+    {
+        return 0;
+    }
+    std::uint64_t bytes = 0;
+    if (base)
+    {
+        bytes = WriteCubemapFile(*base, settings->OutputPath("base.cbmp"));
+        if (bytes == 0)
+        {
+            return 0;
+        }
+    }
+    baseCommitted = true;
+    return bytes + WriteKeyFile();
+}
+
+std::uint64_t IncrementalBase::CommitStage(IncrementalStage stage)
+{
+    if (!baseCommitted)
+    {
+        return 0;
+    }
+    stageFileHashes[(int)stage] = StageFileHash(*settings, stage);
+    return WriteKeyFile();
+}
+
+std::uint64_t IncrementalBase::WriteKeyFile()
+{
+    std::string key = "base " + baseKey + "\n";
+    for (int i = 0; i < stageCount; i++)
+    {
+        if (!stageFileHashes[i].empty())
+        {
+            key += std::string(stageNames[i]) + " " + stageKeys[i] + " " + stageFileHashes[i] + "\n";
+        }
+    }
+    std::string keyPath = settings->OutputPath("base.key");
+    std::ofstream keyFile(keyPath);
+    keyFile << key;
+    keyFile.close();
+    if (!keyFile)
+    {
+        std::cout << "Failed to write " << keyPath << std::endl;
+        return 0;
+    }
+    return key.size();
+}
@@ -0,0 +1,118 @@
+#ifndef BAKE_CACHE_H
+#define BAKE_CACHE_H
+
+#include "BrdfLut.h"
+#include "ConvoluteSettings.h"
+#include "CubemapFile.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// 64 bit FNV-1a. Not cryptographic, but a collision between two bakes of one cache is far less likely than the
+// disk failing.
+class ContentHash
+{
+public:
+    void Update(const void* data, std::size_t size)
+    {
+        const unsigned char* bytes = (const unsigned char*)data;
+        for (std::size_t i = 0; i < size; i++)
+        {
+            hash = (hash ^ bytes[i]) * 0x100000001B3ull;
+        }
+    }
+    // Length first so that consecutive strings can't run into each other.
+    void Update(const std::string& text);
+    // False if the file can't be read.
+    bool UpdateFile(const std::string& path);
+    std::string Hex() const;
+private:
+    std::uint64_t hash = 0xCBF29CE484222325ull;
+};
+
+// Tool version and a hash of the running executable, so that a rebuilt tool never reuses what an older one made.
+// Just the version if the executable can't be read.
+std::string BuildIdentifier();
+
+// Files a bake with these settings leaves in the output directory.
+std::vector<std::string> ConvoluteOutputFiles(const ConvoluteSettings& settings);
+
+// Content addressed store of finished bakes, so a rebake of an unchanged HDRI with unchanged settings, shaders
+// and build is a copy. Every entry is a directory named after its key holding the output files; its
+// modification time is the last use, and the least recently used entries go once the cache outgrows maxBytes.
+// Entries are published with a rename, so concurrent bakes sharing a cache never see half written ones.
+class BakeCache
+{
+public:
+    BakeCache(const std::string& directory, std::uint64_t maxBytes);
+
+    // Hex key of a bake: the HDRI bytes, every setting that changes the outputs, the backend, the build and, for
+    // the gl backend, the shader sources in Shaders/. Empty if the HDRI can't be read.
+    static std::string Key(const std::string& hdriPath, const ConvoluteSettings& settings, const char* backend);
+    // Key of the BRDF table of the given file name, which needs no HDRI: its settings, backend, build and, for
+    // the gl backend, brdfLUT.frag.
+    static std::string BrdfLutKey(const char* table, const BrdfLutSettings& settings, const char* backend);
+
+    // Copies the entry's files to settings.outputDirectory. False on a miss.
+    bool Restore(const std::string& key, const ConvoluteSettings& settings);
+    bool Restore(const std::string& key, const std::vector<std::string>& files, const std::string& outputDirectory);
+
+    // Adds the outputs of a finished bake, then evicts down to maxBytes.
+    void Store(const std::string& key, const ConvoluteSettings& settings);
+    void Store(const std::string& key, const std::vector<std::string>& files, const std::string& outputDirectory);
+private:
+    void Evict(const std::string& keep);
+
+    std::string directory;
+    std::uint64_t maxBytes;
+};
+
+// The stages of a bake whose outputs --incremental can keep.
+enum class IncrementalStage
+{
+    Envmap,
+    Irradiance, // irradiance.cbmp and/or irradiance.sh
+    Prefilter
+};
+
+// What --incremental keeps next to the outputs: base.cbmp, the RGBA16F environment map with its full mip chain,
+// and base.key, recording the inputs base.cbmp and each stage's outputs were made from. A rebake whose HDRI,
+// resolution, max radiance, backend, GL pipeline, equirect and mip filters, streaming and equirect shaders are
+// unchanged starts from base.cbmp. On top of that every stage has its own key, made of the base key, the settings
+// of that stage (sizes, irradiance mode and SH bands, prefilter error target, BC6H quality, file version and
+// order, supercompression, writeUncompressed and, for gl, its shaders) and a hash of its output files; a stage
+// whose key still matches and whose files are unchanged isn't run again.
+class IncrementalBase
+{
+public:
+    // Does nothing unless settings.incremental. Otherwise compares base.key with this bake and deletes it when the
+    // base doesn't match, so that a bake failing halfway never leaves a key describing files it already replaced.
+    void Open(const char* hdriPath, const ConvoluteSettings& settings, const char* backend);
+
+    // Reads base.cbmp into base if it holds this bake's environment map.
+    bool ReadBase(CubemapFile& base);
+    // The stage's outputs in the output directory are already this bake's.
+    bool StageValid(IncrementalStage stage) const { return stageValid[(int)stage]; }
+
+    // Writes base (unless null, when base.cbmp was reused) and then base.key describing it. Returns the number of
+    // bytes written.
+    std::uint64_t CommitBase(const CubemapFile* base);
+    // Records in base.key that the stage's outputs now in the output directory are this bake's. Does nothing
+    // unless the base was committed.
+    std::uint64_t CommitStage(IncrementalStage stage);
+private:
+    std::uint64_t WriteKeyFile();
+
+    static constexpr int stageCount = 3;
+    const ConvoluteSettings* settings = nullptr;
+    std::string baseKey;
+    bool baseValid = false;
+    bool baseCommitted = false;
+    std::string stageKeys[stageCount];
+    std::string stageFileHashes[stageCount]; // as recorded in base.key, empty when not recorded
+    bool stageValid[stageCount] = {};
+};
+
+#endif // !BAKE_CACHE_H
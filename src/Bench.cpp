@@ -0,0 +1,493 @@
+#include "CpuConvolute.h"
+#include "Cubemap.h"
+#include "CubemapFile.h"
+#include "HdrImage.h"
+#include "PrefilterSamples.h"
+#include "SphericalHarmonics.h"
+#include "ThreadPool.h"
+#include "Timing.h"
+#include "stb_image_write.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// ibl_bench: times the CPU pipeline stages one at a time over a set of inputs and cube resolutions, so two
+// branches can be compared on the same machine without a GL context. Every stage gets its inputs prepared up
+// front, is run warmup times untimed, then repetitions times timed.
+
+struct BenchOptions
+{
+    std::vector<std::string> inputs;
+    std::vector<int> resolutions;
+    std::vector<std::string> stages;
+    int warmup = 1;
+    int repetitions = 5;
+    int irradianceResolution = 32;
+    int prefilterResolution = 32;
+    int prefilterMipLevels = 5;
+    float prefilterErrorTarget = ConvoluteSettings().prefilterErrorTarget;
+    BC6HQuality quality = BC6HQuality::Basic;
+    std::string reportPath;
+};
+
+struct BenchResult
+{
+    std::string input;
+    int resolution;
+    std::string stage;
+    double megapixels;
+    std::uint64_t bytesWritten;
+    std::vector<double> ms;
+};
+
+struct Summary
+{
+    double min;
+    double median;
+    double mean;
+    double stddev;
+    double max;
+};
+
+static Summary Summarize(std::vector<double> samples)
+{
+    std::sort(samples.begin(), samples.end());
+    Summary summary;
+    size_t count = samples.size();
+    summary.min = samples.front();
+    summary.max = samples.back();
+    summary.median = count % 2 ? samples[count / 2] : 0.5 * (samples[count / 2 - 1] + samples[count / 2]);
+    summary.mean = std::accumulate(samples.begin(), samples.end(), 0.0) / count;
+    double variance = 0.0;
+    for (double sample : samples)
+    {
+        variance += (sample - summary.mean) * (sample - summary.mean);
+    }
+    summary.stddev = count > 1 ? std::sqrt(variance / (count - 1)) : 0.0;
+    return summary;
+}
+
+static bool StageEnabled(const BenchOptions& options, const std::string& stage)
+{
+    if (options.stages.empty())
+    {
+        return true;
+    }
+    // "prefilter" selects every prefilter_mipN stage.
+    for (const std::string& selected : options.stages)
+    {
+        if (stage == selected || stage.compare(0, selected.size() + 1, selected + "_") == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+template<typename Function>
+static std::vector<double> Measure(const BenchOptions& options, Function&& run)
+{
+    for (int i = 0; i < options.warmup; i++)
+    {
+        run();
+    }
+    std::vector<double> samples;
+    for (int i = 0; i < options.repetitions; i++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        run();
+        samples.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
+    return samples;
+}
+
+// Deterministic test panorama: sky gradient, a small very bright sun, darker ground and a fine hashed pattern so
+// the BC6H encoder and the filters don't see flat regions only. Written as Radiance so decode is part of the run.
+static bool WriteSyntheticHdri(const std::string& path, int width, int height)
+{
+    std::vector<float> rgb((size_t)width * height * 3);
+    const float sunPhi = 1.3f;
+    const float sunTheta = 0.35f;
+    for (int y = 0; y < height; y++)
+    {
+        float theta = PI * (y + 0.5f) / height; // 0 at the zenith, top row first
+        for (int x = 0; x < width; x++)
+        {
+            float phi = 2.0f * PI * (x + 0.5f) / width;
+            std::uint32_t hash = (std::uint32_t)x * 73856093u ^ (std::uint32_t)y * 19349663u;
+            hash = (hash ^ (hash >> 13)) * 0x5bd1e995u;
+            float noise = (float)(hash >> 8) / (float)(1u << 24);
+
+            float r, g, b;
+            if (theta < 0.5f * PI)
+            {
+                float horizon = theta / (0.5f * PI);
+                r = 0.3f + 0.7f * horizon;
+                g = 0.5f + 0.5f * horizon;
+                b = 1.0f;
+            }
+            else
+            {
+                r = 0.25f;
+                g = 0.2f;
+                b = 0.15f;
+            }
+            float scale = 0.8f + 0.4f * noise;
+            float sunDistance = std::sqrt((phi - sunPhi) * (phi - sunPhi) + (theta - sunTheta) * (theta - sunTheta));
+            float sun = sunDistance < 0.02f ? 20000.0f : 0.0f;
+
+            float* texel = &rgb[((size_t)y * width + x) * 3];
+            texel[0] = r * scale + sun;
+            texel[1] = g * scale + sun;
+            texel[2] = b * scale + sun * 0.9f;
+        }
+    }
+    return stbi_write_hdr(path.c_str(), width, height, 3, rgb.data()) != 0;
+}
+
+static std::vector<int> ParseList(const std::string& text)
+{
+    std::vector<int> values;
+    std::stringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ','))
+    {
+        values.push_back(std::atoi(item.c_str()));
+    }
+    return values;
+}
+
+static bool BenchInput(const std::string& path, const BenchOptions& options, std::vector<BenchResult>& results)
+{
+    std::cout << path << std::endl;
+    HdrImage hdri;
+    if (!LoadHdri(path.c_str(), 0.0f, hdri))
+    {
+        return false;
+    }
+    double inputMegapixels = Megapixels((long long)hdri.width * hdri.height);
+
+    auto record = [&](int resolution, const char* stage, double megapixels, std::uint64_t bytesWritten, std::vector<double> ms)
+    {
+        results.push_back({ path, resolution, stage, megapixels, bytesWritten, std::move(ms) });
+        const BenchResult& result = results.back();
+        Summary summary = Summarize(result.ms);
+        char line[256];
+        std::snprintf(line, sizeof(line), "  %5d  %-16s %10.3f ms  (min %.3f, mean %.3f +- %.3f, max %.3f)  %10.4g MPix/s\n",
+            resolution, stage, summary.median, summary.min, summary.mean, summary.stddev, summary.max,
+            megapixels / (summary.median / 1000.0));
+        std::cout << line << std::flush;
+    };
+
+    if (StageEnabled(options, "decode"))
+    {
+        record(0, "decode", inputMegapixels, 0, Measure(options, [&]
+        {
+            HdrImage decoded;
+            LoadHdri(path.c_str(), 0.0f, decoded);
+        }));
+    }
+
+    std::string cbmpPath = (std::filesystem::temp_directory_path() / "ibl_bench.cbmp").string();
+    for (int resolution : options.resolutions)
+    {
+        CubemapImage environmentMap(resolution, 1 + (int)std::log2(resolution));
+        EquirectToCubemap(hdri, environmentMap);
+        GenerateMipmaps(environmentMap);
+
+        if (StageEnabled(options, "equirect"))
+        {
+            CubemapImage target(resolution, 1);
+            record(resolution, "equirect", Megapixels(CubemapPixels(target, 0, 1)), 0, Measure(options, [&]
+            {
+                EquirectToCubemap(hdri, target);
+            }));
+        }
+        if (StageEnabled(options, "mipmaps"))
+        {
+            record(resolution, "mipmaps", Megapixels(CubemapPixels(environmentMap, 1, environmentMap.MipLevels() - 1)), 0,
+                Measure(options, [&]
+            {
+                GenerateMipmaps(environmentMap);
+            }));
+        }
+        if (StageEnabled(options, "mipmaps_seamless"))
+        {
+            CubemapImage target = environmentMap;
+            record(resolution, "mipmaps_seamless", Megapixels(CubemapPixels(target, 1, target.MipLevels() - 1)), 0,
+                Measure(options, [&]
+            {
+                GenerateMipmaps(target, MipFilter::Seamless);
+            }));
+        }
+        if (StageEnabled(options, "irradiance"))
+        {
+            CubemapImage irradiance(options.irradianceResolution, 1);
+            record(resolution, "irradiance", Megapixels(CubemapPixels(irradiance, 0, 1)), 0, Measure(options, [&]
+            {
+                ConvoluteIrradiance(environmentMap, irradiance);
+            }));
+        }
+        if (StageEnabled(options, "sh_project"))
+        {
+            int level = ShSourceLevel(resolution, environmentMap.MipLevels());
+            record(resolution, "sh_project", Megapixels(CubemapPixels(environmentMap, level, 1)), 0, Measure(options, [&]
+            {
+                RadianceToIrradianceSH(ProjectToSH(environmentMap, level, 3));
+            }));
+        }
+        int proxyLevel = PrefilterProxyLevel(resolution, environmentMap.MipLevels());
+        CubemapImage proxy = environmentMap.MipTail(proxyLevel);
+        std::vector<std::uint32_t> sampleCounts = PrefilterSampleSchedule(proxy, options.prefilterMipLevels, options.prefilterErrorTarget);
+        if (StageEnabled(options, "prefilter_schedule"))
+        {
+            record(resolution, "prefilter_schedule", 0.0, 0, Measure(options, [&]
+            {
+                PrefilterSampleSchedule(proxy, options.prefilterMipLevels, options.prefilterErrorTarget);
+            }));
+        }
+        CubemapImage prefiltered(options.prefilterResolution, options.prefilterMipLevels);
+        for (int level = 0; level < prefiltered.MipLevels(); level++)
+        {
+            std::string stage = "prefilter_mip" + std::to_string(level);
+            if (StageEnabled(options, stage))
+            {
+                record(resolution, stage.c_str(), Megapixels(CubemapPixels(prefiltered, level, 1)), 0, Measure(options, [&]
+                {
+                    PrefilterLevel(environmentMap, prefiltered, level, sampleCounts[level]);
+                }));
+            }
+        }
+        CubemapFile compressed = CompressCubemap(environmentMap, options.quality);
+        if (StageEnabled(options, "bc6h"))
+        {
+            record(resolution, "bc6h", Megapixels(CubemapPixels(environmentMap, 0, environmentMap.MipLevels())), 0,
+                Measure(options, [&]
+            {
+                compressed = CompressCubemap(environmentMap, options.quality);
+            }));
+        }
+        if (StageEnabled(options, "write"))
+        {
+            std::uint64_t bytesWritten = 0;
+            std::vector<double> ms = Measure(options, [&]
+            {
+                bytesWritten = WriteCubemapFile(compressed, cbmpPath);
+            });
+            record(resolution, "write", 0.0, bytesWritten, std::move(ms));
+        }
+    }
+    std::error_code error;
+    std::filesystem::remove(cbmpPath, error);
+    return true;
+}
+
+static bool WriteBenchReport(const std::string& path, const BenchOptions& options, const std::vector<BenchResult>& results)
+{
+    std::ostringstream out;
+    out << "{\n";
+    out << "  \"threads\": " << ThreadPool::Global().ThreadCount() << ",\n";
+    out << "  \"warmup\": " << options.warmup << ",\n";
+    out << "  \"repetitions\": " << options.repetitions << ",\n";
+    out << "  \"peak_rss_bytes\": " << PeakResidentBytes() << ",\n";
+    out << "  \"results\": [";
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const BenchResult& result = results[i];
+        Summary summary = Summarize(result.ms);
+        out << (i == 0 ? "\n" : ",\n");
+        out << "    { \"input\": " << JsonString(result.input) << ", \"resolution\": " << result.resolution
+            << ", \"stage\": " << JsonString(result.stage) << ", \"median_ms\": " << summary.median
+            << ", \"min_ms\": " << summary.min << ", \"mean_ms\": " << summary.mean << ", \"stddev_ms\": " << summary.stddev
+            << ", \"max_ms\": " << summary.max << ", \"megapixels\": " << result.megapixels
+            << ", \"mpix_per_s\": " << (summary.median > 0.0 ? result.megapixels / (summary.median / 1000.0) : 0.0)
+            << ", \"bytes_written\": " << result.bytesWritten << ", \"samples_ms\": [";
+        for (size_t s = 0; s < result.ms.size(); s++)
+        {
+            out << (s == 0 ? "" : ", ") << result.ms[s];
+        }
+        out << "] }";
+    }
+    out << "\n  ]\n}\n";
+
+    std::ofstream file(path);
+    if (!file || !(file << out.str()))
+    {
+        std::cout << "Failed to write benchmark report '" << path << "'\n";
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    BenchOptions options;
+    std::vector<std::string> synthetic;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--input" && i + 1 < argc)
+        {
+            options.inputs.push_back(argv[++i]);
+        }
+        else if (arg == "--synthetic" && i + 1 < argc)
+        {
+            synthetic.push_back(argv[++i]);
+        }
+        else if (arg == "--resolutions" && i + 1 < argc)
+        {
+            options.resolutions = ParseList(argv[++i]);
+        }
+        else if (arg == "--stages" && i + 1 < argc)
+        {
+            std::stringstream stream(argv[++i]);
+            std::string stage;
+            while (std::getline(stream, stage, ','))
+            {
+                options.stages.push_back(stage);
+            }
+        }
+        else if (arg == "--warmup" && i + 1 < argc)
+        {
+            options.warmup = std::atoi(argv[++i]);
+        }
+        else if (arg == "--repetitions" && i + 1 < argc)
+        {
+            options.repetitions = std::atoi(argv[++i]);
+        }
+        else if (arg == "--irradiance-resolution" && i + 1 < argc)
+        {
+            options.irradianceResolution = std::atoi(argv[++i]);
+        }
+        else if (arg == "--prefilter-resolution" && i + 1 < argc)
+        {
+            options.prefilterResolution = std::atoi(argv[++i]);
+        }
+        else if (arg == "--prefilter-error" && i + 1 < argc)
+        {
+            options.prefilterErrorTarget = (float)std::atof(argv[++i]);
+        }
+        else if (arg == "--bc6h-quality" && i + 1 < argc)
+        {
+            std::string value = argv[++i];
+            if (value == "fast")
+            {
+                options.quality = BC6HQuality::Fast;
+            }
+            else if (value == "basic")
+            {
+                options.quality = BC6HQuality::Basic;
+            }
+            else if (value == "slow")
+            {
+                options.quality = BC6HQuality::Slow;
+            }
+            else
+            {
+                std::cout << "Invalid BC6H quality: '" << value << "'\n";
+                return 0;
+            }
+        }
+        else if (arg == "--threads" && i + 1 < argc)
+        {
+            int threads = std::atoi(argv[++i]);
+            if (threads <= 0)
+            {
+                std::cout << "Invalid thread count: '" << argv[i] << "'\n";
+                return 0;
+            }
+            ThreadPool::SetGlobalThreadCount(threads);
+        }
+        else if (arg == "--report" && i + 1 < argc)
+        {
+            options.reportPath = argv[++i];
+        }
+        else
+        {
+            std::cout << "Usage: ibl_bench [--input hdri_path]... [--synthetic WIDTHxHEIGHT]... [--resolutions 128,256]\n"
+                         "                 [--stages decode,equirect,mipmaps,mipmaps_seamless,irradiance,sh_project,prefilter,bc6h,write]\n"
+                         "                 [--warmup count] [--repetitions count] [--irradiance-resolution pixels]\n"
+                         "                 [--prefilter-resolution pixels] [--prefilter-error relative]\n"
+                         "                 [--bc6h-quality fast|basic|slow] [--threads count]\n"
+                         "                 [--report file]\n";
+            return 0;
+        }
+    }
+
+    if (options.resolutions.empty())
+    {
+        options.resolutions = { 128, 256 };
+    }
+    if (options.repetitions <= 0 || options.warmup < 0 || !IsValidCubeResolution(options.irradianceResolution)
+        || options.irradianceResolution % 2 != 0 || !IsValidCubeResolution(options.prefilterResolution)
+        || !std::all_of(options.resolutions.begin(), options.resolutions.end(), IsValidCubeResolution))
+    {
+        std::cout << "Invalid benchmark options\n";
+        return 0;
+    }
+
+    // Without explicit inputs, the bundled panorama (when run from the repository root or from data/) and a
+    // synthetic 2048x1024 one.
+    if (options.inputs.empty() && synthetic.empty())
+    {
+        for (const char* bundled : { "EnvironmentMaps/burnt_warehouse.hdr", "data/EnvironmentMaps/burnt_warehouse.hdr" })
+        {
+            if (std::filesystem::exists(bundled))
+            {
+                options.inputs.push_back(bundled);
+                break;
+            }
+        }
+        synthetic.push_back("2048x1024");
+    }
+
+    std::vector<std::string> syntheticPaths;
+    for (const std::string& size : synthetic)
+    {
+        int width = 0;
+        int height = 0;
+        if (std::sscanf(size.c_str(), "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0)
+        {
+            std::cout << "Invalid synthetic size: '" << size << "'\n";
+            return 0;
+        }
+        std::string path = (std::filesystem::temp_directory_path() / ("ibl_bench_synthetic_" + size + ".hdr")).string();
+        if (!WriteSyntheticHdri(path, width, height))
+        {
+            std::cout << "Failed to write synthetic input '" << path << "'\n";
+            return -1;
+        }
+        syntheticPaths.push_back(path);
+        options.inputs.push_back(path);
+    }
+
+    std::cout << "threads " << ThreadPool::Global().ThreadCount() << ", warmup " << options.warmup << ", repetitions "
+        << options.repetitions << "\n";
+    std::vector<BenchResult> results;
+    bool succeeded = true;
+    for (const std::string& input : options.inputs)
+    {
+        succeeded = BenchInput(input, options, results) && succeeded;
+    }
+    for (const std::string& path : syntheticPaths)
+    {
+        std::error_code error;
+        std::filesystem::remove(path, error);
+    }
+
+    if (!options.reportPath.empty() && !WriteBenchReport(options.reportPath, options, results))
+    {
+        return -1;
+    }
+    return succeeded ? 0 : -1;
+}
@@ -0,0 +1,250 @@
+#include "BrdfLut.h"
+
+#include "Half.h"
+#include "Math.h"
+#include "PrefilterSamples.h"
+#include "ThreadPool.h"
+
+#include <cmath>
+#include <fstream>
+
+// Half vectors shared by every texel of a table row, as structure of arrays padded with zero vectors to a multiple
+// of four. V never has a y component, so only x and z are kept. A zero vector puts L below the horizon, which
+// drops the padding from the sums.
+struct HalfVectorTable
+{
+    std::vector<float> x;
+    std::vector<float> z;
+    std::vector<float> weight; // D(NdotH) for the sheen table
+    std::uint32_t sampleCount = 0;
+
+    explicit HalfVectorTable(std::uint32_t sampleCount)
+        : x((sampleCount + 3) & ~3u), z(x.size()), weight(x.size()), sampleCount(sampleCount)
+    {
+    }
+};
+
+// The GGX importance samples of brdfLUT.frag for one roughness.
+static HalfVectorTable GgxHalfVectors(float roughness, std::uint32_t sampleCount)
+{
+    Vec3 N = { 0.0f, 0.0f, 1.0f };
+    Vec3 tangent, bitangent;
+    PrefilterTangentFrame(N, tangent, bitangent);
+    float a = roughness * roughness;
+
+    HalfVectorTable table(sampleCount);
+    for (std::uint32_t i = 0; i < sampleCount; i++)
+    {
+        float phi = 2.0f * PI * ((float)i / (float)sampleCount);
+        float xi1 = RadicalInverse_VdC(i);
+        float cosTheta = std::sqrt((1.0f - xi1) / (1.0f + (a * a - 1.0f) * xi1));
+        float sinTheta = std::sqrt(1.0f - cosTheta * cosTheta);
+        Vec3 H = Normalize(tangent * (std::cos(phi) * sinTheta) + bitangent * (std::sin(phi) * sinTheta) + N * cosTheta);
+        table.x[i] = H.x;
+        table.z[i] = H.z;
+    }
+    return table;
+}
+
+// Uniformly distributed half vectors weighted by the Charlie distribution of Estevez and Kulla,
+// D = (2 + 1 / alpha) sin(theta)^(1 / alpha) / 2 pi with alpha = roughness^2.
+static HalfVectorTable CharlieHalfVectors(float roughness, std::uint32_t sampleCount)
+{
+    float invAlpha = 1.0f / (roughness * roughness);
+    HalfVectorTable table(sampleCount);
+    for (std::uint32_t i = 0; i < sampleCount; i++)
+    {
+        float phi = 2.0f * PI * ((float)i / (float)sampleCount);
+        float cosTheta = 1.0f - RadicalInverse_VdC(i);
+        float sin2Theta = std::max(1.0f - cosTheta * cosTheta, 0.0078125f);
+        table.x[i] = std::cos(phi) * std::sqrt(1.0f - cosTheta * cosTheta);
+        table.z[i] = cosTheta;
+        table.weight[i] = (2.0f + invAlpha) * std::pow(sin2Theta, invAlpha * 0.5f) / (2.0f * PI);
+    }
+    return table;
+}
+
+// IntegrateBRDF of brdfLUT.frag. L = 2 (V.H) H - V is unit length already, so only its z is computed, and
+// pow(1 - VdotH, 5) is multiplied out.
+static void IntegrateBrdf(float NdotV, float roughness, const HalfVectorTable& table, float& scale, float& bias)
+{
+    float Vx = std::sqrt(1.0f - NdotV * NdotV);
+    float k = (roughness * roughness) / 2.0f;
+    float geometryV = NdotV / (NdotV * (1.0f - k) + k);
+
+    float A = 0.0f;
+    float B = 0.0f;
+    std::uint32_t i = 0;
+#ifdef IBL_SSE2
+    __m128 sumA = _mm_setzero_ps();
+    __m128 sumB = _mm_setzero_ps();
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    for (; i < (std::uint32_t)table.x.size(); i += 4)
+    {
+        __m128 Hx = _mm_loadu_ps(&table.x[i]);
+        __m128 Hz = _mm_loadu_ps(&table.z[i]);
+        __m128 VdotH = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(Vx), Hx), _mm_mul_ps(_mm_set1_ps(NdotV), Hz));
+        __m128 NdotL = _mm_sub_ps(_mm_mul_ps(_mm_add_ps(VdotH, VdotH), Hz), _mm_set1_ps(NdotV));
+        __m128 visible = _mm_cmpgt_ps(NdotL, zero);
+        VdotH = _mm_max_ps(VdotH, zero);
+
+        __m128 G = _mm_div_ps(_mm_mul_ps(NdotL, _mm_set1_ps(geometryV)), _mm_add_ps(_mm_mul_ps(NdotL, _mm_set1_ps(1.0f - k)), _mm_set1_ps(k)));
+        __m128 G_Vis = _mm_div_ps(_mm_mul_ps(G, VdotH), _mm_mul_ps(_mm_max_ps(Hz, zero), _mm_set1_ps(NdotV)));
+        // The padding divides by zero, which the mask clears along with every other hidden sample.
+        G_Vis = _mm_and_ps(G_Vis, visible);
+        __m128 t = _mm_sub_ps(one, VdotH);
+        __m128 t2 = _mm_mul_ps(t, t);
+        __m128 Fc = _mm_mul_ps(_mm_mul_ps(t2, t2), t);
+        sumA = _mm_add_ps(sumA, _mm_mul_ps(_mm_sub_ps(one, Fc), G_Vis));
+        sumB = _mm_add_ps(sumB, _mm_mul_ps(Fc, G_Vis));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, sumA);
+    A = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    _mm_storeu_ps(lanes, sumB);
+    B = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#endif
+    for (; i < table.sampleCount; i++)
+    {
+        float VdotH = Vx * table.x[i] + NdotV * table.z[i];
+        float NdotL = 2.0f * VdotH * table.z[i] - NdotV;
+        VdotH = std::max(VdotH, 0.0f);
+        if (NdotL > 0.0f)
+        {
+            float G = NdotL / (NdotL * (1.0f - k) + k) * geometryV;
+            float G_Vis = (G * VdotH) / (std::max(table.z[i], 0.0f) * NdotV);
+            float t = 1.0f - VdotH;
+            float Fc = t * t * t * t * t;
+            A += (1.0f - Fc) * G_Vis;
+            B += Fc * G_Vis;
+        }
+    }
+    scale = A / (float)table.sampleCount;
+    bias = B / (float)table.sampleCount;
+}
+
+// Directional albedo of the Charlie sheen lobe with the visibility term of Neubelt and Pettineo,
+// 1 / (4 (NdotL + NdotV - NdotL NdotV)). Half vectors are uniform over the hemisphere, so a sample's
+// estimate is D V NdotL 4 VdotH 2 pi.
+static float IntegrateSheen(float NdotV, const HalfVectorTable& table)
+{
+    float Vx = std::sqrt(1.0f - NdotV * NdotV);
+    float sum = 0.0f;
+    std::uint32_t i = 0;
+#ifdef IBL_SSE2
+    __m128 sums = _mm_setzero_ps();
+    const __m128 zero = _mm_setzero_ps();
+    for (; i < (std::uint32_t)table.x.size(); i += 4)
+    {
+        __m128 Hz = _mm_loadu_ps(&table.z[i]);
+        __m128 VdotH = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(Vx), _mm_loadu_ps(&table.x[i])), _mm_mul_ps(_mm_set1_ps(NdotV), Hz));
+        __m128 NdotL = _mm_sub_ps(_mm_mul_ps(_mm_add_ps(VdotH, VdotH), Hz), _mm_set1_ps(NdotV));
+        __m128 visible = _mm_cmpgt_ps(NdotL, zero);
+        __m128 denominator = _mm_sub_ps(_mm_add_ps(NdotL, _mm_set1_ps(NdotV)), _mm_mul_ps(NdotL, _mm_set1_ps(NdotV)));
+        __m128 value = _mm_div_ps(_mm_mul_ps(_mm_mul_ps(_mm_loadu_ps(&table.weight[i]), NdotL), _mm_max_ps(VdotH, zero)), denominator);
+        sums = _mm_add_ps(sums, _mm_and_ps(value, visible));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, sums);
+    sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#endif
+    for (; i < table.sampleCount; i++)
+    {
+        float VdotH = Vx * table.x[i] + NdotV * table.z[i];
+        float NdotL = 2.0f * VdotH * table.z[i] - NdotV;
+        if (NdotL > 0.0f)
+        {
+            sum += table.weight[i] * NdotL * std::max(VdotH, 0.0f) / (NdotL + NdotV - NdotL * NdotV);
+        }
+    }
+    // The 1 / 4 of the visibility cancels the 4 VdotH of the half vector density.
+    return sum * (2.0f * PI / (float)table.sampleCount);
+}
+
+void IntegrateBrdfLut(const BrdfLutSettings& settings, std::vector<float>& texels)
+{
+    int resolution = settings.resolution;
+    std::vector<float> ab((size_t)resolution * resolution * 2);
+    ParallelFor(resolution, [&](int y)
+    {
+        float roughness = (y + 0.5f) / resolution;
+        HalfVectorTable table = GgxHalfVectors(roughness, (std::uint32_t)settings.sampleCount);
+        for (int x = 0; x < resolution; x++)
+        {
+            float* texel = &ab[((size_t)y * resolution + x) * 2];
+            IntegrateBrdf((x + 0.5f) / resolution, roughness, table, texel[0], texel[1]);
+        }
+    });
+    FinishBrdfLut(settings, ab, texels);
+}
+
+void FinishBrdfLut(const BrdfLutSettings& settings, const std::vector<float>& ab, std::vector<float>& texels)
+{
+    if (!settings.multiScatter)
+    {
+        texels = ab;
+        return;
+    }
+    int resolution = settings.resolution;
+    texels.resize((size_t)resolution * resolution * 3);
+    for (int y = 0; y < resolution; y++)
+    {
+        // E_avg = 2 integral of E(mu) mu over mu, midpoint rule over the texel centres of the row.
+        const float* row = &ab[(size_t)y * resolution * 2];
+        double average = 0.0;
+        for (int x = 0; x < resolution; x++)
+        {
+            average += 2.0 * ((x + 0.5) / resolution) * (row[x * 2] + row[x * 2 + 1]);
+        }
+        average /= resolution;
+        for (int x = 0; x < resolution; x++)
+        {
+            float* texel = &texels[((size_t)y * resolution + x) * 3];
+            texel[0] = row[x * 2];
+            texel[1] = row[x * 2 + 1];
+            texel[2] = (float)average;
+        }
+    }
+}
+
+void IntegrateSheenLut(const BrdfLutSettings& settings, std::vector<float>& texels)
+{
+    int resolution = settings.resolution;
+    texels.resize((size_t)resolution * resolution);
+    ParallelFor(resolution, [&](int y)
+    {
+        HalfVectorTable table = CharlieHalfVectors((y + 0.5f) / resolution, (std::uint32_t)settings.sampleCount);
+        for (int x = 0; x < resolution; x++)
+        {
+            texels[(size_t)y * resolution + x] = IntegrateSheen((x + 0.5f) / resolution, table);
+        }
+    });
+}
+
+std::uint64_t WriteBrdfLutFile(const BrdfLutSettings& settings, int channels, const std::vector<float>& texels,
+    const std::string& file_path)
+{
+    BrdfLutFile::Header header;
+    header.resolution = settings.resolution;
+    header.sampleCount = settings.sampleCount;
+    header.format = settings.format;
+    header.channels = channels;
+
+    std::ofstream file(file_path, std::ios::binary);
+    file.write((const char*)&header, sizeof(header));
+    size_t bytes = 0;
+    if (settings.format == BrdfLutFormat::Half)
+    {
+        std::vector<std::uint16_t> halves(texels.size());
+        FloatToHalf(texels.data(), halves.data(), texels.size());
+        bytes = halves.size() * sizeof(std::uint16_t);
+        file.write((const char*)halves.data(), bytes);
+    }
+    else
+    {
+        bytes = texels.size() * sizeof(float);
+        file.write((const char*)texels.data(), bytes);
+    }
+    return file ? sizeof(header) + bytes : 0;
+}
@@ -0,0 +1,72 @@
+#ifndef BRDF_LUT_H
+#define BRDF_LUT_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Precomputed BRDF tables over NdotV and roughness. They depend on nothing but these settings, so one table
+// serves every environment map:
+//   brdf.lut  - the split sum scale (A) and bias (B) applied to F0, as brdfLUT.frag integrates them. With
+//               multiScatter a third channel holds the Kulla-Conty average albedo E_avg of the roughness, the
+//               cosine weighted mean of A + B over NdotV. Together with 1 - (A + B) it gives the multiple
+//               scattering energy compensation without integrating anything at run time.
+//   sheen.lut - the directional albedo of the Charlie sheen lobe with Neubelt visibility, for cloth. That pair
+//               isn't energy conserving: towards smooth and grazing it climbs well above 1, and at the very
+//               smoothest roughnesses a few samples of the spike at the horizon dominate.
+enum class BrdfLutFormat : std::uint32_t
+{
+    Half = 1, // 2 bytes per channel
+    Float = 2 // 4 bytes per channel
+};
+
+struct BrdfLutSettings
+{
+    int resolution = 512;
+    int sampleCount = 1024;
+    BrdfLutFormat format = BrdfLutFormat::Half;
+    bool multiScatter = false;
+};
+
+// On disk: Header, then resolution rows of resolution texels of channels values each. Texel (x, y) is at
+// NdotV = (x + 0.5) / resolution and roughness = (y + 0.5) / resolution, so the first row is the smoothest,
+// the way a GL texture made from the file is addressed.
+struct BrdfLutFile
+{
+    // "BRDF" in file byte order.
+    static constexpr std::uint32_t correctMagicNumber = ('F' << 24) | ('D' << 16) | ('R' << 8) | 'B';
+    static constexpr std::uint32_t currentVersion = 1;
+    struct Header
+    {
+        std::uint32_t magicNumber = correctMagicNumber;
+        std::uint32_t version = currentVersion;
+        std::uint32_t resolution;
+        std::uint32_t sampleCount;
+        BrdfLutFormat format;
+        std::uint32_t channels;
+    };
+};
+
+// Names of the tables in the output directory.
+constexpr const char* brdfLutFileName = "brdf.lut";
+constexpr const char* sheenLutFileName = "sheen.lut";
+
+inline int BrdfLutChannels(const BrdfLutSettings& settings)
+{
+    return settings.multiScatter ? 3 : 2;
+}
+
+// CPU port of brdfLUT.frag, rows spread over the thread pool. texels receives the brdf.lut texels in file order.
+void IntegrateBrdfLut(const BrdfLutSettings& settings, std::vector<float>& texels);
+
+// brdf.lut texels from the A, B pairs of every texel, adding the multi-scatter channel if the settings ask for it.
+void FinishBrdfLut(const BrdfLutSettings& settings, const std::vector<float>& ab, std::vector<float>& texels);
+
+// The sheen.lut texels, one channel each.
+void IntegrateSheenLut(const BrdfLutSettings& settings, std::vector<float>& texels);
+
+// Returns the number of bytes written, 0 if the file couldn't be written.
+std::uint64_t WriteBrdfLutFile(const BrdfLutSettings& settings, int channels, const std::vector<float>& texels,
+    const std::string& file_path);
+
+#endif // !BRDF_LUT_H
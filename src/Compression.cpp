@@ -0,0 +1,101 @@
+#include "Compression.h"
+
+#ifdef IBL_ISPC_TEXCOMP
+#include "ispc_texcomp.h"
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+void CompressSurfaceBC6H(const std::uint8_t* rgbaHalfPixels, int width, int height, std::uint8_t* destination, BC6HQuality quality)
+{
+    std::uint8_t padded[4 * 4 * 8];
+    int stride = width * 8;
+
+    if (width < 4 || height < 4)
+    {
+        for (int y = 0; y < 4; y++)
+        {
+            for (int x = 0; x < 4; x++)
+            {
+                const std::uint8_t* texel = rgbaHalfPixels + (std::min(y, height - 1) * width + std::min(x, width - 1)) * 8;
+                std::memcpy(&padded[(y * 4 + x) * 8], texel, 8);
+            }
+        }
+        rgbaHalfPixels = padded;
+        width = 4;
+        height = 4;
+        stride = 4 * 8;
+    }
+
+#ifdef IBL_ISPC_TEXCOMP
+    rgba_surface surface;
+    surface.ptr = (std::uint8_t*)rgbaHalfPixels;
+    surface.width = width;
+    surface.height = height;
+    surface.stride = stride;
+
+    bc6h_enc_settings settings;
+    switch (quality)
+    {
+    case BC6HQuality::Fast:
+        GetProfile_bc6h_fast(&settings);
+        break;
+    case BC6HQuality::Basic:
+        GetProfile_bc6h_basic(&settings);
+        break;
+    case BC6HQuality::Slow:
+        GetProfile_bc6h_slow(&settings);
+        break;
+    }
+    CompressBlocksBC6H(&surface, destination, &settings);
+#else
+    std::uint16_t block[4 * 4 * 4];
+    for (int blockY = 0; blockY < height / 4; blockY++)
+    {
+        for (int blockX = 0; blockX < width / 4; blockX++)
+        {
+            for (int y = 0; y < 4; y++)
+            {
+                std::memcpy(&block[y * 16], rgbaHalfPixels + (size_t)(blockY * 4 + y) * stride + blockX * 4 * 8, 4 * 8);
+            }
+            EncodeBlockBC6H(block, quality, destination);
+            destination += 16;
+        }
+    }
+#endif
+}
+
+void BC6HCompressor::Enqueue(const std::uint8_t* rgbaHalfPixels, int width, int height, std::uint8_t* destination)
+{
+    pixels += (long long)width * height;
+    if (width < 4 || height < 4)
+    {
+        Run([=, quality = quality] { CompressSurfaceBC6H(rgbaHalfPixels, width, height, destination, quality); });
+        return;
+    }
+
+    // Around 256 blocks per task keeps scheduling overhead negligible while still splitting big mips finely.
+    const int blocksPerTask = 256;
+    int blocksPerRow = width / 4;
+    int blockRows = height / 4;
+    int rowsPerTask = std::max(1, blocksPerTask / blocksPerRow);
+    for (int row = 0; row < blockRows; row += rowsPerTask)
+    {
+        int rows = std::min(rowsPerTask, blockRows - row);
+        const std::uint8_t* source = rgbaHalfPixels + (size_t)row * 4 * width * 8;
+        std::uint8_t* sliceDestination = destination + (size_t)row * blocksPerRow * 16;
+        Run([=, quality = quality] { CompressSurfaceBC6H(source, width, rows * 4, sliceDestination, quality); });
+    }
+}
+
+void BC6HCompressor::Run(std::function<void()> compress)
+{
+    tasks.Run([this, compress = std::move(compress)]
+    {
+        auto start = std::chrono::steady_clock::now();
+        compress();
+        busyNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    });
+}
@@ -0,0 +1,46 @@
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include "BC6HEncoder.h"
+#include "ThreadPool.h"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+
+// Size in bytes of one BC6H compressed mip level. Levels smaller than a block still take a whole 4x4 block.
+inline int MipSizeBC6(int mipResolution)
+{
+    int blocks = mipResolution >= 4 ? mipResolution / 4 : 1;
+    return blocks * blocks * 16;
+}
+
+// Compresses a width x height RGBA16F surface (8 bytes per pixel, tightly packed) to BC6H, with ISPCTextureCompressor
+// when the project is configured with IBL_BC6H_ENCODER=ispc and the built-in encoder otherwise.
+// Surfaces smaller than 4x4 are padded by repeating their edge texels.
+void CompressSurfaceBC6H(const std::uint8_t* rgbaHalfPixels, int width, int height, std::uint8_t* destination, BC6HQuality quality);
+
+// Compresses surfaces on the global thread pool. Each surface is cut into slices of whole block rows that are
+// compressed independently straight into their final place in the destination, so faces, mips and the rows of
+// a large mip all spread across cores. Source pixels and destination must stay valid until Wait returns.
+class BC6HCompressor
+{
+public:
+    explicit BC6HCompressor(BC6HQuality quality = BC6HQuality::Basic) : quality(quality) {}
+
+    void Enqueue(const std::uint8_t* rgbaHalfPixels, int width, int height, std::uint8_t* destination);
+    void Wait() { tasks.Wait(); }
+
+    // Totals over everything enqueued so far, for the timing report.
+    double BusyMilliseconds() const { return busyNanoseconds / 1e6; }
+    long long Pixels() const { return pixels; }
+private:
+    void Run(std::function<void()> compress);
+
+    BC6HQuality quality;
+    std::atomic<long long> busyNanoseconds{ 0 };
+    long long pixels = 0;
+    TaskGroup tasks;
+};
+
+#endif // !COMPRESSION_H
@@ -0,0 +1,95 @@
+#ifndef CONVOLUTE_SETTINGS_H
+#define CONVOLUTE_SETTINGS_H
+
+#include "BC6HEncoder.h"
+#include "CubemapFile.h"
+
+#include <string>
+
+enum class IrradianceMode
+{
+    BruteForce,        // convolute.frag hemisphere walk
+    SH,                // SH projection, writes irradiance.sh and the reconstructed irradiance.cbmp
+    SHCoefficientsOnly // SH projection, writes irradiance.sh only
+};
+
+// How the equirect panorama is resampled into the cube map.
+enum class EquirectFilter
+{
+    Bilinear, // one bilinear tap per texel like equirectToCubemap.frag, aliases when the panorama has far more texels
+    Box,      // solid angle weighted average of the panorama texels under each cube texel
+    Lanczos   // Lanczos 2 stretched over the same footprint, sharper than Box
+};
+
+// How the environment map mips are made.
+enum class MipFilter
+{
+    Box,     // 2x2 average within each face: glGenerateMipmap on the GL backend, its CPU twin on the CPU one
+    Seamless // 4x4 tent reaching across face edges, always on the CPU so every vendor gets the same mips
+};
+
+// How the GL backend runs the equirect, irradiance and prefilter stages.
+enum class GlPipeline
+{
+    Raster, // a full screen draw per face, each with its own framebuffer attachment
+    Compute // one dispatch per mip writing all six faces through an image binding
+};
+
+// Parameters shared by the GL and CPU backends.
+struct ConvoluteSettings
+{
+    int resolution = 0;
+    float maxRadiance = 0.0f;
+    IrradianceMode irradianceMode = IrradianceMode::BruteForce;
+    int shBands = 3;
+    // Sizes of the derived maps; the environment map is resolution with a full mip chain. All are powers of two
+    // (see IsValidCubeResolution) and the irradiance size is at least 2, see --irradiance-resolution.
+    int irradianceResolution = 32;
+    int prefilterResolution = 128;
+    int prefilterMipLevels = 5;
+    BC6HQuality compressionQuality = BC6HQuality::Basic;
+    // Error the prefilter sample schedule may add per mip relative to 4096 samples, 0 for 4096 everywhere.
+    // --prefilter-quality fast|balanced|reference maps to 0.05, 0.01 and 0.
+    float prefilterErrorTarget = 0.01f;
+    GlPipeline glPipeline = GlPipeline::Compute;
+    // Anything but Bilinear resamples on the CPU, see EquirectToCubemap.
+    EquirectFilter equirectFilter = EquirectFilter::Bilinear;
+    MipFilter mipFilter = MipFilter::Box;
+    // Decode the HDRI in bands straight into the cube map instead of loading it whole, see ShouldStreamHdri.
+    bool streamHdri = false;
+    // .cbmp layout of the BC6H outputs. Version 1 is the default until loaders read version 2, which mip major
+    // order and supercompression need; the RGBA16F copies are always version 2.
+    std::uint32_t fileVersion = 1;
+    CubemapFileOrder fileOrder = CubemapFileOrder::FaceMajor;
+    // rANS code the BC6H payloads of the .cbmp outputs, see WriteCubemapFile.
+    bool supercompress = false;
+    // Keep the environment map in the output directory and start from it when only derived settings changed,
+    // see IncrementalBase.
+    bool incremental = false;
+    // Also write the RGBA16F cube map every .cbmp output was compressed from, named by UncompressedFileName, so
+    // --validate can tell the error of the bake from the error of the compression.
+    bool writeUncompressed = false;
+
+    // Where the .cbmp/.sh outputs go; empty means the working directory.
+    std::string outputDirectory;
+
+    std::string OutputPath(const char* fileName) const
+    {
+        return outputDirectory.empty() ? std::string(fileName) : outputDirectory + "/" + fileName;
+    }
+};
+
+// Sizes the cube maps can have: powers of two, so that every mip of a BC6H chain is whole 4x4 blocks, or a single
+// padded block once it is smaller.
+inline bool IsValidCubeResolution(int resolution)
+{
+    return resolution > 0 && (resolution & (resolution - 1)) == 0;
+}
+
+// The RGBA16F copy of an output that writeUncompressed keeps, envmap.cbmp -> envmap_rgba16f.cbmp.
+inline std::string UncompressedFileName(const std::string& fileName)
+{
+    return fileName.substr(0, fileName.rfind('.')) + "_rgba16f.cbmp";
+}
+
+#endif // !CONVOLUTE_SETTINGS_H
@@ -0,0 +1,803 @@
+#include "CpuConvolute.h"
+
+#include "BakeCache.h"
+#include "Compression.h"
+#include "Half.h"
+#include "PrefilterSamples.h"
+#include "RadianceReader.h"
+#include "SphericalHarmonics.h"
+#include "ThreadPool.h"
+
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <utility>
+
+// Bilinear footprint of the equirect lookup equirectToCubemap.frag does for one cube texel: GL_LINEAR with
+// GL_CLAMP_TO_EDGE. Rows count from the bottom of the image like HdrImage.
+struct EquirectTap
+{
+    int x0, x1;
+    int y0, y1;
+    float fx, fy;
+};
+
+static EquirectTap EquirectTapAt(int width, int height, float u, float v)
+{
+    float sx = u * width - 0.5f;
+    float sy = v * height - 0.5f;
+    float x0f = std::floor(sx);
+    float y0f = std::floor(sy);
+
+    EquirectTap tap;
+    tap.fx = sx - x0f;
+    tap.fy = sy - y0f;
+    tap.x0 = std::clamp((int)x0f, 0, width - 1);
+    tap.x1 = std::clamp((int)x0f + 1, 0, width - 1);
+    tap.y0 = std::clamp((int)y0f, 0, height - 1);
+    tap.y1 = std::clamp((int)y0f + 1, 0, height - 1);
+    return tap;
+}
+
+static Color SampleTap(const float* row0, const float* row1, const EquirectTap& tap)
+{
+    auto fetch = [](const float* row, int px)
+    {
+        const float* texel = row + (size_t)px * 3;
+        return Color{ texel[0], texel[1], texel[2], 1.0f };
+    };
+    return Lerp(Lerp(fetch(row0, tap.x0), fetch(row0, tap.x1), tap.fx), Lerp(fetch(row1, tap.x0), fetch(row1, tap.x1), tap.fx), tap.fy);
+}
+
+std::shared_ptr<const EquirectLut> GetEquirectLut(int resolution)
+{
+    // Only the latest resolution is kept: a 2048 cube map takes 200 MB of coordinates, and batches rarely mix
+    // resolutions.
+    static std::mutex mutex;
+    static std::shared_ptr<const EquirectLut> latest;
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!latest || latest->resolution != resolution)
+    {
+        latest.reset();
+        auto lut = std::make_shared<EquirectLut>();
+        lut->resolution = resolution;
+        lut->u.resize((size_t)6 * resolution * resolution);
+        lut->v.resize((size_t)6 * resolution * resolution);
+        ParallelFor(6 * resolution, [&](int row)
+        {
+            int face = row / resolution;
+            int y = row % resolution;
+            for (int x = 0; x < resolution; x++)
+            {
+                Vec3 dir = Normalize(CubeTexelDirection(face, x, y, resolution));
+                lut->u[(size_t)row * resolution + x] = std::atan2(dir.z, dir.x) * 0.1591f + 0.5f;
+                lut->v[(size_t)row * resolution + x] = std::asin(dir.y) * 0.3183f + 0.5f;
+            }
+        });
+        latest = lut;
+    }
+    return latest;
+}
+
+static float Lanczos2(float t)
+{
+    t = std::abs(t);
+    if (t < 1e-4f)
+    {
+        return 1.0f;
+    }
+    if (t >= 2.0f)
+    {
+        return 0.0f;
+    }
+    float x = PI * t;
+    return 2.0f * std::sin(x) * std::sin(0.5f * x) / (x * x);
+}
+
+// Weights along one axis of the panorama texels (texel i centred on i) under a footprint of the given size centred
+// on position. Returns the first texel, weights holding one entry per texel from there. Box weights are the
+// overlap of every texel with the footprint, Lanczos 2 is stretched to it. Footprints under a texel are widened
+// to one, where Box becomes linear interpolation.
+static int FootprintWeights(float position, float footprint, EquirectFilter filter, std::vector<float>& weights)
+{
+    footprint = std::max(footprint, 1.0f);
+    float radius = filter == EquirectFilter::Box ? 0.5f * footprint + 0.5f : 2.0f * footprint;
+    int first = (int)std::ceil(position - radius);
+    int last = (int)std::floor(position + radius);
+    weights.resize(last - first + 1);
+    for (int i = first; i <= last; i++)
+    {
+        if (filter == EquirectFilter::Box)
+        {
+            float overlap = std::min(i + 0.5f, position + 0.5f * footprint) - std::max(i - 0.5f, position - 0.5f * footprint);
+            weights[i - first] = std::max(overlap, 0.0f);
+        }
+        else
+        {
+            weights[i - first] = Lanczos2((i - position) / footprint);
+        }
+    }
+    return first;
+}
+
+// Filter weights of the panorama texels under the footprint of one cube texel: columnWeights from firstColumn
+// (wrapping around) and rowWeights from firstRow (clamped), rows counting from the bottom like HdrImage.
+struct EquirectFootprint
+{
+    int firstColumn;
+    int firstRow;
+    std::vector<float> columnWeights;
+    std::vector<float> rowWeights;
+};
+
+// The footprint of cube texel x, y of face is how far u and v move towards the neighbouring texels (u the short way
+// round the seam), so it grows towards the poles where a cube texel spans many panorama columns.
+static void EquirectFootprintAt(const EquirectLut& lut, int face, int x, int y, int width, int height, EquirectFilter filter,
+    EquirectFootprint& footprint)
+{
+    int resolution = lut.resolution;
+    size_t row = (size_t)face * resolution + y;
+    // Neighbouring texels of the same face, the texel itself at the face edges.
+    size_t above = (y > 0 ? row - 1 : row) * resolution;
+    size_t below = (y + 1 < resolution ? row + 1 : row) * resolution;
+    const float* u = &lut.u[row * resolution];
+    const float* v = &lut.v[row * resolution];
+    auto wrap = [](float d) { return d - std::round(d); };
+    int x0 = std::max(x - 1, 0);
+    int x1 = std::min(x + 1, resolution - 1);
+    float steps = (float)std::max(x1 - x0, 1);
+    float dudx = std::abs(wrap(u[x1] - u[x0])) / steps;
+    float dvdx = std::abs(v[x1] - v[x0]) / steps;
+    float rowSteps = (float)std::max((int)(y > 0) + (int)(y + 1 < resolution), 1);
+    float dudy = std::abs(wrap(lut.u[below + x] - lut.u[above + x])) / rowSteps;
+    float dvdy = std::abs(lut.v[below + x] - lut.v[above + x]) / rowSteps;
+    float footprintU = std::min(std::max(dudx, dudy) * width, (float)width);
+    float footprintV = std::max(dvdx, dvdy) * height;
+
+    footprint.firstColumn = FootprintWeights(u[x] * width - 0.5f, footprintU, filter, footprint.columnWeights);
+    footprint.firstRow = FootprintWeights(v[x] * height - 0.5f, footprintV, filter, footprint.rowWeights);
+}
+
+// cos(latitude) of every panorama row, rows counting from the bottom.
+static std::vector<float> RowSolidAngles(int height)
+{
+    std::vector<float> rowSolidAngle(height);
+    for (int row = 0; row < height; row++)
+    {
+        rowSolidAngle[row] = std::cos(((row + 0.5f) / height - 0.5f) * PI);
+    }
+    return rowSolidAngle;
+}
+
+// Filters the panorama over a footprint, rowAt(row) giving the texels of every row it covers. Every row is weighted
+// by the solid angle of its texels.
+template <typename RowAt>
+static Color SampleFootprint(const EquirectFootprint& footprint, int width, int height, const std::vector<float>& rowSolidAngle, RowAt rowAt)
+{
+    float columnSum = 0.0f;
+    for (float weight : footprint.columnWeights)
+    {
+        columnSum += weight;
+    }
+
+    Color sum = { 0.0f, 0.0f, 0.0f, 0.0f };
+    float weightSum = 0.0f;
+    for (int j = 0; j < (int)footprint.rowWeights.size(); j++)
+    {
+        int row = std::clamp(footprint.firstRow + j, 0, height - 1);
+        float rowWeight = footprint.rowWeights[j] * rowSolidAngle[row];
+        if (rowWeight == 0.0f)
+        {
+            continue;
+        }
+        const float* source = rowAt(row);
+        Color rowSum = { 0.0f, 0.0f, 0.0f, 0.0f };
+        int column = ((footprint.firstColumn % width) + width) % width;
+        for (float weight : footprint.columnWeights)
+        {
+            const float* texel = source + (size_t)column * 3;
+            rowSum += Color{ texel[0], texel[1], texel[2], 0.0f } * weight;
+            column = column + 1 == width ? 0 : column + 1;
+        }
+        sum += rowSum * rowWeight;
+        weightSum += columnSum * rowWeight;
+    }
+    sum = sum * (1.0f / weightSum);
+    // Lanczos lobes can ring below zero next to very bright texels.
+    return { std::max(sum.r, 0.0f), std::max(sum.g, 0.0f), std::max(sum.b, 0.0f), 1.0f };
+}
+
+void EquirectToCubemap(const HdrImage& hdri, CubemapImage& cubemap, EquirectFilter filter)
+{
+    int resolution = cubemap.Resolution();
+    std::shared_ptr<const EquirectLut> lut = GetEquirectLut(resolution);
+    size_t rowFloats = (size_t)hdri.width * 3;
+    std::vector<float> rowSolidAngle = RowSolidAngles(hdri.height);
+    auto rowAt = [&](int row) { return hdri.rgb.get() + row * rowFloats; };
+
+    ParallelFor(6 * resolution, [&](int row)
+    {
+        int face = row / resolution;
+        int y = row % resolution;
+        Color* destination = cubemap.Face(0, face) + y * resolution;
+        const float* u = &lut->u[(size_t)row * resolution];
+        const float* v = &lut->v[(size_t)row * resolution];
+        if (filter == EquirectFilter::Bilinear)
+        {
+            for (int x = 0; x < resolution; x++)
+            {
+                EquirectTap tap = EquirectTapAt(hdri.width, hdri.height, u[x], v[x]);
+                destination[x] = SampleTap(rowAt(tap.y0), rowAt(tap.y1), tap);
+            }
+            return;
+        }
+
+        EquirectFootprint footprint;
+        for (int x = 0; x < resolution; x++)
+        {
+            EquirectFootprintAt(*lut, face, x, y, hdri.width, hdri.height, filter, footprint);
+            destination[x] = SampleFootprint(footprint, hdri.width, hdri.height, rowSolidAngle, rowAt);
+        }
+    });
+    cubemap.QuantizeToHalf(0);
+}
+
+// Inputs this large (16K x 8K) take 1.5 GiB as floats, so they are streamed even without --stream.
+static const long long streamPixelThreshold = 16384LL * 8192;
+// Decoded rows held at once while streaming.
+static const size_t streamBandBytes = 64 << 20;
+
+bool ShouldStreamHdri(const char* hdriPath, const ConvoluteSettings& settings)
+{
+    RadianceReader reader;
+    return settings.streamHdri || (reader.Open(hdriPath) && (long long)reader.Width() * reader.Height() >= streamPixelThreshold);
+}
+
+bool StreamEquirectToCubemap(const char* hdriPath, float maxRadiance, CubemapImage& cubemap, EquirectFilter filter)
+{
+    RadianceReader reader;
+    if (!reader.Open(hdriPath))
+    {
+        std::cout << "Failed to open " << hdriPath << " for streaming, only Radiance .hdr files are supported" << std::endl;
+        return false;
+    }
+    int width = reader.Width();
+    int height = reader.Height();
+    int resolution = cubemap.Resolution();
+    size_t rowFloats = (size_t)width * 3;
+    std::shared_ptr<const EquirectLut> lut = GetEquirectLut(resolution);
+    std::vector<float> rowSolidAngle = RowSolidAngles(height);
+
+    // Scanlines arrive top to bottom, so band b holds file rows [b * bandRows, (b + 1) * bandRows), file row r being
+    // panorama row height - 1 - r. The first and last file rows a texel reads are those of its bilinear taps or
+    // of its footprint.
+    auto texelFileRows = [&](int face, int x, int y, EquirectFootprint& footprint)
+    {
+        int bottom, top;
+        if (filter == EquirectFilter::Bilinear)
+        {
+            size_t index = ((size_t)face * resolution + y) * resolution + x;
+            EquirectTap tap = EquirectTapAt(width, height, lut->u[index], lut->v[index]);
+            bottom = tap.y0;
+            top = tap.y1;
+        }
+        else
+        {
+            EquirectFootprintAt(*lut, face, x, y, width, height, filter, footprint);
+            bottom = std::clamp(footprint.firstRow, 0, height - 1);
+            top = std::clamp(footprint.firstRow + (int)footprint.rowWeights.size() - 1, 0, height - 1);
+        }
+        return std::make_pair(height - 1 - top, height - 1 - bottom);
+    };
+
+    // Every texel is resampled while the band holding the last file row it reads is resident. The rows it reads
+    // from earlier bands are carried over, as many as the tallest footprint needs: one for Bilinear, more for
+    // the other filters, and most at low cube resolutions.
+    int bandRows = std::clamp((int)(streamBandBytes / (rowFloats * sizeof(float))), 1, height);
+    int bandCount = (height + bandRows - 1) / bandRows;
+
+    // Group each face row into runs of texels that belong to the same band. Texels of a row sweep the latitudes
+    // monotonically on either side of its centre, so there are only a few runs per row.
+    struct Run
+    {
+        int face;
+        int y;
+        int x0, x1;
+        int band;
+    };
+    std::vector<std::vector<Run>> rowRuns(6 * resolution);
+    std::vector<int> rowCarry(6 * resolution);
+    ParallelFor(6 * resolution, [&](int row)
+    {
+        int face = row / resolution;
+        int y = row % resolution;
+        Run run = { face, y, 0, 0, -1 };
+        EquirectFootprint footprint;
+        for (int x = 0; x < resolution; x++)
+        {
+            auto [first, last] = texelFileRows(face, x, y, footprint);
+            rowCarry[row] = std::max(rowCarry[row], last - first);
+            int band = last / bandRows;
+            if (band != run.band)
+            {
+                if (run.band >= 0)
+                {
+                    run.x1 = x;
+                    rowRuns[row].push_back(run);
+                }
+                run.x0 = x;
+                run.band = band;
+            }
+        }
+        run.x1 = resolution;
+        rowRuns[row].push_back(run);
+    });
+    int carryRows = *std::max_element(rowCarry.begin(), rowCarry.end());
+    std::vector<std::vector<Run>> bandRuns(bandCount);
+    for (std::vector<Run>& runs : rowRuns)
+    {
+        for (const Run& run : runs)
+        {
+            bandRuns[run.band].push_back(run);
+        }
+        std::vector<Run>().swap(runs);
+    }
+
+    // The first carryRows slots hold the rows carried over, file row r of band b lives in slot
+    // r - b * bandRows + carryRows.
+    std::vector<float> rows((size_t)(carryRows + bandRows) * rowFloats);
+    for (int band = 0; band < bandCount; band++)
+    {
+        int firstRow = band * bandRows;
+        if (band > 0)
+        {
+            std::copy(rows.begin() + (size_t)bandRows * rowFloats, rows.end(), rows.begin());
+        }
+        if (!reader.ReadScanlines(std::min(bandRows, height - firstRow), maxRadiance, rows.data() + (size_t)carryRows * rowFloats))
+        {
+            std::cout << "Failed to decode " << hdriPath << std::endl;
+            return false;
+        }
+
+        auto rowAt = [&](int row) { return rows.data() + (size_t)(height - 1 - row - firstRow + carryRows) * rowFloats; };
+        const std::vector<Run>& runs = bandRuns[band];
+        ParallelFor((int)runs.size(), [&](int i)
+        {
+            const Run& run = runs[i];
+            Color* destination = cubemap.Face(0, run.face) + run.y * resolution;
+            EquirectFootprint footprint;
+            for (int x = run.x0; x < run.x1; x++)
+            {
+                size_t index = ((size_t)run.face * resolution + run.y) * resolution + x;
+                if (filter == EquirectFilter::Bilinear)
+                {
+                    EquirectTap tap = EquirectTapAt(width, height, lut->u[index], lut->v[index]);
+                    destination[x] = SampleTap(rowAt(tap.y0), rowAt(tap.y1), tap);
+                }
+                else
+                {
+                    EquirectFootprintAt(*lut, run.face, x, run.y, width, height, filter, footprint);
+                    destination[x] = SampleFootprint(footprint, width, height, rowSolidAngle, rowAt);
+                }
+            }
+        });
+    }
+    cubemap.QuantizeToHalf(0);
+    return true;
+}
+
+// One seamless level. The ring of texels around every parent face is gathered from its neighbours first, so the
+// kernel itself runs on plain rows without any edge cases.
+static void DownsampleSeamless(CubemapImage& cubemap, int level, std::vector<Color>& border)
+{
+    int parentRes = cubemap.MipResolution(level - 1);
+    int mipRes = cubemap.MipResolution(level);
+    // Per face: the row above and the row below including the corners, then the column left and the column right.
+    int paddedRes = parentRes + 2;
+    size_t faceBorder = (size_t)paddedRes * 2 + (size_t)parentRes * 2;
+    border.resize(faceBorder * 6);
+    ParallelFor(6, [&](int face)
+    {
+        Color* destination = &border[face * faceBorder];
+        for (int x = -1; x <= parentRes; x++)
+        {
+            destination[x + 1] = cubemap.FetchSeamless(level - 1, face, x, -1);
+            destination[paddedRes + x + 1] = cubemap.FetchSeamless(level - 1, face, x, parentRes);
+        }
+        for (int y = 0; y < parentRes; y++)
+        {
+            destination[2 * paddedRes + y] = cubemap.FetchSeamless(level - 1, face, -1, y);
+            destination[2 * paddedRes + parentRes + y] = cubemap.FetchSeamless(level - 1, face, parentRes, y);
+        }
+    });
+
+    // Child texel x covers parent texels 2x and 2x + 1, so its taps are parent texels 2x - 1 to 2x + 2. Those are
+    // never more than one texel outside the face, even for odd parent resolutions.
+    ParallelFor(6 * mipRes, [&](int row)
+    {
+        int face = row / mipRes;
+        int y = row % mipRes;
+        const Color* parent = cubemap.Face(level - 1, face);
+        const Color* faceBorderTexels = &border[face * faceBorder];
+        const Color* left = faceBorderTexels + 2 * paddedRes;
+        const Color* right = left + parentRes;
+
+        // The four parent rows, weighted 1 3 3 1, with the face borders on either end.
+        std::vector<Color> columns(paddedRes);
+        const Color* rows[4];
+        Color leftTexels[4];
+        Color rightTexels[4];
+        for (int i = 0; i < 4; i++)
+        {
+            int parentY = 2 * y - 1 + i;
+            if (parentY < 0 || parentY >= parentRes)
+            {
+                rows[i] = faceBorderTexels + (parentY < 0 ? 0 : paddedRes) + 1;
+                leftTexels[i] = rows[i][-1];
+                rightTexels[i] = rows[i][parentRes];
+            }
+            else
+            {
+                rows[i] = parent + parentY * parentRes;
+                leftTexels[i] = left[parentY];
+                rightTexels[i] = right[parentY];
+            }
+        }
+        columns[0] = leftTexels[0] + (leftTexels[1] + leftTexels[2]) * 3.0f + leftTexels[3];
+        columns[paddedRes - 1] = rightTexels[0] + (rightTexels[1] + rightTexels[2]) * 3.0f + rightTexels[3];
+        for (int x = 0; x < parentRes; x++)
+        {
+            columns[x + 1] = rows[0][x] + (rows[1][x] + rows[2][x]) * 3.0f + rows[3][x];
+        }
+
+        Color* destination = cubemap.Face(level, face) + y * mipRes;
+        for (int x = 0; x < mipRes; x++)
+        {
+            const Color* taps = &columns[2 * x];
+            destination[x] = (taps[0] + (taps[1] + taps[2]) * 3.0f + taps[3]) * (1.0f / 64.0f);
+        }
+    });
+}
+
+void GenerateMipmaps(CubemapImage& cubemap, MipFilter filter)
+{
+    std::vector<Color> border;
+    for (int level = 1; level < cubemap.MipLevels(); level++)
+    {
+        int parentRes = cubemap.MipResolution(level - 1);
+        int mipRes = cubemap.MipResolution(level);
+        if (filter == MipFilter::Seamless)
+        {
+            DownsampleSeamless(cubemap, level, border);
+            cubemap.QuantizeToHalf(level);
+            continue;
+        }
+        ParallelFor(6 * mipRes, [&](int row)
+        {
+            int face = row / mipRes;
+            int y = row % mipRes;
+            const Color* parent = cubemap.Face(level - 1, face);
+            const Color* row0 = parent + std::min(2 * y, parentRes - 1) * parentRes;
+            const Color* row1 = parent + std::min(2 * y + 1, parentRes - 1) * parentRes;
+            Color* destination = cubemap.Face(level, face) + y * mipRes;
+            for (int x = 0; x < mipRes; x++)
+            {
+                int x0 = std::min(2 * x, parentRes - 1);
+                int x1 = std::min(2 * x + 1, parentRes - 1);
+                destination[x] = (row0[x0] + row0[x1] + row1[x0] + row1[x1]) * 0.25f;
+            }
+        });
+        cubemap.QuantizeToHalf(level);
+    }
+}
+
+std::vector<IrradianceSample> BuildIrradianceSamples(float sampleDelta)
+{
+    // Accumulating phi and theta in float keeps the sample count identical to convolute.frag.
+    const float nSamples = ((2.0f * PI) / sampleDelta) * ((0.5f * PI) / sampleDelta);
+    std::vector<IrradianceSample> samples;
+    for (float phi = 0.0f; phi < 2.0f * PI; phi += sampleDelta)
+    {
+        for (float theta = 0.0f; theta < 0.5f * PI; theta += sampleDelta)
+        {
+            Vec3 tangentDir = { std::sin(theta) * std::cos(phi), std::sin(theta) * std::sin(phi), std::cos(theta) };
+            samples.push_back({ tangentDir, std::cos(theta) * std::sin(theta) * (1.0f / nSamples) });
+        }
+    }
+    return samples;
+}
+
+void ConvoluteIrradiance(const CubemapImage& environmentMap, CubemapImage& irradiance, float sampleDelta)
+{
+    // The sample pattern is the same for every texel, so evaluate the trigonometry once.
+    std::vector<IrradianceSample> samples = BuildIrradianceSamples(sampleDelta);
+    int irradianceRes = irradiance.Resolution();
+    float lod = std::max(IrradianceSourceLod(environmentMap.Resolution(), irradianceRes) - std::log2(irradianceSampleDelta / sampleDelta), 0.0f);
+
+    ParallelFor(6 * irradianceRes, [&](int row)
+    {
+        int face = row / irradianceRes;
+        int y = row % irradianceRes;
+        Color* destination = irradiance.Face(0, face) + y * irradianceRes;
+        for (int x = 0; x < irradianceRes; x++)
+        {
+            Vec3 normal = Normalize(CubeTexelDirection(face, x, y, irradianceRes));
+            Vec3 up = { 0.0f, 1.0f, 0.0f };
+            Vec3 right = Normalize(Cross(up, normal));
+            up = Normalize(Cross(normal, right));
+
+            Color sum = { 0.0f, 0.0f, 0.0f, 0.0f };
+            for (const IrradianceSample& sample : samples)
+            {
+                Vec3 sampleVec = sample.tangentDir.x * right + sample.tangentDir.y * up + sample.tangentDir.z * normal;
+                sum += environmentMap.SampleTrilinear(sampleVec, lod) * sample.weight;
+            }
+            sum = sum * PI;
+            sum.a = 1.0f;
+            destination[x] = sum;
+        }
+    });
+    irradiance.QuantizeToHalf(0);
+}
+
+void PrefilterLevel(const CubemapImage& environmentMap, CubemapImage& prefiltered, int level, std::uint32_t sampleCount)
+{
+    float roughness = PrefilterRoughness(level, prefiltered.MipLevels());
+    std::vector<PrefilterSample> samples = BuildPrefilterSamples(roughness, environmentMap.Resolution(), sampleCount);
+
+    int mipRes = prefiltered.MipResolution(level);
+    ParallelFor(6 * mipRes, [&](int row)
+    {
+        int face = row / mipRes;
+        int y = row % mipRes;
+        Color* destination = prefiltered.Face(level, face) + y * mipRes;
+        for (int x = 0; x < mipRes; x++)
+        {
+            destination[x] = PrefilterDirection(environmentMap, Normalize(CubeTexelDirection(face, x, y, mipRes)), samples);
+        }
+    });
+    prefiltered.QuantizeToHalf(level);
+}
+
+void PrefilterEnvironment(const CubemapImage& environmentMap, CubemapImage& prefiltered, const std::vector<std::uint32_t>& sampleCounts)
+{
+    for (int level = 0; level < prefiltered.MipLevels(); level++)
+    {
+        PrefilterLevel(environmentMap, prefiltered, level, sampleCounts[level]);
+    }
+}
+
+long long CubemapPixels(const CubemapImage& cubemap, int firstLevel, int levelCount)
+{
+    long long pixels = 0;
+    for (int level = firstLevel; level < firstLevel + levelCount; level++)
+    {
+        pixels += 6LL * cubemap.MipResolution(level) * cubemap.MipResolution(level);
+    }
+    return pixels;
+}
+
+CubemapFile CompressCubemap(const CubemapImage& cubemap, BC6HQuality quality, StageTimings* timings)
+{
+    ScopedStageTimer timer(timings, "bc6h");
+    CubemapFile file;
+    file.Allocate(cubemap.Resolution(), cubemap.MipLevels());
+
+    // Half float staging for every face and mip, so all of them can be in flight in the compressor at once.
+    struct Surface
+    {
+        int face;
+        int level;
+        size_t stagingOffset;
+    };
+    std::vector<Surface> surfaces;
+    size_t stagingSize = 0;
+    for (int face = 0; face < 6; face++)
+    {
+        for (int level = 0; level < cubemap.MipLevels(); level++)
+        {
+            int mipRes = cubemap.MipResolution(level);
+            surfaces.push_back({ face, level, stagingSize });
+            stagingSize += (size_t)mipRes * mipRes * 4;
+        }
+    }
+
+    std::vector<std::uint16_t> halfPixels(stagingSize);
+    ParallelFor((int)surfaces.size(), [&](int i)
+    {
+        const Surface& surface = surfaces[i];
+        int mipRes = cubemap.MipResolution(surface.level);
+        FloatToHalf(&cubemap.Face(surface.level, surface.face)->r, &halfPixels[surface.stagingOffset], (size_t)mipRes * mipRes * 4);
+    });
+
+    BC6HCompressor compressor(quality);
+    for (const Surface& surface : surfaces)
+    {
+        int mipRes = cubemap.MipResolution(surface.level);
+        compressor.Enqueue((const std::uint8_t*)&halfPixels[surface.stagingOffset], mipRes, mipRes, file.SubresourcePixels(surface.face, surface.level));
+    }
+    compressor.Wait();
+    timer.AddMegapixels(Megapixels(compressor.Pixels()));
+    if (timings)
+    {
+        timings->AddThreadTime("bc6h", compressor.BusyMilliseconds());
+    }
+    return file;
+}
+
+CubemapFile ToHalfCubemapFile(const CubemapImage& cubemap)
+{
+    CubemapFile file;
+    file.Allocate(cubemap.Resolution(), cubemap.MipLevels(), CubemapPixelFormat::RGBA16F);
+    ParallelFor(6 * cubemap.MipLevels(), [&](int i)
+    {
+        int face = i / cubemap.MipLevels();
+        int level = i % cubemap.MipLevels();
+        int mipRes = cubemap.MipResolution(level);
+        FloatToHalf(&cubemap.Face(level, face)->r, (std::uint16_t*)file.SubresourcePixels(face, level), (size_t)mipRes * mipRes * 4);
+    });
+    return file;
+}
+
+static void WriteCompressedCubemap(const CubemapImage& cubemap, const ConvoluteSettings& settings, const char* fileName, StageTimings* timings)
+{
+    CubemapFile file = CompressCubemap(cubemap, settings.compressionQuality, timings);
+    ScopedStageTimer timer(timings, "write");
+    timer.AddBytesWritten(WriteCubemapFile(file, settings.OutputPath(fileName), settings.fileOrder, settings.supercompress,
+        settings.fileVersion));
+    if (settings.writeUncompressed)
+    {
+        timer.AddBytesWritten(WriteCubemapFile(ToHalfCubemapFile(cubemap), settings.OutputPath(UncompressedFileName(fileName).c_str())));
+    }
+}
+
+void ConvoluteIrradianceSH(const CubemapImage& environmentMap, int level, const ConvoluteSettings& settings, int irradianceRes, StageTimings* timings)
+{
+    ShCoefficients irradianceSH;
+    {
+        ScopedStageTimer timer(timings, "sh_project");
+        irradianceSH = RadianceToIrradianceSH(ProjectToSH(environmentMap, level, settings.shBands));
+        timer.AddMegapixels(Megapixels(CubemapPixels(environmentMap, level, 1)));
+    }
+    {
+        ScopedStageTimer timer(timings, "write");
+        timer.AddBytesWritten(WriteShFile(irradianceSH, settings.OutputPath("irradiance.sh")));
+    }
+
+    if (settings.irradianceMode == IrradianceMode::SH)
+    {
+        CubemapImage irradianceMap(irradianceRes, 1);
+        {
+            ScopedStageTimer timer(timings, "sh_reconstruct");
+            ReconstructFromSH(irradianceSH, irradianceMap);
+            timer.AddMegapixels(Megapixels(CubemapPixels(irradianceMap, 0, 1)));
+        }
+        WriteCompressedCubemap(irradianceMap, settings, "irradiance.cbmp", timings);
+    }
+}
+
+static void FromHalfCubemapFile(const CubemapFile& file, CubemapImage& cubemap)
+{
+    ParallelFor(6 * cubemap.MipLevels(), [&](int i)
+    {
+        int face = i / cubemap.MipLevels();
+        int level = i % cubemap.MipLevels();
+        int mipRes = cubemap.MipResolution(level);
+        HalfToFloat((const std::uint16_t*)file.SubresourcePixels(face, level), &cubemap.Face(level, face)->r, (size_t)mipRes * mipRes * 4);
+    });
+}
+
+bool BakeEnvironmentMap(const char* hdriPath, const ConvoluteSettings& settings, CubemapImage& environmentMap, StageTimings* timings)
+{
+    if (ShouldStreamHdri(hdriPath, settings))
+    {
+        ScopedStageTimer timer(timings, "stream_equirect");
+        if (!StreamEquirectToCubemap(hdriPath, settings.maxRadiance, environmentMap, settings.equirectFilter))
+        {
+            return false;
+        }
+        timer.AddMegapixels(Megapixels(CubemapPixels(environmentMap, 0, 1)));
+    }
+    else
+    {
+        HdrImage hdri;
+        {
+            ScopedStageTimer timer(timings, "load");
+            if (!LoadHdri(hdriPath, settings.maxRadiance, hdri))
+            {
+                return false;
+            }
+            timer.AddMegapixels(Megapixels((long long)hdri.width * hdri.height));
+        }
+        ScopedStageTimer timer(timings, "equirect");
+        EquirectToCubemap(hdri, environmentMap, settings.equirectFilter);
+        timer.AddMegapixels(Megapixels(CubemapPixels(environmentMap, 0, 1)));
+    }
+    ScopedStageTimer timer(timings, "mipmaps");
+    GenerateMipmaps(environmentMap, settings.mipFilter);
+    timer.AddMegapixels(Megapixels(CubemapPixels(environmentMap, 1, environmentMap.MipLevels() - 1)));
+    return true;
+}
+
+bool ConvoluteCpu(const char* hdriPath, const ConvoluteSettings& settings, StageTimings* timings)
+{
+    int resolution = settings.resolution;
+    CubemapImage environmentMap(resolution, 1 + (int)std::log2(resolution));
+    IncrementalBase incremental;
+    CubemapFile base;
+    bool reuseBase = false;
+    {
+        ScopedStageTimer timer(timings, "incremental");
+        incremental.Open(hdriPath, settings, "cpu");
+        reuseBase = incremental.ReadBase(base);
+    }
+
+    if (reuseBase)
+    {
+        ScopedStageTimer timer(timings, "load");
+        FromHalfCubemapFile(base, environmentMap);
+        timer.AddMegapixels(Megapixels(CubemapPixels(environmentMap, 0, environmentMap.MipLevels())));
+    }
+    else if (!BakeEnvironmentMap(hdriPath, settings, environmentMap, timings))
+    {
+        return false;
+    }
+    if (!incremental.StageValid(IncrementalStage::Envmap))
+    {
+        WriteCompressedCubemap(environmentMap, settings, "envmap.cbmp", timings);
+    }
+    if (settings.incremental)
+    {
+        if (!reuseBase)
+        {
+            base = ToHalfCubemapFile(environmentMap);
+        }
+        ScopedStageTimer timer(timings, "write");
+        timer.AddBytesWritten(incremental.CommitBase(reuseBase ? nullptr : &base));
+        timer.AddBytesWritten(incremental.CommitStage(IncrementalStage::Envmap));
+    }
+
+    if (!incremental.StageValid(IncrementalStage::Irradiance))
+    {
+        int irradianceRes = settings.irradianceResolution;
+        if (settings.irradianceMode == IrradianceMode::BruteForce)
+        {
+            CubemapImage irradianceMap(irradianceRes, 1);
+            {
+                ScopedStageTimer timer(timings, "irradiance");
+                ConvoluteIrradiance(environmentMap, irradianceMap);
+                timer.AddMegapixels(Megapixels(CubemapPixels(irradianceMap, 0, 1)));
+            }
+            WriteCompressedCubemap(irradianceMap, settings, "irradiance.cbmp", timings);
+        }
+        else
+        {
+            ConvoluteIrradianceSH(environmentMap, ShSourceLevel(resolution, environmentMap.MipLevels()), settings, irradianceRes, timings);
+        }
+        ScopedStageTimer timer(timings, "write");
+        timer.AddBytesWritten(incremental.CommitStage(IncrementalStage::Irradiance));
+    }
+
+    if (incremental.StageValid(IncrementalStage::Prefilter))
+    {
+        return true;
+    }
+    int prefilterRes = settings.prefilterResolution;
+    int mipLevels = settings.prefilterMipLevels;
+    CubemapImage prefilterMap(prefilterRes, mipLevels);
+    std::vector<std::uint32_t> sampleCounts;
+    {
+        ScopedStageTimer timer(timings, "prefilter_schedule");
+        int proxyLevel = PrefilterProxyLevel(resolution, environmentMap.MipLevels());
+        sampleCounts = PrefilterSampleSchedule(environmentMap.MipTail(proxyLevel), mipLevels, settings.prefilterErrorTarget);
+    }
+    {
+        ScopedStageTimer timer(timings, "prefilter");
+        PrefilterEnvironment(environmentMap, prefilterMap, sampleCounts);
+        timer.AddMegapixels(Megapixels(CubemapPixels(prefilterMap, 0, mipLevels)));
+    }
+    WriteCompressedCubemap(prefilterMap, settings, "prefilter.cbmp", timings);
+    ScopedStageTimer timer(timings, "write");
+    timer.AddBytesWritten(incremental.CommitStage(IncrementalStage::Prefilter));
+    return true;
+}
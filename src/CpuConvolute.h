@@ -0,0 +1,98 @@
+#ifndef CPU_CONVOLUTE_H
+#define CPU_CONVOLUTE_H
+
+#include "ConvoluteSettings.h"
+#include "Cubemap.h"
+#include "CubemapFile.h"
+#include "HdrImage.h"
+#include "Timing.h"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// CPU ports of the GL stages. Each one matches the shader of the same name so the backends are interchangeable.
+
+// Panorama coordinates (u, v in [0, 1]) of every texel centre of a cube map, as equirectToCubemap.frag computes
+// them, so resampling doesn't evaluate atan and asin per texel. Face major, then rows of resolution texels.
+struct EquirectLut
+{
+    int resolution = 0;
+    std::vector<float> u;
+    std::vector<float> v;
+};
+
+// The table for a resolution, computed on first use and kept for the following jobs at that resolution.
+std::shared_ptr<const EquirectLut> GetEquirectLut(int resolution);
+
+// Resamples hdri into mip 0 of cubemap. Bilinear matches equirectToCubemap.frag; Box and Lanczos filter the
+// whole footprint of each cube texel, which stays alias free however large the panorama is.
+void EquirectToCubemap(const HdrImage& hdri, CubemapImage& cubemap, EquirectFilter filter = EquirectFilter::Bilinear);
+
+// True when the HDRI should go through StreamEquirectToCubemap: --stream was given, or it is a Radiance file
+// too large to comfortably hold as floats.
+bool ShouldStreamHdri(const char* hdriPath, const ConvoluteSettings& settings);
+
+// EquirectToCubemap for Radiance files, decoding scanlines in bands straight into mip 0 of cubemap so peak memory
+// is one band of rows, plus the rows the tallest texel footprint reaches back, instead of the whole image.
+// Produces the same texels as loading the file and calling EquirectToCubemap with the same filter.
+bool StreamEquirectToCubemap(const char* hdriPath, float maxRadiance, CubemapImage& cubemap, EquirectFilter filter = EquirectFilter::Bilinear);
+
+// Fills mips 1 and up from mip 0. Box is the 2x2 filter per face glGenerateMipmap uses. Seamless weights the 4x4
+// parent texels around each child texel by 1 3 3 1 along both axes, taking the outer ring from the neighbouring
+// faces at the edges, so texels on either side of a seam blend the same parents and edges stay continuous.
+void GenerateMipmaps(CubemapImage& cubemap, MipFilter filter = MipFilter::Box);
+
+// Mip 0 from the HDRI (streamed when ShouldStreamHdri says so) and the other mips by settings.mipFilter: the
+// environment map every output is derived from.
+bool BakeEnvironmentMap(const char* hdriPath, const ConvoluteSettings& settings, CubemapImage& environmentMap, StageTimings* timings = nullptr);
+
+// One step of the hemisphere walk convolute.frag does, in the tangent frame of the texel (normal = +Z).
+struct IrradianceSample
+{
+    Vec3 tangentDir;
+    float weight; // cos(theta) sin(theta) / sample count
+};
+static_assert(sizeof(IrradianceSample) == 16, "IrradianceSample is uploaded as a std430 vec4");
+
+// Step of the walk in phi and theta that convolute.frag takes.
+constexpr float irradianceSampleDelta = 0.025f;
+
+std::vector<IrradianceSample> BuildIrradianceSamples(float sampleDelta = irradianceSampleDelta);
+
+// Implicit LOD the GL sampler picks in convolute.frag: one irradiance texel spans
+// environmentMapResolution / irradianceResolution environment texels.
+inline float IrradianceSourceLod(int environmentMapResolution, int irradianceResolution)
+{
+    return std::max(std::log2((float)environmentMapResolution / irradianceResolution), 0.0f);
+}
+
+// convolute.frag into mip 0 of irradiance. A finer sampleDelta than the shader's also fetches from a finer source
+// mip, as each sample then covers less of the sphere.
+void ConvoluteIrradiance(const CubemapImage& environmentMap, CubemapImage& irradiance, float sampleDelta = irradianceSampleDelta);
+
+// prefilter.frag, roughness increasing linearly from 0 at mip 0 to 1 at the last mip of prefiltered. sampleCounts
+// holds the GGX sample count of each mip, see PrefilterSampleSchedule.
+void PrefilterEnvironment(const CubemapImage& environmentMap, CubemapImage& prefiltered, const std::vector<std::uint32_t>& sampleCounts);
+
+// One mip of PrefilterEnvironment, at the roughness that mip gets there.
+void PrefilterLevel(const CubemapImage& environmentMap, CubemapImage& prefiltered, int level, std::uint32_t sampleCount);
+
+// SH replacement for ConvoluteIrradiance: projects the given environment level and writes irradiance.sh, plus the
+// reconstructed irradiance.cbmp unless only coefficients were requested.
+void ConvoluteIrradianceSH(const CubemapImage& environmentMap, int level, const ConvoluteSettings& settings, int irradianceRes,
+    StageTimings* timings = nullptr);
+
+// BC6H compresses all faces and mips with the same face major layout the GL path writes.
+CubemapFile CompressCubemap(const CubemapImage& cubemap, BC6HQuality quality, StageTimings* timings = nullptr);
+
+// RGBA16F copy of every face and mip of cubemap, whose texels are already half precision.
+CubemapFile ToHalfCubemapFile(const CubemapImage& cubemap);
+
+// Texels in all faces of the given mip levels, for throughput figures.
+long long CubemapPixels(const CubemapImage& cubemap, int firstLevel, int levelCount);
+
+// timings, when given, receives the per stage breakdown for the report.
+bool ConvoluteCpu(const char* hdriPath, const ConvoluteSettings& settings, StageTimings* timings = nullptr);
+
+#endif // !CPU_CONVOLUTE_H
@@ -0,0 +1,147 @@
+#include "Cubemap.h"
+
+#include "Half.h"
+
+#include <cstdint>
+
+Vec3 CubeFaceDirection(int face, float sc, float tc)
+{
+    switch (face)
+    {
+    case 0: return { 1.0f, -tc, -sc };   // POSITIVE_X
+    case 1: return { -1.0f, -tc, sc };   // NEGATIVE_X
+    case 2: return { sc, 1.0f, tc };     // POSITIVE_Y
+    case 3: return { sc, -1.0f, -tc };   // NEGATIVE_Y
+    case 4: return { sc, -tc, 1.0f };    // POSITIVE_Z
+    default: return { -sc, -tc, -1.0f }; // NEGATIVE_Z
+    }
+}
+
+void DirectionToCubeCoords(Vec3 dir, int& face, float& s, float& t)
+{
+    float ax = std::abs(dir.x);
+    float ay = std::abs(dir.y);
+    float az = std::abs(dir.z);
+    float ma, sc, tc;
+    if (ax >= ay && ax >= az)
+    {
+        face = dir.x > 0.0f ? 0 : 1;
+        ma = ax;
+        sc = dir.x > 0.0f ? -dir.z : dir.z;
+        tc = -dir.y;
+    }
+    else if (ay >= az)
+    {
+        face = dir.y > 0.0f ? 2 : 3;
+        ma = ay;
+        sc = dir.x;
+        tc = dir.y > 0.0f ? dir.z : -dir.z;
+    }
+    else
+    {
+        face = dir.z > 0.0f ? 4 : 5;
+        ma = az;
+        sc = dir.z > 0.0f ? dir.x : -dir.x;
+        tc = -dir.y;
+    }
+    s = 0.5f * (sc / ma + 1.0f);
+    t = 0.5f * (tc / ma + 1.0f);
+}
+
+CubemapImage::CubemapImage(int resolution, int mipLevels)
+    : resolution(resolution), levels(mipLevels)
+{
+    for (int level = 0; level < mipLevels; level++)
+    {
+        int mipRes = MipResolution(level);
+        levels[level].resize((size_t)6 * mipRes * mipRes);
+    }
+}
+
+CubemapImage CubemapImage::MipTail(int firstLevel) const
+{
+    CubemapImage tail;
+    tail.resolution = MipResolution(firstLevel);
+    tail.levels.assign(levels.begin() + firstLevel, levels.end());
+    return tail;
+}
+
+const Color& CubemapImage::FetchSeamless(int level, int face, int x, int y) const
+{
+    int mipRes = MipResolution(level);
+    if (x < 0 || y < 0 || x >= mipRes || y >= mipRes)
+    {
+        // Extend the face plane past its edge and let the face selection pick the neighbour that covers it.
+        Vec3 dir = CubeTexelDirection(face, x, y, mipRes);
+        float s, t;
+        DirectionToCubeCoords(dir, face, s, t);
+        x = std::clamp((int)(s * mipRes), 0, mipRes - 1);
+        y = std::clamp((int)(t * mipRes), 0, mipRes - 1);
+    }
+    return Face(level, face)[y * mipRes + x];
+}
+
+Color CubemapImage::SampleFace(int level, int face, float s, float t) const
+{
+    int mipRes = MipResolution(level);
+    float x = s * mipRes - 0.5f;
+    float y = t * mipRes - 0.5f;
+    float x0f = std::floor(x);
+    float y0f = std::floor(y);
+    float fx = x - x0f;
+    float fy = y - y0f;
+    int x0 = (int)x0f;
+    int y0 = (int)y0f;
+
+    if (x0 >= 0 && y0 >= 0 && x0 + 1 < mipRes && y0 + 1 < mipRes)
+    {
+        const Color* row0 = Face(level, face) + y0 * mipRes + x0;
+        const Color* row1 = row0 + mipRes;
+        return Lerp(Lerp(row0[0], row0[1], fx), Lerp(row1[0], row1[1], fx), fy);
+    }
+
+    Color c00 = FetchSeamless(level, face, x0, y0);
+    Color c10 = FetchSeamless(level, face, x0 + 1, y0);
+    Color c01 = FetchSeamless(level, face, x0, y0 + 1);
+    Color c11 = FetchSeamless(level, face, x0 + 1, y0 + 1);
+    return Lerp(Lerp(c00, c10, fx), Lerp(c01, c11, fx), fy);
+}
+
+Color CubemapImage::SampleBilinear(Vec3 dir, int level) const
+{
+    int face;
+    float s, t;
+    DirectionToCubeCoords(dir, face, s, t);
+    return SampleFace(level, face, s, t);
+}
+
+Color CubemapImage::SampleTrilinear(Vec3 dir, float lod) const
+{
+    int face;
+    float s, t;
+    DirectionToCubeCoords(dir, face, s, t);
+
+    int maxLevel = MipLevels() - 1;
+    lod = std::clamp(lod, 0.0f, (float)maxLevel);
+    int level = (int)lod;
+    float fraction = lod - level;
+    if (fraction == 0.0f || level == maxLevel)
+    {
+        return SampleFace(level, face, s, t);
+    }
+    return Lerp(SampleFace(level, face, s, t), SampleFace(level + 1, face, s, t), fraction);
+}
+
+void CubemapImage::QuantizeToHalf(int level)
+{
+    float* values = &levels[level][0].r;
+    size_t count = levels[level].size() * 4;
+
+    std::uint16_t halves[256];
+    for (size_t i = 0; i < count; i += 256)
+    {
+        size_t chunk = std::min<size_t>(256, count - i);
+        FloatToHalf(values + i, halves, chunk);
+        HalfToFloat(halves, values + i, chunk);
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef CUBEMAP_H
+#define CUBEMAP_H
+
+#include "Math.h"
+
+#include <vector>
+
+// Direction through a point on a cube face, following the GL cube map face selection table.
+// sc and tc are in [-1, 1]; tc = -1 is the first row in memory (the row glReadPixels returns first).
+Vec3 CubeFaceDirection(int face, float sc, float tc);
+
+// Direction through the center of texel (x, y) of a face with the given resolution (not normalized).
+inline Vec3 CubeTexelDirection(int face, int x, int y, int resolution)
+{
+    return CubeFaceDirection(face, (2.0f * x + 1.0f) / resolution - 1.0f, (2.0f * y + 1.0f) / resolution - 1.0f);
+}
+
+// Inverse of CubeFaceDirection. s and t are returned in [0, 1].
+void DirectionToCubeCoords(Vec3 dir, int& face, float& s, float& t);
+
+// CPU side RGBA float cube map with a full or partial mip chain, laid out like the GL textures the
+// shaders render into: levels[mip] holds the six faces back to back, rows starting at tc = -1.
+class CubemapImage
+{
+public:
+    CubemapImage() = default;
+    CubemapImage(int resolution, int mipLevels);
+
+    int Resolution() const { return resolution; }
+    int MipLevels() const { return (int)levels.size(); }
+    int MipResolution(int level) const { return std::max(resolution >> level, 1); }
+
+    Color* Face(int level, int face) { return &levels[level][(size_t)face * MipResolution(level) * MipResolution(level)]; }
+    const Color* Face(int level, int face) const { return &levels[level][(size_t)face * MipResolution(level) * MipResolution(level)]; }
+
+    // Texel fetch that follows cube edges onto the neighbouring face when x or y is outside the face.
+    const Color& FetchSeamless(int level, int face, int x, int y) const;
+
+    // GL_LINEAR / GL_LINEAR_MIPMAP_LINEAR lookups with GL_TEXTURE_CUBE_MAP_SEAMLESS behaviour.
+    Color SampleBilinear(Vec3 dir, int level) const;
+    Color SampleTrilinear(Vec3 dir, float lod) const;
+
+    // Levels firstLevel and up as a cube map of their own.
+    CubemapImage MipTail(int firstLevel) const;
+
+    // Rounds every texel to half precision, mirroring what storing into an RGBA16F texture does.
+    void QuantizeToHalf(int level);
+private:
+    Color SampleFace(int level, int face, float s, float t) const;
+
+    int resolution = 0;
+    std::vector<std::vector<Color>> levels;
+};
+
+#endif // !CUBEMAP_H
@@ -0,0 +1,404 @@
+#include "CubemapFile.h"
+
+#include "Compression.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+static_assert(sizeof(CubemapFile::Header) == 32, "header layout is part of the file format");
+static_assert(sizeof(CubemapFile::Subresource) == 16, "table layout is part of the file format");
+static_assert(sizeof(CubemapFile::SupercompressionHeader) == 8, "supercompression header is part of the file format");
+
+// Size of the version 1 header: magic number, mip levels and resolution.
+static const std::size_t headerSizeV1 = 12;
+
+static std::uint64_t AlignUp(std::uint64_t value, std::uint64_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+std::size_t SubresourceSizeBytes(CubemapPixelFormat format, int mipResolution)
+{
+    if (format == CubemapPixelFormat::RGBA16F)
+    {
+        return (std::size_t)mipResolution * mipResolution * 8;
+    }
+    return MipSizeBC6(mipResolution);
+}
+
+static int MipResolution(const CubemapFile::Header& header, int level)
+{
+    return std::max((int)header.resolution >> level, 1);
+}
+
+// Uncompressed size of table entry i.
+static std::size_t SubresourceSizeBytes(const CubemapFile::Header& header, size_t i)
+{
+    return SubresourceSizeBytes(header.pixelFormat, MipResolution(header, (int)(i % header.mipmapLevels)));
+}
+
+// Supercompression contexts: the bytes of one BC6H block or one RGBA16F texel.
+static int ContextCount(CubemapPixelFormat format)
+{
+    return format == CubemapPixelFormat::RGBA16F ? 8 : 16;
+}
+
+void CubemapFile::Allocate(int resolution, int mipmapLevels, CubemapPixelFormat pixelFormat)
+{
+    header = Header();
+    header.resolution = resolution;
+    header.mipmapLevels = mipmapLevels;
+    header.pixelFormat = pixelFormat;
+    pixels.resize(SubresourceOffset(faceCount, 0));
+}
+
+std::size_t CubemapFile::SubresourceOffset(int face, int level) const
+{
+    std::size_t faceSize = 0;
+    std::size_t levelOffset = 0;
+    for (int j = 0; j < (int)header.mipmapLevels; j++)
+    {
+        std::size_t size = SubresourceSizeBytes(header.pixelFormat, MipResolution(header, j));
+        levelOffset += j < level ? size : 0;
+        faceSize += size;
+    }
+    return face * faceSize + levelOffset;
+}
+
+static bool IsValidFormat(CubemapPixelFormat format)
+{
+    return format == CubemapPixelFormat::BC6H_UF16 || format == CubemapPixelFormat::RGBA16F;
+}
+
+// Table indices in the order their pixels are stored.
+static std::vector<size_t> StorageOrder(const CubemapFile::Header& header)
+{
+    std::vector<size_t> order;
+    if (header.flags & CubemapFile::flagMipMajor)
+    {
+        for (int level = (int)header.mipmapLevels - 1; level >= 0; level--)
+        {
+            for (size_t face = 0; face < header.faces; face++)
+            {
+                order.push_back(face * header.mipmapLevels + level);
+            }
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < (size_t)header.faces * header.mipmapLevels; i++)
+        {
+            order.push_back(i);
+        }
+    }
+    return order;
+}
+
+// Table of the version 2 layout for header with pixel data from dataOffset on, offsets from the start of the file.
+static std::vector<CubemapFile::Subresource> LayoutV2(const CubemapFile::Header& header, const std::vector<std::uint64_t>& storedSizes, std::uint64_t dataOffset)
+{
+    std::vector<CubemapFile::Subresource> subresources(storedSizes.size());
+    std::uint64_t offset = dataOffset;
+    for (size_t i : StorageOrder(header))
+    {
+        offset = AlignUp(offset, header.subresourceAlignment);
+        subresources[i].offset = offset;
+        subresources[i].size = storedSizes[i];
+        offset += subresources[i].size;
+    }
+    return subresources;
+}
+
+std::uint64_t CubemapFileLayout::PrefixSize(int level) const
+{
+    std::uint64_t size = 0;
+    for (size_t i = 0; i < subresources.size(); i++)
+    {
+        if ((int)(i % header.mipmapLevels) >= level)
+        {
+            size = std::max(size, subresources[i].offset + subresources[i].size);
+        }
+    }
+    return size;
+}
+
+// Version 1 has no version field. Its size is fixed by resolution and mip count and is smaller than the header
+// and table of an uncompressed version 2 file with the same pixels, but a supercompressed one can have any size.
+static bool HasSizeV1(const CubemapFile::Header& header, std::size_t size)
+{
+    return size == headerSizeV1 + (size_t)TextureSizeBC6(header.resolution, header.mipmapLevels) * CubemapFile::faceCount;
+}
+
+static bool IsValidHeaderV2(const CubemapFile::Header& header, std::size_t size)
+{
+    return size >= sizeof(header) && header.version == 2 && IsValidFormat(header.pixelFormat) && header.faces == CubemapFile::faceCount
+        && header.subresourceAlignment != 0 && (header.flags & ~(CubemapFile::flagMipMajor | CubemapFile::flagSupercompressed)) == 0;
+}
+
+static void ReadLayoutV1(CubemapFile::Header header, CubemapFileLayout& layout)
+{
+    header.version = 1;
+    header.pixelFormat = CubemapPixelFormat::BC6H_UF16;
+    header.faces = CubemapFile::faceCount;
+    header.subresourceAlignment = 1;
+    header.flags = 0;
+    layout.header = header;
+    layout.subresources.resize((size_t)header.faces * header.mipmapLevels);
+    std::uint64_t offset = headerSizeV1;
+    for (size_t i = 0; i < layout.subresources.size(); i++)
+    {
+        layout.subresources[i].offset = offset;
+        layout.subresources[i].size = SubresourceSizeBytes(header, i);
+        offset += layout.subresources[i].size;
+    }
+}
+
+static bool ReadLayoutV2(const std::uint8_t* data, std::size_t size, const CubemapFile::Header& header, CubemapFileLayout& layout)
+{
+    if (!IsValidHeaderV2(header, size))
+    {
+        return false;
+    }
+    size_t tableSize = (size_t)header.faces * header.mipmapLevels * sizeof(CubemapFile::Subresource);
+    if (size < sizeof(header) + tableSize)
+    {
+        return false;
+    }
+    layout.header = header;
+    layout.subresources.resize((size_t)header.faces * header.mipmapLevels);
+    std::memcpy(layout.subresources.data(), data + sizeof(header), tableSize);
+    bool supercompressed = (header.flags & CubemapFile::flagSupercompressed) != 0;
+    if (supercompressed)
+    {
+        size_t sectionOffset = sizeof(header) + tableSize;
+        CubemapFile::SupercompressionHeader supercompression;
+        if (size < sectionOffset + sizeof(supercompression))
+        {
+            return false;
+        }
+        std::memcpy(&supercompression, data + sectionOffset, sizeof(supercompression));
+        sectionOffset += sizeof(supercompression);
+        if (supercompression.scheme != 1 || supercompression.contextCount != (std::uint32_t)ContextCount(header.pixelFormat)
+            || !layout.model.Deserialize(data + sectionOffset, size - sectionOffset, supercompression.contextCount))
+        {
+            return false;
+        }
+    }
+    for (size_t i = 0; i < layout.subresources.size(); i++)
+    {
+        const CubemapFile::Subresource& subresource = layout.subresources[i];
+        size_t expectedSize = SubresourceSizeBytes(header, i);
+        bool sizeValid = supercompressed ? subresource.size <= expectedSize : subresource.size == expectedSize;
+        if (!sizeValid || subresource.offset > size || subresource.size > size - subresource.offset)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ReadCubemapFileLayout(const std::uint8_t* data, std::size_t size, CubemapFileLayout& layout)
+{
+    if (size < headerSizeV1)
+    {
+        return false;
+    }
+    CubemapFile::Header header;
+    std::memcpy(&header, data, std::min(size, sizeof(header)));
+    if (header.magicNumber != CubemapFile::correctMagicNumber || header.resolution == 0 || header.resolution > (1u << 14)
+        || header.mipmapLevels == 0 || header.mipmapLevels > 15)
+    {
+        return false;
+    }
+
+    // A file of the version 1 size is version 1 unless its bytes also hold a version 2 header and layout. Pixels
+    // of a version 1 file that happen to look like a version 2 header still fall back to version 1 when the rest
+    // doesn't parse.
+    bool sizeV1 = HasSizeV1(header, size);
+    if (sizeV1 && !IsValidHeaderV2(header, size))
+    {
+        ReadLayoutV1(header, layout);
+        return true;
+    }
+    if (ReadLayoutV2(data, size, header, layout))
+    {
+        return true;
+    }
+    if (sizeV1)
+    {
+        layout = CubemapFileLayout();
+        ReadLayoutV1(header, layout);
+        return true;
+    }
+    return false;
+}
+
+bool ReadCubemapFile(const std::string& file_path, CubemapFile& cubemap)
+{
+    std::ifstream file(file_path, std::ios::binary | std::ios::ate);
+    if (!file)
+    {
+        std::cout << "Failed to open cube map file " << file_path << "\n";
+        return false;
+    }
+    std::vector<std::uint8_t> data((size_t)file.tellg());
+    file.seekg(0);
+    file.read((char*)data.data(), data.size());
+
+    CubemapFileLayout layout;
+    if (!file || !ReadCubemapFileLayout(data.data(), data.size(), layout))
+    {
+        std::cout << "Invalid cube map file " << file_path << "\n";
+        return false;
+    }
+    cubemap.Allocate(layout.header.resolution, layout.header.mipmapLevels, layout.header.pixelFormat);
+    std::atomic<bool> valid{ true };
+    int levels = (int)layout.header.mipmapLevels;
+    ParallelFor((int)CubemapFile::faceCount * levels, [&](int i)
+    {
+        if (!ReadSubresource(layout, data.data(), i / levels, i % levels, cubemap.SubresourcePixels(i / levels, i % levels)))
+        {
+            valid = false;
+        }
+    });
+    if (!valid)
+    {
+        std::cout << "Corrupt supercompressed data in " << file_path << "\n";
+    }
+    return valid;
+}
+
+bool ReadSubresource(const CubemapFileLayout& layout, const std::uint8_t* data, int face, int level, std::uint8_t* destination)
+{
+    const CubemapFile::Subresource& subresource = layout.At(face, level);
+    size_t size = SubresourceSizeBytes(layout.header.pixelFormat, MipResolution(layout.header, level));
+    if (subresource.size == size)
+    {
+        std::memcpy(destination, data + subresource.offset, size);
+        return true;
+    }
+    return layout.model.Decode(data + subresource.offset, subresource.size, destination, size);
+}
+
+// The first three header fields and the pixels as they are in memory.
+static std::uint64_t WriteCubemapFileV1(const CubemapFile& cubemap, const std::string& file_path)
+{
+    std::ofstream file(file_path, std::ios::binary);
+    file.write((const char*)&cubemap.header, headerSizeV1);
+    file.write((const char*)cubemap.pixels.data(), cubemap.pixels.size());
+    return file ? headerSizeV1 + cubemap.pixels.size() : 0;
+}
+
+std::uint64_t WriteCubemapFile(const CubemapFile& cubemap, const std::string& file_path, CubemapFileOrder order, bool supercompress,
+    std::uint32_t version)
+{
+    if (version == 1)
+    {
+        if (cubemap.header.pixelFormat != CubemapPixelFormat::BC6H_UF16 || order != CubemapFileOrder::FaceMajor || supercompress)
+        {
+            std::cout << "Version 1 cube map files only hold face major BC6H data, can't write " << file_path << "\n";
+            return 0;
+        }
+        return WriteCubemapFileV1(cubemap, file_path);
+    }
+
+    std::ofstream file(file_path, std::ios::binary);
+
+    CubemapFile::Header header = cubemap.header;
+    header.version = CubemapFile::currentVersion;
+    header.faces = CubemapFile::faceCount;
+    header.flags = order == CubemapFileOrder::MipMajor ? CubemapFile::flagMipMajor : 0;
+
+    size_t subresourceCount = (size_t)header.faces * header.mipmapLevels;
+    std::vector<std::uint64_t> storedSizes(subresourceCount);
+    for (size_t i = 0; i < subresourceCount; i++)
+    {
+        storedSizes[i] = SubresourceSizeBytes(header, i);
+    }
+    std::uint64_t dataOffset = sizeof(header) + subresourceCount * sizeof(CubemapFile::Subresource);
+
+    // Chunks that don't get smaller are stored raw, which readers tell apart by their size. Small files (a
+    // low resolution irradiance map) can't pay for the model and keep the plain layout.
+    std::vector<std::vector<std::uint8_t>> chunks;
+    std::vector<std::uint8_t> supercompressionSection;
+    if (supercompress)
+    {
+        RansModel model;
+        model.Build(cubemap.pixels.data(), cubemap.pixels.size(), ContextCount(header.pixelFormat));
+        chunks.resize(subresourceCount);
+        ParallelFor((int)subresourceCount, [&](int i)
+        {
+            std::vector<std::uint8_t> encoded = model.Encode(cubemap.SubresourcePixels(i / header.mipmapLevels, i % header.mipmapLevels), storedSizes[i]);
+            if (encoded.size() < storedSizes[i])
+            {
+                chunks[i] = std::move(encoded);
+            }
+        });
+
+        CubemapFile::SupercompressionHeader supercompression;
+        supercompression.contextCount = model.ContextCount();
+        supercompressionSection.resize(sizeof(supercompression) + model.SerializedSize());
+        std::memcpy(supercompressionSection.data(), &supercompression, sizeof(supercompression));
+        model.Serialize(supercompressionSection.data() + sizeof(supercompression));
+
+        std::uint64_t compressedSize = supercompressionSection.size();
+        for (size_t i = 0; i < subresourceCount; i++)
+        {
+            compressedSize += chunks[i].empty() ? storedSizes[i] : chunks[i].size();
+        }
+        supercompress = compressedSize < cubemap.pixels.size();
+    }
+    if (supercompress)
+    {
+        header.flags |= CubemapFile::flagSupercompressed;
+        // Chunks are read whole, so aligning them buys nothing.
+        header.subresourceAlignment = 1;
+        for (size_t i = 0; i < subresourceCount; i++)
+        {
+            storedSizes[i] = chunks[i].empty() ? storedSizes[i] : chunks[i].size();
+        }
+        dataOffset += supercompressionSection.size();
+    }
+    else
+    {
+        supercompressionSection.clear();
+    }
+
+    std::vector<CubemapFile::Subresource> subresources = LayoutV2(header, storedSizes, dataOffset);
+    file.write((const char*)&header, sizeof(header));
+    file.write((const char*)subresources.data(), subresources.size() * sizeof(CubemapFile::Subresource));
+    file.write((const char*)supercompressionSection.data(), supercompressionSection.size());
+
+    std::uint64_t position = dataOffset;
+    const char padding[CubemapFile::defaultAlignment] = {};
+    for (size_t i : StorageOrder(header))
+    {
+        int face = (int)(i / header.mipmapLevels);
+        int level = (int)(i % header.mipmapLevels);
+        for (std::uint64_t gap = subresources[i].offset - position; gap > 0; gap -= std::min<std::uint64_t>(gap, sizeof(padding)))
+        {
+            file.write(padding, std::min<std::uint64_t>(gap, sizeof(padding)));
+        }
+        const std::uint8_t* stored = supercompress && !chunks[i].empty() ? chunks[i].data() : cubemap.SubresourcePixels(face, level);
+        file.write((const char*)stored, subresources[i].size);
+        position = subresources[i].offset + subresources[i].size;
+    }
+    return file ? position : 0;
+}
+
+int TextureSizeBC6(std::uint32_t resolution, std::uint32_t mipmapLevels)
+{
+    int bytesNeeded = resolution * resolution;
+
+    for (std::uint32_t i = 1; i < mipmapLevels; i++)
+    {
+        resolution = std::max(resolution / 2, 4u); // BC6 always works with 4x4 blocks
+        bytesNeeded += resolution * resolution;
+    }
+
+    return bytesNeeded;
+}
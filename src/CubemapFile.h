@@ -0,0 +1,118 @@
+#ifndef CUBEMAP_FILE_H
+#define CUBEMAP_FILE_H
+
+#include "Supercompression.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+int TextureSizeBC6(std::uint32_t resolution, std::uint32_t mipmapLevels);
+
+enum class CubemapPixelFormat : std::uint32_t
+{
+    BC6H_UF16 = 1, // 16 byte blocks of 4x4 texels, mips below 4x4 still take one block
+    RGBA16F = 2    // 8 bytes per texel
+};
+
+// Order of the subresources in the pixel data of a file. Face major keeps each face's mip chain together; mip
+// major puts the smallest mip of every face first, so a prefix of the file is a complete lower resolution cube
+// map that a streaming loader can show while the rest arrives.
+enum class CubemapFileOrder
+{
+    FaceMajor,
+    MipMajor
+};
+
+// Bytes of one face of one mip level.
+std::size_t SubresourceSizeBytes(CubemapPixelFormat format, int mipResolution);
+
+// On disk (version 2):
+//   Header
+//   Subresource table, faces * mipmapLevels entries, entry face * mipmapLevels + level
+//   SupercompressionHeader and the serialized RansModel, only with flagSupercompressed
+//   pixel data in face or mip major order (see flags), every subresource starting at a multiple of
+//   subresourceAlignment from the start of the file
+// so a loader can map the file and hand any face/mip straight to the graphics API. Supercompressed files store
+// each subresource as its own rANS stream (or raw, when its table size equals the uncompressed size) so that
+// they can be decoded in parallel and individually; the GPU format inside stays the same.
+// Version 1 files are the first three header fields followed by the faces back to back, each with its mip chain;
+// WriteCubemapFile still writes them on request and ReadCubemapFileLayout accepts them.
+// In memory pixels holds the subresources tightly packed in that same face then mip order.
+struct CubemapFile
+{
+    // "CBMP" in file byte order.
+    static constexpr std::uint32_t correctMagicNumber = ('P' << 24) | ('M' << 16) | ('B' << 8) | 'C';
+    static constexpr std::uint32_t currentVersion = 2;
+    static constexpr std::uint32_t faceCount = 6;
+    // D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT, also enough for Vulkan and GL buffer to texture copies.
+    static constexpr std::uint32_t defaultAlignment = 512;
+    static constexpr std::uint32_t flagMipMajor = 1;
+    static constexpr std::uint32_t flagSupercompressed = 2;
+
+    struct Header
+    {
+        std::uint32_t magicNumber = correctMagicNumber;
+        std::uint32_t mipmapLevels;
+        std::uint32_t resolution;
+        std::uint32_t version = currentVersion;
+        CubemapPixelFormat pixelFormat = CubemapPixelFormat::BC6H_UF16;
+        std::uint32_t faces = faceCount;
+        std::uint32_t subresourceAlignment = defaultAlignment;
+        std::uint32_t flags = 0;
+    };
+    struct Subresource
+    {
+        std::uint64_t offset; // from the start of the file
+        std::uint64_t size;   // bytes stored in the file
+    };
+    struct SupercompressionHeader
+    {
+        std::uint32_t scheme = 1; // static rANS, contexts by byte position in the block
+        std::uint32_t contextCount;
+    };
+
+    // Sets the header up for a face-major cube map and sizes pixels for it.
+    void Allocate(int resolution, int mipmapLevels, CubemapPixelFormat pixelFormat = CubemapPixelFormat::BC6H_UF16);
+
+    std::size_t SubresourceOffset(int face, int level) const;
+    std::uint8_t* SubresourcePixels(int face, int level) { return &pixels[SubresourceOffset(face, level)]; }
+    const std::uint8_t* SubresourcePixels(int face, int level) const { return &pixels[SubresourceOffset(face, level)]; }
+
+    Header header;
+    std::vector<std::uint8_t> pixels;
+};
+
+// Header and subresource table of a file, parsed from its bytes so that they can come from a memory mapping.
+struct CubemapFileLayout
+{
+    CubemapFile::Header header;
+    std::vector<CubemapFile::Subresource> subresources;
+    RansModel model; // supercompressed files only
+
+    const CubemapFile::Subresource& At(int face, int level) const { return subresources[(size_t)face * header.mipmapLevels + level]; }
+
+    // Bytes from the start of the file that hold every face of level and all smaller levels. For a mip major
+    // file that is the prefix to read for a usable cube map with level as its largest mip.
+    std::uint64_t PrefixSize(int level) const;
+};
+
+// Validates the header and that every subresource lies within the size bytes at data. Version 1 files get a
+// table synthesized from their fixed layout.
+bool ReadCubemapFileLayout(const std::uint8_t* data, std::size_t size, CubemapFileLayout& layout);
+
+// Copies or decodes one subresource of the file at data into destination, which takes
+// SubresourceSizeBytes(header.pixelFormat, mip resolution) bytes.
+bool ReadSubresource(const CubemapFileLayout& layout, const std::uint8_t* data, int face, int level, std::uint8_t* destination);
+
+// Loads a whole file of either version into memory, decoding supercompressed subresources in parallel.
+bool ReadCubemapFile(const std::string& file_path, CubemapFile& cubemap);
+
+// Writes the layout of the given version, supercompressed on request. Version 1 is what loaders written before
+// version 2 read; it only holds face major BC6H data. Returns the number of bytes written, 0 if the file couldn't be
+// written.
+std::uint64_t WriteCubemapFile(const CubemapFile& cubemap, const std::string& file_path, CubemapFileOrder order = CubemapFileOrder::FaceMajor,
+    bool supercompress = false, std::uint32_t version = CubemapFile::currentVersion);
+
+#endif // !CUBEMAP_FILE_H
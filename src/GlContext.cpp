@@ -0,0 +1,338 @@
+#include "GlContext.h"
+
+#include <glad/glad.h>
+
+#ifdef IBL_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+#ifdef IBL_OSMESA
+#include <GL/osmesa.h>
+#endif
+#ifdef IBL_GLFW
+#include <GLFW/glfw3.h>
+#endif
+
+#include <cstring>
+#include <iostream>
+
+static bool HasExtension(const char* extensions, const char* name)
+{
+    size_t length = std::strlen(name);
+    for (const char* start = extensions; start && (start = std::strstr(start, name)) != nullptr; start += length)
+    {
+        bool startsWord = start == extensions || start[-1] == ' ';
+        bool endsWord = start[length] == ' ' || start[length] == '\0';
+        if (startsWord && endsWord)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+GlContext::~GlContext()
+{
+    Destroy();
+}
+
+bool GlContext::Create(GlContextKind requested)
+{
+    Destroy();
+    GlContextKind candidates[] = { GlContextKind::EglSurfaceless, GlContextKind::EglPbuffer, GlContextKind::OSMesa, GlContextKind::Glfw };
+    for (GlContextKind candidate : candidates)
+    {
+        if (requested != GlContextKind::Auto && requested != candidate)
+        {
+            continue;
+        }
+        kind = candidate;
+        switch (candidate)
+        {
+        case GlContextKind::EglSurfaceless:
+            created = CreateEgl(true);
+            break;
+        case GlContextKind::EglPbuffer:
+            created = CreateEgl(false);
+            break;
+        case GlContextKind::OSMesa:
+            created = CreateOSMesa();
+            break;
+        default:
+            created = CreateGlfw();
+            break;
+        }
+        if (created)
+        {
+            return true;
+        }
+        Destroy();
+    }
+    std::cout << "Failed to create an OpenGL 4.3 context\n";
+    return false;
+}
+
+const char* GlContext::Name() const
+{
+    switch (kind)
+    {
+    case GlContextKind::EglSurfaceless: return "egl";
+    case GlContextKind::EglPbuffer: return "egl-pbuffer";
+    case GlContextKind::OSMesa: return "osmesa";
+    case GlContextKind::Glfw: return "glfw";
+    default: return "none";
+    }
+}
+
+bool GlContext::LoadFunctions(void* (*getProcAddress)(const char*))
+{
+    if (!gladLoadGLLoader((GLADloadproc)getProcAddress))
+    {
+        std::cout << Name() << ": failed to initialize GLAD\n";
+        return false;
+    }
+    if (GLVersion.major < 4 || (GLVersion.major == 4 && GLVersion.minor < 3))
+    {
+        std::cout << Name() << ": got OpenGL " << GLVersion.major << "." << GLVersion.minor << ", 4.3 is required\n";
+        return false;
+    }
+    return true;
+}
+
+#ifdef IBL_EGL
+static void* EglProcAddress(const char* name)
+{
+    return (void*)eglGetProcAddress(name);
+}
+
+static EGLDisplay InitializeEglDisplay(EGLDisplay display)
+{
+    EGLint major, minor;
+    return display != EGL_NO_DISPLAY && eglInitialize(display, &major, &minor) ? display : EGL_NO_DISPLAY;
+}
+#endif
+
+bool GlContext::CreateEgl(bool surfaceless)
+{
+#ifdef IBL_EGL
+    // Client extensions are only queryable with EGL 1.5 or EGL_EXT_client_extensions, a null result means neither.
+    const char* clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    auto getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    EGLDisplay eglDisplay = EGL_NO_DISPLAY;
+    if (surfaceless && clientExtensions && HasExtension(clientExtensions, "EGL_MESA_platform_surfaceless") && getPlatformDisplay)
+    {
+        eglDisplay = InitializeEglDisplay(getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr));
+    }
+    if (eglDisplay == EGL_NO_DISPLAY)
+    {
+        eglDisplay = InitializeEglDisplay(eglGetDisplay(EGL_DEFAULT_DISPLAY));
+    }
+    if (eglDisplay == EGL_NO_DISPLAY && clientExtensions && HasExtension(clientExtensions, "EGL_EXT_platform_device") && getPlatformDisplay)
+    {
+        // Without a window system the default display may not initialize, but drivers such as NVIDIA's still
+        // expose their GPUs as EGL devices.
+        auto queryDevices = (PFNEGLQUERYDEVICESEXTPROC)eglGetProcAddress("eglQueryDevicesEXT");
+        EGLDeviceEXT device;
+        EGLint deviceCount = 0;
+        if (queryDevices && queryDevices(1, &device, &deviceCount) && deviceCount > 0)
+        {
+            eglDisplay = InitializeEglDisplay(getPlatformDisplay(EGL_PLATFORM_DEVICE_EXT, device, nullptr));
+        }
+    }
+    if (eglDisplay == EGL_NO_DISPLAY)
+    {
+        std::cout << Name() << ": no EGL display\n";
+        return false;
+    }
+    display = eglDisplay;
+
+    const char* extensions = eglQueryString(eglDisplay, EGL_EXTENSIONS);
+    if (surfaceless && !HasExtension(extensions, "EGL_KHR_surfaceless_context"))
+    {
+        std::cout << Name() << ": EGL_KHR_surfaceless_context not supported\n";
+        return false;
+    }
+    if (!eglBindAPI(EGL_OPENGL_API))
+    {
+        std::cout << Name() << ": desktop OpenGL not supported by EGL\n";
+        return false;
+    }
+
+    EGLConfig config = nullptr;
+    if (!surfaceless || !HasExtension(extensions, "EGL_KHR_no_config_context"))
+    {
+        const EGLint configAttributes[] = {
+            EGL_SURFACE_TYPE, surfaceless ? 0 : EGL_PBUFFER_BIT,
+            EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+            EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8, EGL_ALPHA_SIZE, 8,
+            EGL_NONE
+        };
+        EGLint configCount = 0;
+        if (!eglChooseConfig(eglDisplay, configAttributes, &config, 1, &configCount) || configCount == 0)
+        {
+            std::cout << Name() << ": no matching EGL config\n";
+            return false;
+        }
+    }
+
+    const EGLint contextAttributes[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 4,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    EGLContext eglContext = eglCreateContext(eglDisplay, config, EGL_NO_CONTEXT, contextAttributes);
+    if (eglContext == EGL_NO_CONTEXT)
+    {
+        std::cout << Name() << ": failed to create an OpenGL 4.3 core context (EGL error 0x" << std::hex << eglGetError() << std::dec << ")\n";
+        return false;
+    }
+    context = eglContext;
+
+    EGLSurface eglSurface = EGL_NO_SURFACE;
+    if (!surfaceless)
+    {
+        const EGLint pbufferAttributes[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+        eglSurface = eglCreatePbufferSurface(eglDisplay, config, pbufferAttributes);
+        if (eglSurface == EGL_NO_SURFACE)
+        {
+            std::cout << Name() << ": failed to create a pbuffer\n";
+            return false;
+        }
+        surface = eglSurface;
+    }
+    if (!eglMakeCurrent(eglDisplay, eglSurface, eglSurface, eglContext))
+    {
+        std::cout << Name() << ": failed to make the context current\n";
+        return false;
+    }
+    return LoadFunctions(EglProcAddress);
+#else
+    (void)surfaceless;
+    std::cout << Name() << ": not built with EGL\n";
+    return false;
+#endif
+}
+
+#ifdef IBL_OSMESA
+static void* OSMesaProcAddress(const char* name)
+{
+    return (void*)OSMesaGetProcAddress(name);
+}
+#endif
+
+bool GlContext::CreateOSMesa()
+{
+#ifdef IBL_OSMESA
+    const int attributes[] = {
+        OSMESA_FORMAT, OSMESA_RGBA,
+        OSMESA_PROFILE, OSMESA_CORE_PROFILE,
+        OSMESA_CONTEXT_MAJOR_VERSION, 4,
+        OSMESA_CONTEXT_MINOR_VERSION, 3,
+        0
+    };
+    OSMesaContext osmesaContext = OSMesaCreateContextAttribs(attributes, nullptr);
+    if (!osmesaContext)
+    {
+        std::cout << Name() << ": failed to create an OpenGL 4.3 core context\n";
+        return false;
+    }
+    context = osmesaContext;
+    // OSMesa always renders to a client buffer, the smallest one will do.
+    osmesaBuffer.resize(4);
+    if (!OSMesaMakeCurrent(osmesaContext, osmesaBuffer.data(), GL_UNSIGNED_BYTE, 1, 1))
+    {
+        std::cout << Name() << ": failed to make the context current\n";
+        return false;
+    }
+    return LoadFunctions(OSMesaProcAddress);
+#else
+    std::cout << Name() << ": not built with OSMesa\n";
+    return false;
+#endif
+}
+
+#ifdef IBL_GLFW
+static void* GlfwProcAddress(const char* name)
+{
+    return (void*)glfwGetProcAddress(name);
+}
+#endif
+
+bool GlContext::CreateGlfw()
+{
+#ifdef IBL_GLFW
+    if (!glfwInit())
+    {
+        std::cout << Name() << ": failed to initialize GLFW\n";
+        return false;
+    }
+    display = this; // marks glfwInit as done for Destroy
+
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
+    GLFWwindow* window = glfwCreateWindow(100, 100, "", NULL, NULL);
+    if (!window)
+    {
+        std::cout << Name() << ": failed to create a window\n";
+        return false;
+    }
+    context = window;
+    glfwMakeContextCurrent(window);
+    return LoadFunctions(GlfwProcAddress);
+#else
+    std::cout << Name() << ": not built with GLFW\n";
+    return false;
+#endif
+}
+
+void GlContext::Destroy()
+{
+    switch (kind)
+    {
+#ifdef IBL_EGL
+    case GlContextKind::EglSurfaceless:
+    case GlContextKind::EglPbuffer:
+        if (display)
+        {
+            eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+            if (surface)
+            {
+                eglDestroySurface(display, surface);
+            }
+            if (context)
+            {
+                eglDestroyContext(display, context);
+            }
+            eglTerminate(display);
+        }
+        break;
+#endif
+#ifdef IBL_OSMESA
+    case GlContextKind::OSMesa:
+        if (context)
+        {
+            OSMesaDestroyContext((OSMesaContext)context);
+        }
+        break;
+#endif
+#ifdef IBL_GLFW
+    case GlContextKind::Glfw:
+        if (display)
+        {
+            glfwTerminate();
+        }
+        break;
+#endif
+    default:
+        break;
+    }
+    display = nullptr;
+    context = nullptr;
+    surface = nullptr;
+    osmesaBuffer.clear();
+    created = false;
+}
@@ -0,0 +1,51 @@
+#ifndef GL_CONTEXT_H
+#define GL_CONTEXT_H
+
+#include <vector>
+
+// Ways of getting a GL 4.3 core context, in the order Auto tries them. Only the first two need nothing but a GL
+// driver, which is what lets the GL backend run in containers and on nodes without a display server.
+enum class GlContextKind
+{
+    Auto,
+    EglSurfaceless, // EGL_MESA_platform_surfaceless display (or the default one) and a context with no surface
+    EglPbuffer,     // default EGL display with a 1x1 pbuffer, for drivers without surfaceless contexts
+    OSMesa,         // Mesa's off-screen software renderer, IBL_OSMESA builds only
+    Glfw            // hidden GLFW window, needs a display, IBL_GLFW builds only
+};
+
+// Creates, makes current and owns the context the GL backend renders with, and loads the GL entry points
+// through glad. Everything the backend renders goes to its own framebuffer objects, so the default framebuffer
+// (if there is one at all) is never used.
+class GlContext
+{
+public:
+    GlContext() = default;
+    ~GlContext();
+
+    GlContext(const GlContext&) = delete;
+    GlContext& operator=(const GlContext&) = delete;
+
+    // Tries kind, or each kind built in until one works for Auto. Reports every attempt that fails.
+    bool Create(GlContextKind kind);
+
+    // Name of the kind that was created, for logs.
+    const char* Name() const;
+private:
+    bool CreateEgl(bool surfaceless);
+    bool CreateOSMesa();
+    bool CreateGlfw();
+    bool LoadFunctions(void* (*getProcAddress)(const char*));
+    void Destroy();
+
+    GlContextKind kind = GlContextKind::Auto;
+    bool created = false;
+
+    // EGLDisplay/EGLContext/EGLSurface, OSMesaContext or GLFWwindow*, depending on kind.
+    void* display = nullptr;
+    void* context = nullptr;
+    void* surface = nullptr;
+    std::vector<unsigned char> osmesaBuffer;
+};
+
+#endif // !GL_CONTEXT_H
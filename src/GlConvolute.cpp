@@ -0,0 +1,821 @@
+#include "GlConvolute.h"
+
+#include "BakeCache.h"
+#include "Compression.h"
+#include "CpuConvolute.h"
+#include "CubemapFile.h"
+#include "Half.h"
+#include "HdrImage.h"
+#include "Math.h"
+#include "PrefilterSamples.h"
+#include "SphericalHarmonics.h"
+#include "ThreadPool.h"
+
+#include <cstring>
+
+// RGBA16F bytes for all six faces of a cube map with the given mip count.
+static size_t StagingSize(int resolution, int mipLevels)
+{
+    size_t size = 0;
+    for (int level = 0; level < mipLevels; level++)
+    {
+        int mipRes = std::max(resolution >> level, 1);
+        size += (size_t)mipRes * mipRes * 8 * 6;
+    }
+    return size;
+}
+
+// GL_TIME_ELAPSED queries attributed to report stages. Queries of that target can't nest, so every Begin is closed
+// by End before the next. Results are only fetched once the job is done so timing never stalls the pipeline.
+class GpuStageTimer
+{
+public:
+    explicit GpuStageTimer(StageTimings* timings) : timings(timings) {}
+    ~GpuStageTimer()
+    {
+        for (const Query& query : queries)
+        {
+            GLuint64 nanoseconds = 0;
+            glGetQueryObjectui64v(query.id, GL_QUERY_RESULT, &nanoseconds);
+            timings->AddGpuTime(query.stage, nanoseconds / 1e6);
+            glDeleteQueries(1, &query.id);
+        }
+    }
+
+    GpuStageTimer(const GpuStageTimer&) = delete;
+    GpuStageTimer& operator=(const GpuStageTimer&) = delete;
+
+    void Begin(const char* stage)
+    {
+        if (timings)
+        {
+            Query query = { stage, 0 };
+            glGenQueries(1, &query.id);
+            glBeginQuery(GL_TIME_ELAPSED, query.id);
+            queries.push_back(query);
+        }
+    }
+
+    void End()
+    {
+        if (timings)
+        {
+            glEndQuery(GL_TIME_ELAPSED);
+        }
+    }
+private:
+    struct Query
+    {
+        const char* stage;
+        GLuint id;
+    };
+
+    StageTimings* timings;
+    std::vector<Query> queries;
+};
+
+// Times a scope on the CPU and the GPU under the same stage.
+class GlStageScope
+{
+public:
+    GlStageScope(GpuStageTimer& gpuTimer, StageTimings* timings, const char* stage)
+        : cpuTimer(timings, stage), gpuTimer(gpuTimer)
+    {
+        gpuTimer.Begin(stage);
+    }
+    ~GlStageScope() { gpuTimer.End(); }
+
+    void AddMegapixels(double megapixels) { cpuTimer.AddMegapixels(megapixels); }
+private:
+    ScopedStageTimer cpuTimer;
+    GpuStageTimer& gpuTimer;
+};
+
+static void WriteTimed(const CubemapFile& file, const ConvoluteSettings& settings, const char* fileName, StageTimings* timings)
+{
+    ScopedStageTimer timer(timings, "write");
+    timer.AddBytesWritten(WriteCubemapFile(file, settings.OutputPath(fileName), settings.fileOrder, settings.supercompress,
+        settings.fileVersion));
+}
+
+// With writeUncompressed, the RGBA16F pixels fileName was compressed from, laid out face then mip like the file.
+static void WriteUncompressedTimed(const std::uint8_t* pixels, int resolution, int mipLevels, const ConvoluteSettings& settings,
+    const char* fileName, StageTimings* timings)
+{
+    if (!settings.writeUncompressed)
+    {
+        return;
+    }
+    CubemapFile file;
+    file.Allocate(resolution, mipLevels, CubemapPixelFormat::RGBA16F);
+    std::memcpy(file.pixels.data(), pixels, file.pixels.size());
+    ScopedStageTimer timer(timings, "write");
+    timer.AddBytesWritten(WriteCubemapFile(file, settings.OutputPath(UncompressedFileName(fileName).c_str())));
+}
+
+static GLuint CreateCubemapTexture(int resolution, bool mipmapped)
+{
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+    for (unsigned int i = 0; i < 6; ++i)
+    {
+        // RGBA used because this is the format expected by the BC6 compressor being used (final result of BC6 compression doesn't include alpha)
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGBA16F,
+            resolution, resolution, 0, GL_RGBA, GL_FLOAT, nullptr);
+    }
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, mipmapped ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    if (mipmapped)
+    {
+        glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+    }
+    return texture;
+}
+
+GlConvoluter::GlConvoluter()
+    : equirectToCubemapShader("Shaders/equirectToCubemap.vert", "Shaders/equirectToCubemap.frag"),
+      convolutionShader("Shaders/equirectToCubemap.vert", "Shaders/convolute.frag"),
+      prefilterShader("Shaders/equirectToCubemap.vert", "Shaders/prefilter.frag"),
+      equirectToCubemapCompute("Shaders/equirectToCubemap.comp"),
+      convolutionCompute("Shaders/convolute.comp"),
+      prefilterCompute("Shaders/prefilter.comp"),
+      brdfLutShader("Shaders/fullscreen.vert", "Shaders/brdfLUT.frag")
+{
+    Vec3 cubeVertices[] = {
+        {-1.0f, -1.0f, 0.0f}, {1.0f, 1.0f, 1.0f}, {1.0f, -1.0f, 0.0f}, {1.0f, 1.0f, -1.0f}, {1.0f, 1.0f, 0.0f}, {1.0f, -1.0f, -1.0f}, {-1.0f, 1.0f, 0.0f}, {1.0f, -1.0f, 1.0f},  // POSITIVE_X
+
+        {-1.0f, -1.0f, 0.0f}, {-1.0f, 1.0f, -1.0f}, {1.0f, -1.0f, 0.0f}, {-1.0f, 1.0f, 1.0f}, {1.0f, 1.0f, 0.0f}, {-1.0f, -1.0f, 1.0f}, {-1.0f, 1.0f, 0.0f}, {-1.0f, -1.0f, -1.0f},    // NEGATIVE_X
+
+        {-1.0f, -1.0f, 0.0f}, {-1.0f, 1.0f, -1.0f}, {1.0f, -1.0f, 0.0f}, {1.0f, 1.0f, -1.0f}, {1.0f, 1.0f, 0.0f}, {1.0f, 1.0f, 1.0f}, {-1.0f, 1.0f, 0.0f}, {-1.0f, 1.0f, 1.0f},   // POSITIVE_Y
+
+        {-1.0f, -1.0f, 0.0f}, {-1.0f, -1.0f, 1.0f}, {1.0f, -1.0f, 0.0f}, {1.0f, -1.0f, 1.0f}, {1.0f, 1.0f, 0.0f}, {1.0f, -1.0f, -1.0f}, {-1.0f, 1.0f, 0.0f}, {-1.0f, -1.0f, -1.0f}, // NEGATIVE_Y
+
+         {-1.0f, -1.0f, 0.0f}, {-1.0f, 1.0f, 1.0f}, {1.0f, -1.0f, 0.0f}, {1.0f, 1.0f, 1.0f}, {1.0f, 1.0f, 0.0f}, {1.0f, -1.0f, 1.0f}, {-1.0f, 1.0f, 0.0f}, {-1.0f, -1.0f, 1.0f},   // POSITIVE_Z
+
+        {-1.0f, -1.0f, 0.0f}, {1.0f, 1.0f, -1.0f}, {1.0f, -1.0f, 0.0f}, {-1.0f, 1.0f, -1.0f}, {1.0f, 1.0f, 0.0f}, {-1.0f, -1.0f, -1.0f}, {-1.0f, 1.0f, 0.0f}, {1.0f, -1.0f, -1.0f}, // NEGATIVE_Z
+    };
+
+    GLuint cubeIndices[] = {
+        0, 1, 2, 2, 3, 0,
+        4, 5, 6, 6, 7, 4,
+        8, 9, 10, 10, 11, 8,
+        12, 13, 14, 14, 15, 12,
+        16, 17, 18, 18, 19, 16,
+        20, 21, 22, 22, 23, 20
+    };
+
+    glGenVertexArrays(1, &cubeVAO);
+    glBindVertexArray(cubeVAO);
+
+    glGenBuffers(1, &cubeVBO);
+    glBindBuffer(GL_ARRAY_BUFFER, cubeVBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(cubeVertices), cubeVertices, GL_STATIC_DRAW);
+
+    glGenBuffers(1, &cubeIBO);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cubeIBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(cubeIndices), cubeIndices, GL_STATIC_DRAW);
+
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 2 * sizeof(Vec3), 0);
+
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 2 * sizeof(Vec3), (const void*)(sizeof(Vec3)));
+
+    glGenFramebuffers(1, &captureFBO);
+
+    equirectToCubemapShader.use();
+    equirectToCubemapShader.SetInt("equirectangularMap", 0);
+    convolutionShader.use();
+    convolutionShader.SetInt("environmentMap", 0);
+    prefilterShader.use();
+    prefilterShader.SetInt("environmentMap", 0);
+    equirectToCubemapCompute.use();
+    equirectToCubemapCompute.SetInt("equirectangularMap", 0);
+    convolutionCompute.use();
+    convolutionCompute.SetInt("environmentMap", 0);
+    prefilterCompute.use();
+    prefilterCompute.SetInt("environmentMap", 0);
+
+    std::vector<IrradianceSample> irradianceSamples = BuildIrradianceSamples();
+    irradianceSampleCount = (int)irradianceSamples.size();
+    glGenBuffers(1, &irradianceSampleBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, irradianceSampleBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, irradianceSamples.size() * sizeof(IrradianceSample), irradianceSamples.data(), GL_STATIC_DRAW);
+}
+
+GlConvoluter::~GlConvoluter()
+{
+    GLuint textures[] = { hdrTexture, environmentMap, irradianceMap, prefilterMap };
+    glDeleteTextures(4, textures);
+    glDeleteFramebuffers(1, &captureFBO);
+    glDeleteBuffers(1, &prefilterSampleBuffer);
+    glDeleteBuffers(1, &uploadBuffer);
+    glDeleteBuffers(1, &irradianceSampleBuffer);
+    glDeleteBuffers(1, &cubeVBO);
+    glDeleteBuffers(1, &cubeIBO);
+    glDeleteVertexArrays(1, &cubeVAO);
+    glDeleteProgram(equirectToCubemapShader.id);
+    glDeleteProgram(convolutionShader.id);
+    glDeleteProgram(prefilterShader.id);
+    glDeleteProgram(equirectToCubemapCompute.id);
+    glDeleteProgram(convolutionCompute.id);
+    glDeleteProgram(prefilterCompute.id);
+    glDeleteProgram(brdfLutShader.id);
+    glDeleteBuffers(1, &quadVBO);
+    glDeleteVertexArrays(1, &quadVAO);
+}
+
+void GlConvoluter::DrawFace(unsigned int face)
+{
+    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, (const void*)(face * 6 * sizeof(GLuint)));
+}
+
+void GlConvoluter::DispatchFaces(int resolution)
+{
+    GLuint groups = (GLuint)(resolution + 7) / 8;
+    glDispatchCompute(groups, groups, 6);
+    // Image stores are incoherent: make them visible to the texture fetches, mip generation and framebuffer reads
+    // of the following stages.
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT);
+}
+
+void GlConvoluter::UploadPrefilterSamples(int environmentMapResolution, const std::vector<std::uint32_t>& sampleCounts)
+{
+    if (prefilterSampleBuffer == 0)
+    {
+        glGenBuffers(1, &prefilterSampleBuffer);
+    }
+    if (prefilterSampleResolution != environmentMapResolution || prefilterSampleCounts != sampleCounts)
+    {
+        // The tables of all mips go into one buffer, each mip's draw selects its range with sampleOffset/sampleCount.
+        std::vector<PrefilterSample> samples;
+        prefilterSampleOffsets.assign(1, 0);
+        int prefilterMipLevels = (int)sampleCounts.size();
+        for (int j = 0; j < prefilterMipLevels; j++)
+        {
+            float roughness = PrefilterRoughness(j, prefilterMipLevels);
+            std::vector<PrefilterSample> level = BuildPrefilterSamples(roughness, environmentMapResolution, sampleCounts[j]);
+            samples.insert(samples.end(), level.begin(), level.end());
+            prefilterSampleOffsets.push_back((int)samples.size());
+        }
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, prefilterSampleBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, samples.size() * sizeof(PrefilterSample), samples.data(), GL_STATIC_DRAW);
+        prefilterSampleResolution = environmentMapResolution;
+        prefilterSampleCounts = sampleCounts;
+    }
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, prefilterSampleBuffer);
+}
+
+std::uint8_t* GlConvoluter::MapUploadBuffer(size_t size)
+{
+    if (uploadBuffer == 0)
+    {
+        glGenBuffers(1, &uploadBuffer);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, uploadBuffer);
+    if (size > uploadBufferSize)
+    {
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+        uploadBufferSize = size;
+    }
+    // Invalidating lets the driver hand out fresh storage instead of waiting for the previous upload.
+    return (std::uint8_t*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+}
+
+void GlConvoluter::UnmapUploadBuffer()
+{
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+}
+
+void GlConvoluter::GenerateSeamlessMipmaps(int resolution, int mipLevels)
+{
+    CubemapImage image(resolution, mipLevels);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, environmentMap);
+    for (unsigned int i = 0; i < 6; ++i)
+    {
+        // Halves widen to floats exactly, so this is the texture's own mip 0.
+        glGetTexImage(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGBA, GL_FLOAT, image.Face(0, i));
+    }
+    GenerateMipmaps(image, MipFilter::Seamless);
+
+    // Face major like the staging layout, without mip 0.
+    size_t tailSize = StagingSize(resolution, mipLevels) - StagingSize(resolution, 1);
+    std::uint16_t* halfPixels = (std::uint16_t*)MapUploadBuffer(tailSize);
+    ParallelFor(6, [&](int face)
+    {
+        size_t offset = face * tailSize / 6 / sizeof(std::uint16_t);
+        for (int j = 1; j < mipLevels; j++)
+        {
+            size_t texels = (size_t)image.MipResolution(j) * image.MipResolution(j);
+            FloatToHalf(&image.Face(j, face)->r, halfPixels + offset, texels * 4);
+            offset += texels * 4;
+        }
+    });
+    UnmapUploadBuffer();
+    size_t offset = 0;
+    for (unsigned int i = 0; i < 6; ++i)
+    {
+        for (int j = 1; j < mipLevels; j++)
+        {
+            int mipRes = image.MipResolution(j);
+            glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, j, 0, 0, mipRes, mipRes, GL_RGBA, GL_HALF_FLOAT, (const void*)offset);
+            offset += (size_t)mipRes * mipRes * 8;
+        }
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+void GlConvoluter::IntegrateBrdfLut(const BrdfLutSettings& settings, std::vector<float>& texels)
+{
+    if (quadVAO == 0)
+    {
+        // Position and texture coordinates of a full screen triangle strip, counter clockwise.
+        float quadVertices[] = {
+            -1.0f, 1.0f, 0.0f, 1.0f,
+            -1.0f, -1.0f, 0.0f, 0.0f,
+            1.0f, 1.0f, 1.0f, 1.0f,
+            1.0f, -1.0f, 1.0f, 0.0f,
+        };
+        glGenVertexArrays(1, &quadVAO);
+        glBindVertexArray(quadVAO);
+        glGenBuffers(1, &quadVBO);
+        glBindBuffer(GL_ARRAY_BUFFER, quadVBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), quadVertices, GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), 0);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (const void*)(2 * sizeof(float)));
+    }
+
+    // Always rendered at full precision; half files are rounded on the CPU like every other half this tool writes.
+    int resolution = settings.resolution;
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, resolution, resolution, 0, GL_RG, GL_FLOAT, nullptr);
+    glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+
+    brdfLutShader.use();
+    brdfLutShader.SetInt("sampleCount", settings.sampleCount);
+    glViewport(0, 0, resolution, resolution);
+    glBindVertexArray(quadVAO);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    glBindVertexArray(cubeVAO);
+
+    std::vector<float> ab((size_t)resolution * resolution * 2);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glReadPixels(0, 0, resolution, resolution, GL_RG, GL_FLOAT, ab.data());
+    glDeleteTextures(1, &texture);
+    FinishBrdfLut(settings, ab, texels);
+}
+
+bool GlConvoluter::Convolute(const char* hdriPath, const ConvoluteSettings& settings, StageTimings* timings)
+{
+    GpuStageTimer gpuTimer(timings);
+    int resolution = settings.resolution;
+    int mipLevels = 1 + (int)std::log2(resolution);
+    int irradianceRes = settings.irradianceResolution;
+    int prefilterRes = settings.prefilterResolution;
+    unsigned int prefilterMipLevels = settings.prefilterMipLevels;
+    if (environmentMap == 0 || environmentMapResolution != resolution)
+    {
+        glDeleteTextures(1, &environmentMap);
+        environmentMap = CreateCubemapTexture(resolution, true);
+        environmentMapResolution = resolution;
+    }
+    if (irradianceMap == 0 || irradianceMapResolution != irradianceRes)
+    {
+        glDeleteTextures(1, &irradianceMap);
+        irradianceMap = CreateCubemapTexture(irradianceRes, false);
+        irradianceMapResolution = irradianceRes;
+    }
+    if (prefilterMap == 0 || prefilterMapResolution != prefilterRes)
+    {
+        glDeleteTextures(1, &prefilterMap);
+        prefilterMap = CreateCubemapTexture(prefilterRes, true);
+        prefilterMapResolution = prefilterRes;
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
+
+    // With --incremental the environment map is read back into base (or comes from it), which is kept for the
+    // next bake.
+    IncrementalBase incremental;
+    CubemapFile base;
+    bool reuseBase = false;
+    {
+        ScopedStageTimer timer(timings, "incremental");
+        incremental.Open(hdriPath, settings, "gl");
+        reuseBase = incremental.ReadBase(base);
+    }
+
+    if (reuseBase)
+    {
+        GlStageScope stage(gpuTimer, timings, "upload");
+        glBindTexture(GL_TEXTURE_CUBE_MAP, environmentMap);
+        for (unsigned int i = 0; i < 6; ++i)
+        {
+            for (int j = 0; j < mipLevels; j++)
+            {
+                int mipRes = std::max(resolution >> j, 1);
+                glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, j, 0, 0, mipRes, mipRes, GL_RGBA, GL_HALF_FLOAT, base.SubresourcePixels(i, j));
+            }
+        }
+        stage.AddMegapixels(Megapixels((long long)StagingSize(resolution, mipLevels) / 8));
+    }
+    else if (bool stream = ShouldStreamHdri(hdriPath, settings); stream || settings.equirectFilter != EquirectFilter::Bilinear)
+    {
+        // The panorama is too large to upload whole, or needs a filter the shader doesn't do, so it is resampled
+        // on the CPU and only the resulting faces are uploaded.
+        CubemapImage baseLevel(resolution, 1);
+        if (stream)
+        {
+            ScopedStageTimer timer(timings, "stream_equirect");
+            if (!StreamEquirectToCubemap(hdriPath, settings.maxRadiance, baseLevel, settings.equirectFilter))
+            {
+                return false;
+            }
+            timer.AddMegapixels(Megapixels(CubemapPixels(baseLevel, 0, 1)));
+        }
+        else
+        {
+            HdrImage hdri;
+            {
+                ScopedStageTimer timer(timings, "load");
+                if (!LoadHdri(hdriPath, settings.maxRadiance, hdri))
+                {
+                    return false;
+                }
+                timer.AddMegapixels(Megapixels((long long)hdri.width * hdri.height));
+            }
+            ScopedStageTimer timer(timings, "cpu_equirect");
+            EquirectToCubemap(hdri, baseLevel, settings.equirectFilter);
+            timer.AddMegapixels(Megapixels(CubemapPixels(baseLevel, 0, 1)));
+        }
+        GlStageScope stage(gpuTimer, timings, "upload");
+        size_t faceTexels = (size_t)resolution * resolution;
+        std::uint16_t* halfPixels = (std::uint16_t*)MapUploadBuffer(faceTexels * 8 * 6);
+        ParallelFor(6, [&](int face)
+        {
+            FloatToHalf(&baseLevel.Face(0, face)->r, halfPixels + face * faceTexels * 4, faceTexels * 4);
+        });
+        UnmapUploadBuffer();
+        glBindTexture(GL_TEXTURE_CUBE_MAP, environmentMap);
+        for (unsigned int i = 0; i < 6; ++i)
+        {
+            glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, 0, 0, resolution, resolution, GL_RGBA, GL_HALF_FLOAT,
+                (const void*)(i * faceTexels * 8));
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        stage.AddMegapixels(Megapixels(CubemapPixels(baseLevel, 0, 1)));
+    }
+    else
+    {
+        // The clamp to maxRadiance happens during the half conversion of the upload instead.
+        HdrImage hdri;
+        {
+            ScopedStageTimer timer(timings, "load");
+            if (!LoadHdri(hdriPath, 0.0f, hdri))
+            {
+                return false;
+            }
+            timer.AddMegapixels(Megapixels((long long)hdri.width * hdri.height));
+        }
+
+        {
+            // The image is converted to RGBA16F straight into the unpack buffer, so the driver neither converts
+            // floats nor copies client memory, and half as many bytes cross over to the GPU.
+            GlStageScope stage(gpuTimer, timings, "upload");
+            std::uint16_t* halfPixels = (std::uint16_t*)MapUploadBuffer((size_t)hdri.width * hdri.height * 8);
+            ParallelFor(hdri.height, [&](int row)
+            {
+                size_t offset = (size_t)row * hdri.width;
+                RgbToHalfRgba(hdri.rgb.get() + offset * 3, halfPixels + offset * 4, hdri.width, settings.maxRadiance);
+            });
+            UnmapUploadBuffer();
+            hdri.rgb.reset();
+
+            if (hdrTexture == 0 || hdri.width != hdrWidth || hdri.height != hdrHeight)
+            {
+                glDeleteTextures(1, &hdrTexture);
+                glGenTextures(1, &hdrTexture);
+                glBindTexture(GL_TEXTURE_2D, hdrTexture);
+                glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, hdri.width, hdri.height, 0, GL_RGBA, GL_HALF_FLOAT, nullptr);
+
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+                hdrWidth = hdri.width;
+                hdrHeight = hdri.height;
+            }
+            else
+            {
+                glBindTexture(GL_TEXTURE_2D, hdrTexture);
+                glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, hdri.width, hdri.height, GL_RGBA, GL_HALF_FLOAT, nullptr);
+            }
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            stage.AddMegapixels(Megapixels((long long)hdri.width * hdri.height));
+        }
+
+        GlStageScope stage(gpuTimer, timings, "equirect");
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, hdrTexture);
+        if (settings.glPipeline == GlPipeline::Compute)
+        {
+            equirectToCubemapCompute.use();
+            equirectToCubemapCompute.SetInt("resolution", resolution);
+            glBindImageTexture(0, environmentMap, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+            DispatchFaces(resolution);
+        }
+        else
+        {
+            equirectToCubemapShader.use();
+            glViewport(0, 0, resolution, resolution);
+            for (unsigned int i = 0; i < 6; ++i)
+            {
+                glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                    GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, environmentMap, 0);
+                glClear(GL_COLOR_BUFFER_BIT);
+                DrawFace(i);
+            }
+        }
+        stage.AddMegapixels(Megapixels(6LL * resolution * resolution));
+    }
+
+    if (!reuseBase)
+    {
+        GlStageScope stage(gpuTimer, timings, "mipmaps");
+        if (settings.mipFilter == MipFilter::Seamless)
+        {
+            GenerateSeamlessMipmaps(resolution, mipLevels);
+        }
+        else
+        {
+            glBindTexture(GL_TEXTURE_CUBE_MAP, environmentMap);
+            glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+        }
+        stage.AddMegapixels(Megapixels((long long)StagingSize(resolution, mipLevels) / 8 - 6LL * resolution * resolution));
+    }
+
+    // Everything read back for a stage stays in stagingPixels until the compressor is done with it. Reads go
+    // through the PBO ring, so rendering and transfer of later faces/mips overlap compression of earlier ones.
+    // base has the same face then mip layout, so with --incremental the environment map is read straight into
+    // it, and a reused one is compressed from it without any readback.
+    BC6HCompressor compressor(settings.compressionQuality);
+    std::uint8_t* environmentPixels = nullptr;
+    if (reuseBase)
+    {
+        environmentPixels = base.pixels.data();
+    }
+    else if (settings.incremental)
+    {
+        base.Allocate(resolution, mipLevels, CubemapPixelFormat::RGBA16F);
+        environmentPixels = base.pixels.data();
+    }
+    else
+    {
+        stagingPixels.resize(StagingSize(resolution, mipLevels));
+        environmentPixels = stagingPixels.data();
+    }
+
+    if (!incremental.StageValid(IncrementalStage::Envmap))
+    {
+        CubemapFile envMapFile;
+        envMapFile.Allocate(resolution, mipLevels);
+        {
+            size_t stagingOffset = 0;
+            GlStageScope stage(gpuTimer, timings, "readback");
+            for (unsigned int i = 0; i < 6; ++i)
+            {
+                int mipRes = resolution;
+                for (int j = 0; j < mipLevels; j++)
+                {
+                    std::uint8_t* surfacePixels = environmentPixels + stagingOffset;
+                    std::uint8_t* compressed = envMapFile.SubresourcePixels(i, j);
+                    if (reuseBase)
+                    {
+                        compressor.Enqueue(surfacePixels, mipRes, mipRes, compressed);
+                    }
+                    else
+                    {
+                        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                            GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, environmentMap, j);
+                        readback.Read(mipRes, mipRes, surfacePixels, [&compressor, surfacePixels, mipRes, compressed] {
+                            compressor.Enqueue(surfacePixels, mipRes, mipRes, compressed);
+                        });
+                    }
+                    stagingOffset += (size_t)mipRes * mipRes * 8;
+                    mipRes = std::max(mipRes / 2, 1);
+                }
+            }
+            readback.Flush();
+            stage.AddMegapixels(reuseBase ? 0.0 : Megapixels((long long)stagingOffset / 8));
+        }
+        {
+            ScopedStageTimer timer(timings, "bc6h");
+            compressor.Wait();
+        }
+
+        WriteTimed(envMapFile, settings, "envmap.cbmp", timings);
+        WriteUncompressedTimed(environmentPixels, resolution, mipLevels, settings, "envmap.cbmp", timings);
+    }
+    {
+        ScopedStageTimer timer(timings, "write");
+        timer.AddBytesWritten(incremental.CommitBase(reuseBase ? nullptr : &base));
+        timer.AddBytesWritten(incremental.CommitStage(IncrementalStage::Envmap));
+    }
+
+    if (!incremental.StageValid(IncrementalStage::Irradiance))
+    {
+        if (settings.irradianceMode == IrradianceMode::BruteForce)
+        {
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_CUBE_MAP, environmentMap);
+            bool compute = settings.glPipeline == GlPipeline::Compute;
+            if (compute)
+            {
+                GlStageScope stage(gpuTimer, timings, "irradiance");
+                convolutionCompute.use();
+                convolutionCompute.SetInt("resolution", irradianceRes);
+                convolutionCompute.SetFloat("sourceLod", IrradianceSourceLod(resolution, irradianceRes));
+                convolutionCompute.SetInt("sampleCount", irradianceSampleCount);
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, irradianceSampleBuffer);
+                glBindImageTexture(0, irradianceMap, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+                DispatchFaces(irradianceRes);
+                stage.AddMegapixels(Megapixels(6 * irradianceRes * irradianceRes));
+            }
+            else
+            {
+                convolutionShader.use();
+                glViewport(0, 0, irradianceRes, irradianceRes);
+            }
+
+            stagingPixels.resize(StagingSize(irradianceRes, 1));
+            CubemapFile irradianceMapFileData;
+            irradianceMapFileData.Allocate(irradianceRes, 1);
+            for (unsigned int i = 0; i < 6; ++i)
+            {
+                if (compute)
+                {
+                    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                        GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, irradianceMap, 0);
+                }
+                else
+                {
+                    GlStageScope stage(gpuTimer, timings, "irradiance");
+                    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                        GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, irradianceMap, 0);
+                    glClear(GL_COLOR_BUFFER_BIT);
+                    DrawFace(i);
+                    stage.AddMegapixels(Megapixels(irradianceRes * irradianceRes));
+                }
+                GlStageScope stage(gpuTimer, timings, "readback");
+                std::uint8_t* facePixels = &stagingPixels[(size_t)i * irradianceRes * irradianceRes * 8];
+                std::uint8_t* compressed = irradianceMapFileData.SubresourcePixels(i, 0);
+                readback.Read(irradianceRes, irradianceRes, facePixels, [&compressor, facePixels, irradianceRes, compressed] {
+                    compressor.Enqueue(facePixels, irradianceRes, irradianceRes, compressed);
+                });
+                stage.AddMegapixels(Megapixels(irradianceRes * irradianceRes));
+            }
+            {
+                GlStageScope stage(gpuTimer, timings, "readback");
+                readback.Flush();
+            }
+            {
+                ScopedStageTimer timer(timings, "bc6h");
+                compressor.Wait();
+            }
+
+            WriteTimed(irradianceMapFileData, settings, "irradiance.cbmp", timings);
+            WriteUncompressedTimed(stagingPixels.data(), irradianceRes, 1, settings, "irradiance.cbmp", timings);
+        }
+        else
+        {
+            int shLevel = ShSourceLevel(resolution, mipLevels);
+            CubemapImage shSource(std::max(resolution >> shLevel, 1), 1);
+            {
+                GlStageScope stage(gpuTimer, timings, "readback");
+                glBindTexture(GL_TEXTURE_CUBE_MAP, environmentMap);
+                for (unsigned int i = 0; i < 6; ++i)
+                {
+                    glGetTexImage(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, shLevel, GL_RGBA, GL_FLOAT, shSource.Face(0, i));
+                }
+                stage.AddMegapixels(Megapixels(CubemapPixels(shSource, 0, 1)));
+            }
+            ConvoluteIrradianceSH(shSource, 0, settings, irradianceRes, timings);
+        }
+        ScopedStageTimer timer(timings, "write");
+        timer.AddBytesWritten(incremental.CommitStage(IncrementalStage::Irradiance));
+    }
+
+    if (incremental.StageValid(IncrementalStage::Prefilter))
+    {
+        return true;
+    }
+    std::vector<std::uint32_t> sampleCounts;
+    {
+        GlStageScope stage(gpuTimer, timings, "prefilter_schedule");
+        int proxyLevel = PrefilterProxyLevel(resolution, mipLevels);
+        CubemapImage proxy(std::max(resolution >> proxyLevel, 1), mipLevels - proxyLevel);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, environmentMap);
+        for (int level = 0; level < proxy.MipLevels(); level++)
+        {
+            for (unsigned int i = 0; i < 6; ++i)
+            {
+                glGetTexImage(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, proxyLevel + level, GL_RGBA, GL_FLOAT, proxy.Face(level, i));
+            }
+        }
+        sampleCounts = PrefilterSampleSchedule(proxy, prefilterMipLevels, settings.prefilterErrorTarget);
+    }
+
+    stagingPixels.resize(StagingSize(prefilterRes, prefilterMipLevels));
+    size_t stagingOffset = 0;
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, environmentMap);
+    UploadPrefilterSamples(resolution, sampleCounts);
+    CubemapFile prefilterFile;
+    prefilterFile.Allocate(prefilterRes, prefilterMipLevels);
+
+    // The compute path renders every mip up front, the raster path draws each face/mip just before reading it back.
+    bool compute = settings.glPipeline == GlPipeline::Compute;
+    if (compute)
+    {
+        GlStageScope stage(gpuTimer, timings, "prefilter");
+        prefilterCompute.use();
+        int mipRes = prefilterRes;
+        for (unsigned int j = 0; j < prefilterMipLevels; j++)
+        {
+            prefilterCompute.SetInt("resolution", mipRes);
+            prefilterCompute.SetInt("sampleOffset", prefilterSampleOffsets[j]);
+            prefilterCompute.SetInt("sampleCount", prefilterSampleOffsets[j + 1] - prefilterSampleOffsets[j]);
+            glBindImageTexture(0, prefilterMap, j, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+            DispatchFaces(mipRes);
+            stage.AddMegapixels(Megapixels(6 * mipRes * mipRes));
+            mipRes /= 2;
+        }
+    }
+    else
+    {
+        prefilterShader.use();
+    }
+
+    for (unsigned int i = 0; i < 6; ++i)
+    {
+        int mipRes = prefilterRes;
+        for (unsigned int j = 0; j < prefilterMipLevels; j++)
+        {
+            if (compute)
+            {
+                glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                    GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, prefilterMap, j);
+            }
+            else
+            {
+                GlStageScope stage(gpuTimer, timings, "prefilter");
+                glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                    GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, prefilterMap, j);
+                glViewport(0, 0, mipRes, mipRes);
+                glClear(GL_COLOR_BUFFER_BIT);
+                prefilterShader.SetInt("sampleOffset", prefilterSampleOffsets[j]);
+                prefilterShader.SetInt("sampleCount", prefilterSampleOffsets[j + 1] - prefilterSampleOffsets[j]);
+                DrawFace(i);
+                stage.AddMegapixels(Megapixels(mipRes * mipRes));
+            }
+            GlStageScope stage(gpuTimer, timings, "readback");
+            std::uint8_t* surfacePixels = &stagingPixels[stagingOffset];
+            std::uint8_t* compressed = prefilterFile.SubresourcePixels(i, j);
+            readback.Read(mipRes, mipRes, surfacePixels, [&compressor, surfacePixels, mipRes, compressed] {
+                compressor.Enqueue(surfacePixels, mipRes, mipRes, compressed);
+            });
+            stage.AddMegapixels(Megapixels(mipRes * mipRes));
+            stagingOffset += (size_t)mipRes * mipRes * 8;
+            mipRes /= 2;
+        }
+    }
+    {
+        GlStageScope stage(gpuTimer, timings, "readback");
+        readback.Flush();
+    }
+    {
+        ScopedStageTimer timer(timings, "bc6h");
+        compressor.Wait();
+        timer.AddMegapixels(Megapixels(compressor.Pixels()));
+    }
+    if (timings)
+    {
+        timings->AddThreadTime("bc6h", compressor.BusyMilliseconds());
+    }
+
+    WriteTimed(prefilterFile, settings, "prefilter.cbmp", timings);
+    WriteUncompressedTimed(stagingPixels.data(), prefilterRes, prefilterMipLevels, settings, "prefilter.cbmp", timings);
+    ScopedStageTimer timer(timings, "write");
+    timer.AddBytesWritten(incremental.CommitStage(IncrementalStage::Prefilter));
+    return true;
+}
@@ -0,0 +1,87 @@
+#ifndef GL_CONVOLUTE_H
+#define GL_CONVOLUTE_H
+
+#include "BrdfLut.h"
+#include "ConvoluteSettings.h"
+#include "GlReadback.h"
+#include "Shader.h"
+#include "Timing.h"
+
+#include <glad/glad.h>
+
+#include <cstdint>
+#include <vector>
+
+// GL backend. Owns everything that can outlive a single HDRI (cube geometry, capture FBO, compiled programs,
+// textures and readback storage) so a batch only pays for context setup and shader compilation once.
+// Requires a current GL 4.3 context for its whole lifetime.
+class GlConvoluter
+{
+public:
+    GlConvoluter();
+    ~GlConvoluter();
+
+    GlConvoluter(const GlConvoluter&) = delete;
+    GlConvoluter& operator=(const GlConvoluter&) = delete;
+
+    // timings, when given, receives the per stage breakdown (CPU and GL_TIME_ELAPSED) for the report.
+    bool Convolute(const char* hdriPath, const ConvoluteSettings& settings, StageTimings* timings = nullptr);
+
+    // Renders brdfLUT.frag into texels, laid out like the CPU IntegrateBrdfLut's.
+    void IntegrateBrdfLut(const BrdfLutSettings& settings, std::vector<float>& texels);
+private:
+    void DrawFace(unsigned int face);
+    // Runs the bound compute program over all six faces of a resolution x resolution cube level.
+    void DispatchFaces(int resolution);
+    // Binds the prefilter.frag sample tables for a source cube of the given resolution and the per mip sample
+    // counts of PrefilterSampleSchedule, rebuilding them when either changed.
+    void UploadPrefilterSamples(int environmentMapResolution, const std::vector<std::uint32_t>& sampleCounts);
+    // Binds the pixel unpack buffer, grown to at least size bytes, and maps it for writing. Texture uploads
+    // between this and UnmapUploadBuffer take their data from it, the pointer argument being an offset.
+    std::uint8_t* MapUploadBuffer(size_t size);
+    void UnmapUploadBuffer();
+    // MipFilter::Seamless for environmentMap: mip 0 is read back, filtered by GenerateMipmaps and the other mips
+    // are uploaded.
+    void GenerateSeamlessMipmaps(int resolution, int mipLevels);
+
+    GLuint cubeVAO = 0;
+    GLuint cubeVBO = 0;
+    GLuint cubeIBO = 0;
+    GLuint captureFBO = 0;
+    GLuint quadVAO = 0;
+    GLuint quadVBO = 0;
+
+    Shader equirectToCubemapShader;
+    Shader convolutionShader;
+    Shader prefilterShader;
+    Shader equirectToCubemapCompute;
+    Shader convolutionCompute;
+    Shader prefilterCompute;
+    Shader brdfLutShader;
+
+    // Textures are reallocated only when the size they were created with changes.
+    GLuint hdrTexture = 0;
+    int hdrWidth = 0;
+    int hdrHeight = 0;
+    GLuint environmentMap = 0;
+    int environmentMapResolution = 0;
+    GLuint irradianceMap = 0;
+    int irradianceMapResolution = 0;
+    GLuint prefilterMap = 0;
+    int prefilterMapResolution = 0;
+
+    GLuint irradianceSampleBuffer = 0;
+    int irradianceSampleCount = 0;
+    GLuint prefilterSampleBuffer = 0;
+    int prefilterSampleResolution = 0;
+    std::vector<std::uint32_t> prefilterSampleCounts;
+    std::vector<int> prefilterSampleOffsets;
+
+    GLuint uploadBuffer = 0;
+    size_t uploadBufferSize = 0;
+
+    ReadbackRing readback;
+    std::vector<std::uint8_t> stagingPixels;
+};
+
+#endif // !GL_CONVOLUTE_H
@@ -0,0 +1,86 @@
+#include "GlReadback.h"
+
+#include <cstring>
+#include <iostream>
+
+ReadbackRing::ReadbackRing()
+{
+    for (Slot& slot : slots)
+    {
+        glGenBuffers(1, &slot.buffer);
+    }
+}
+
+ReadbackRing::~ReadbackRing()
+{
+    Flush();
+    for (Slot& slot : slots)
+    {
+        glDeleteBuffers(1, &slot.buffer);
+    }
+}
+
+void ReadbackRing::Read(int width, int height, std::uint8_t* destination, std::function<void()> onReady)
+{
+    Slot& slot = slots[next];
+    next = (next + 1) % slotCount;
+    if (slot.fence)
+    {
+        Complete(slot);
+    }
+
+    slot.size = (GLsizeiptr)width * height * 8;
+    slot.destination = destination;
+    slot.onReady = std::move(onReady);
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+    if (slot.capacity < slot.size)
+    {
+        glBufferData(GL_PIXEL_PACK_BUFFER, slot.size, nullptr, GL_STREAM_READ);
+        slot.capacity = slot.size;
+    }
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_HALF_FLOAT, nullptr);
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+void ReadbackRing::Flush()
+{
+    for (int i = 0; i < slotCount; i++)
+    {
+        Slot& slot = slots[(next + i) % slotCount];
+        if (slot.fence)
+        {
+            Complete(slot);
+        }
+    }
+}
+
+void ReadbackRing::Complete(Slot& slot)
+{
+    // The flush bit makes sure the fence has actually been submitted before we block on it.
+    GLenum status;
+    do
+    {
+        status = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+    } while (status == GL_TIMEOUT_EXPIRED);
+    glDeleteSync(slot.fence);
+    slot.fence = nullptr;
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+    const void* pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, slot.size, GL_MAP_READ_BIT);
+    if (pixels)
+    {
+        std::memcpy(slot.destination, pixels, slot.size);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    else
+    {
+        std::cout << "Failed to map readback buffer\n";
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    std::function<void()> onReady = std::move(slot.onReady);
+    slot.onReady = nullptr;
+    onReady();
+}
@@ -0,0 +1,46 @@
+#ifndef GL_READBACK_H
+#define GL_READBACK_H
+
+#include <glad/glad.h>
+
+#include <cstdint>
+#include <functional>
+
+// Asynchronous glReadPixels through a ring of pixel pack buffers. Read queues a copy of the current read
+// framebuffer into the next buffer and fences it, so the GPU keeps rendering while earlier transfers land.
+// A slot is only waited on when the ring wraps around to it (or on Flush); its pixels are then copied to the
+// destination given to Read and onReady is called on the GL thread, typically to hand them to the compressor.
+// Requires a current GL context for its whole lifetime.
+class ReadbackRing
+{
+public:
+    ReadbackRing();
+    ~ReadbackRing();
+
+    ReadbackRing(const ReadbackRing&) = delete;
+    ReadbackRing& operator=(const ReadbackRing&) = delete;
+
+    // Reads width x height RGBA16F pixels from the lower left corner of the read framebuffer.
+    void Read(int width, int height, std::uint8_t* destination, std::function<void()> onReady);
+    // Completes every outstanding read, oldest first.
+    void Flush();
+private:
+    struct Slot
+    {
+        GLuint buffer = 0;
+        GLsizeiptr capacity = 0;
+        GLsync fence = nullptr;
+        GLsizeiptr size = 0;
+        std::uint8_t* destination = nullptr;
+        std::function<void()> onReady;
+    };
+
+    void Complete(Slot& slot);
+
+    // Three in flight is enough for the GPU to stay a couple of faces ahead of the copies.
+    static const int slotCount = 3;
+    Slot slots[slotCount];
+    int next = 0;
+};
+
+#endif // !GL_READBACK_H
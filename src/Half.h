@@ -0,0 +1,156 @@
+#ifndef HALF_H
+#define HALF_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+#if defined(__F16C__) || (defined(_MSC_VER) && defined(__AVX2__))
+#define IBL_F16C 1
+#include <immintrin.h>
+#endif
+
+// IEEE 754 binary16 conversions, round to nearest even. Used for the RGBA16F surfaces handed to the BC6H compressor.
+inline std::uint16_t FloatToHalf(float value)
+{
+    std::uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+
+    std::uint32_t sign = (bits >> 16) & 0x8000u;
+    std::uint32_t magnitude = bits & 0x7FFFFFFFu;
+
+    if (magnitude >= 0x7F800000u) // inf or nan
+    {
+        return (std::uint16_t)(sign | 0x7C00u | (magnitude > 0x7F800000u ? 0x200u : 0u));
+    }
+    if (magnitude >= 0x477FF000u) // rounds to a value beyond the largest half
+    {
+        return (std::uint16_t)(sign | 0x7C00u);
+    }
+    if (magnitude < 0x38800000u) // half denormal or zero
+    {
+        if (magnitude < 0x33000000u)
+        {
+            return (std::uint16_t)sign;
+        }
+        std::uint32_t exponent = magnitude >> 23;
+        std::uint32_t mantissa = (magnitude & 0x7FFFFFu) | 0x800000u;
+        std::uint32_t shift = 126 - exponent;
+        std::uint32_t half = mantissa >> shift;
+        std::uint32_t remainder = mantissa & ((1u << shift) - 1);
+        std::uint32_t halfway = 1u << (shift - 1);
+        if (remainder > halfway || (remainder == halfway && (half & 1u)))
+        {
+            half++;
+        }
+        return (std::uint16_t)(sign | half);
+    }
+
+    std::uint32_t half = (magnitude - 0x38000000u) >> 13;
+    std::uint32_t remainder = magnitude & 0x1FFFu;
+    if (remainder > 0x1000u || (remainder == 0x1000u && (half & 1u)))
+    {
+        half++;
+    }
+    return (std::uint16_t)(sign | half);
+}
+
+inline float HalfToFloat(std::uint16_t value)
+{
+    std::uint32_t sign = (std::uint32_t)(value & 0x8000u) << 16;
+    std::uint32_t exponent = (value >> 10) & 0x1Fu;
+    std::uint32_t mantissa = value & 0x3FFu;
+    std::uint32_t bits;
+
+    if (exponent == 0x1Fu)
+    {
+        bits = sign | 0x7F800000u | (mantissa << 13);
+    }
+    else if (exponent != 0)
+    {
+        bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    }
+    else if (mantissa != 0)
+    {
+        // renormalize half denormal
+        exponent = 113;
+        while ((mantissa & 0x400u) == 0)
+        {
+            mantissa <<= 1;
+            exponent--;
+        }
+        bits = sign | (exponent << 23) | ((mantissa & 0x3FFu) << 13);
+    }
+    else
+    {
+        bits = sign;
+    }
+
+    float result;
+    std::memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+inline void FloatToHalf(const float* src, std::uint16_t* dst, std::size_t count)
+{
+    std::size_t i = 0;
+#ifdef IBL_F16C
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i half = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128((__m128i*)(dst + i), half);
+    }
+#endif
+    for (; i < count; i++)
+    {
+        dst[i] = FloatToHalf(src[i]);
+    }
+}
+
+inline void HalfToFloat(const std::uint16_t* src, float* dst, std::size_t count)
+{
+    std::size_t i = 0;
+#ifdef IBL_F16C
+    for (; i + 8 <= count; i += 8)
+    {
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(src + i))));
+    }
+#endif
+    for (; i < count; i++)
+    {
+        dst[i] = HalfToFloat(src[i]);
+    }
+}
+
+// RGB floats to RGBA halves with alpha 1, clamped to [0, maxRadiance] on the way when maxRadiance > 0. Produces
+// GL_RGBA16F upload data in one pass over the image.
+inline void RgbToHalfRgba(const float* rgb, std::uint16_t* rgba, std::size_t texels, float maxRadiance)
+{
+    std::size_t i = 0;
+#ifdef IBL_F16C
+    // Two texels per conversion. Every texel is loaded as four floats, the last one belonging to the next texel,
+    // so the final texel is left to the scalar loop.
+    const __m256 lowest = _mm256_set1_ps(maxRadiance > 0.0f ? 0.0f : -std::numeric_limits<float>::infinity());
+    const __m256 highest = _mm256_set1_ps(maxRadiance > 0.0f ? maxRadiance : std::numeric_limits<float>::infinity());
+    const __m256 one = _mm256_set1_ps(1.0f);
+    for (; i + 3 <= texels; i += 2)
+    {
+        __m256 pair = _mm256_set_m128(_mm_loadu_ps(rgb + 3 * i + 3), _mm_loadu_ps(rgb + 3 * i));
+        pair = _mm256_blend_ps(_mm256_min_ps(_mm256_max_ps(pair, lowest), highest), one, 0x88);
+        _mm_storeu_si128((__m128i*)(rgba + 4 * i), _mm256_cvtps_ph(pair, _MM_FROUND_TO_NEAREST_INT));
+    }
+#endif
+    for (; i < texels; i++)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            float value = rgb[3 * i + c];
+            rgba[4 * i + c] = FloatToHalf(maxRadiance > 0.0f ? std::clamp(value, 0.0f, maxRadiance) : value);
+        }
+        rgba[4 * i + 3] = 0x3C00;
+    }
+}
+
+#endif // !HALF_H
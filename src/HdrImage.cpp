@@ -0,0 +1,53 @@
+#include "HdrImage.h"
+
+#include "RadianceReader.h"
+#include "stb_image.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+
+bool LoadHdri(const char* hdriPath, float maxRadiance, HdrImage& image)
+{
+    // Radiance files go through the parallel decoder, which also applies the clamp; anything else is left to
+    // stb_image.
+    RadianceReader reader;
+    if (reader.Open(hdriPath))
+    {
+        float* rgb = (float*)std::malloc((std::size_t)reader.Width() * reader.Height() * 3 * sizeof(float));
+        if (!rgb || !reader.ReadImage(maxRadiance, rgb))
+        {
+            std::free(rgb);
+            std::cout << "Failed to load HDR image at " << hdriPath << std::endl;
+            return false;
+        }
+        image.width = reader.Width();
+        image.height = reader.Height();
+        image.rgb = { rgb, std::free };
+        return true;
+    }
+
+    int width, height, nrComponents;
+    stbi_set_flip_vertically_on_load(true);
+    float* data = stbi_loadf(hdriPath, &width, &height, &nrComponents, 3);
+    if (!data)
+    {
+        std::cout << "Failed to load HDR image at " << hdriPath << std::endl;
+        return false;
+    }
+
+    if (maxRadiance > 0.0f)
+    {
+        std::size_t count = (std::size_t)width * height * 3;
+        for (std::size_t i = 0; i < count; i++)
+        {
+            data[i] = std::clamp(data[i], 0.0f, maxRadiance);
+        }
+    }
+
+    image.width = width;
+    image.height = height;
+    image.rgb = { data, stbi_image_free };
+    return true;
+}
@@ -0,0 +1,17 @@
+#ifndef HDR_IMAGE_H
+#define HDR_IMAGE_H
+
+#include <memory>
+
+// Equirectangular RGB float image, bottom row first (the layout the GL upload expects).
+struct HdrImage
+{
+    int width = 0;
+    int height = 0;
+    std::unique_ptr<float, void(*)(void*)> rgb{ nullptr, nullptr };
+};
+
+// Loads an HDRI and clamps every channel to [0, maxRadiance] when maxRadiance > 0.
+bool LoadHdri(const char* hdriPath, float maxRadiance, HdrImage& image);
+
+#endif // !HDR_IMAGE_H
@@ -1,14 +1,25 @@
 #include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
-#include "stb_image.h"
-#include "Shader.h"
+#include <memory>
+#include <sstream>
 #include <glad/glad.h>
+#include <string>
 #include <vector>
-#include <GLFW/glfw3.h>
-#include "ispc_texcomp.h"
-#include <cassert>
-
-void Convolute(const char* hdriPath, int resolution, float maxRadiance, GLuint cubeVAO);
+#include "BakeCache.h"
+#include "BrdfLut.h"
+#include "ConvoluteSettings.h"
+#include "CpuConvolute.h"
+#include "GlContext.h"
+#include "GlConvolute.h"
+#include "SphericalHarmonics.h"
+#include "ThreadPool.h"
+#include "Timing.h"
+#include "Validation.h"
 
 void GLAPIENTRY
 MessageCallback(GLenum source,
@@ -19,354 +30,774 @@ MessageCallback(GLenum source,
     const GLchar* message,
     const void* userParam);
 
-int TextureSizeBC6(std::uint32_t resolution, std::uint32_t mipmapLevels);
-
-struct CubemapFile
+enum class Backend
 {
-    static constexpr std::uint32_t correctMagicNumber = 'PMBC';
-    struct Header
-    {
-        std::uint32_t magicNumber = correctMagicNumber;
-        std::uint32_t mipmapLevels;
-        std::uint32_t resolution;
-        // TODO: specify pixel format?
-    };
-    Header header;
-    std::vector<std::uint8_t> pixels;
+    GL,
+    CPU
 };
 
-inline void WriteCubemapFile(const CubemapFile& cubemap, const std::string& file_path)
+struct ConvoluteJob
 {
-    std::ofstream file(file_path, std::ios::binary);
-
-    file.write((const char*)&cubemap.header, sizeof(CubemapFile::Header));
-    file.write((const char*)cubemap.pixels.data(), cubemap.pixels.size());
-}
+    std::string hdriPath;
+    ConvoluteSettings settings;
+};
 
-struct Vec3
+static bool IsNumber(const std::string& text)
 {
-    float x, y, z;
-};
+    char* end = nullptr;
+    std::strtod(text.c_str(), &end);
+    return !text.empty() && end == text.c_str() + text.size();
+}
 
-int main(int argc, char** argv)
+// Response file: one HDRI path per line, blank lines and lines starting with '#' ignored.
+static bool ReadResponseFile(const std::string& path, std::vector<std::string>& inputs)
 {
-    if (argc < 3)
+    std::ifstream file(path);
+    if (!file)
     {
-        std::cout << "Usage: ibl_convoluter hdri1_path resolutionPixels [maxRadiance]\n";
-        return 0;
+        std::cout << "Failed to open response file '" << path << "'\n";
+        return false;
     }
-
-    int resolution = std::atoi(argv[2]);
-    if (resolution <= 0)
+    std::string line;
+    while (std::getline(file, line))
     {
-        std::cout << "Invalid resolution: '" << argv[2] << "'\n";
-        return 0;
+        line.erase(line.find_last_not_of(" \t\r") + 1);
+        line.erase(0, line.find_first_not_of(" \t"));
+        if (!line.empty() && line[0] != '#')
+        {
+            inputs.push_back(line);
+        }
     }
+    return true;
+}
 
-    float maxRadiance = 0.0f;
-    if (argc == 4)
+// Manifest: one job per line, "hdri_path [resolutionPixels [maxRadiance]]". Paths containing spaces must be quoted.
+// Missing values fall back to the ones given on the command line.
+static bool ReadManifest(const std::string& path, const ConvoluteSettings& defaults, std::vector<ConvoluteJob>& jobs)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        std::cout << "Failed to open manifest '" << path << "'\n";
+        return false;
+    }
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line))
     {
-        maxRadiance = std::atof(argv[3]);
-        if (maxRadiance <= 0.0f)
+        lineNumber++;
+        std::istringstream fields(line);
+        ConvoluteJob job;
+        job.settings = defaults;
+        if (!(fields >> std::quoted(job.hdriPath)) || job.hdriPath[0] == '#')
         {
-            std::cout << "Invalid max radiance: '" << argv[3] << "'\n";
-            return 0;
+            continue;
         }
+        std::string value;
+        if (fields >> value)
+        {
+            job.settings.resolution = std::atoi(value.c_str());
+        }
+        if (fields >> value)
+        {
+            job.settings.maxRadiance = (float)std::atof(value.c_str());
+            if (job.settings.maxRadiance <= 0.0f)
+            {
+                std::cout << path << ":" << lineNumber << ": invalid max radiance '" << value << "'\n";
+                return false;
+            }
+        }
+        if (!IsValidCubeResolution(job.settings.resolution))
+        {
+            std::cout << path << ":" << lineNumber << ": missing resolution, or not a power of two\n";
+            return false;
+        }
+        jobs.push_back(job);
     }
+    return true;
+}
 
-    if (!glfwInit())
-        return -1;
-
-    const char* glsl_version = "#version 430";
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
-
-    GLFWwindow* dummyWindow = glfwCreateWindow(100, 100, "", NULL, NULL);
-
-    if (!dummyWindow)
+// A single job keeps writing straight into outputRoot (the working directory by default); a batch gets one
+// directory per input, named after the input file.
+static void AssignOutputDirectories(std::vector<ConvoluteJob>& jobs, const std::string& outputRoot)
+{
+    if (jobs.size() == 1)
     {
-        glfwTerminate();
-        return -1;
+        jobs[0].settings.outputDirectory = outputRoot;
+        return;
     }
 
-    glfwMakeContextCurrent(dummyWindow);
-
-    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+    std::vector<std::string> used;
+    for (ConvoluteJob& job : jobs)
     {
-        printf("Failed to initialize GLAD\n");
-        return -1;
+        std::filesystem::path directory = std::filesystem::path(outputRoot.empty() ? "." : outputRoot) / std::filesystem::path(job.hdriPath).stem();
+        std::string name = directory.string();
+        for (int suffix = 2; std::find(used.begin(), used.end(), name) != used.end(); suffix++)
+        {
+            name = directory.string() + "_" + std::to_string(suffix);
+        }
+        used.push_back(name);
+        job.settings.outputDirectory = name;
     }
-
-    glEnable(GL_DEBUG_OUTPUT);
-    glDebugMessageCallback(MessageCallback, 0);
-
-    glEnable(GL_CULL_FACE);
-    glCullFace(GL_BACK);
-    glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
-
-    Vec3 cubeVertices[] = {
-        {-1.0f, -1.0f, 0.0f}, {1.0f, 1.0f, 1.0f}, {1.0f, -1.0f, 0.0f}, {1.0f, 1.0f, -1.0f}, {1.0f, 1.0f, 0.0f}, {1.0f, -1.0f, -1.0f}, {-1.0f, 1.0f, 0.0f}, {1.0f, -1.0f, 1.0f},  // POSITIVE_X
-
-        {-1.0f, -1.0f, 0.0f}, {-1.0f, 1.0f, -1.0f}, {1.0f, -1.0f, 0.0f}, {-1.0f, 1.0f, 1.0f}, {1.0f, 1.0f, 0.0f}, {-1.0f, -1.0f, 1.0f}, {-1.0f, 1.0f, 0.0f}, {-1.0f, -1.0f, -1.0f},    // NEGATIVE_X
-
-        {-1.0f, -1.0f, 0.0f}, {-1.0f, 1.0f, -1.0f}, {1.0f, -1.0f, 0.0f}, {1.0f, 1.0f, -1.0f}, {1.0f, 1.0f, 0.0f}, {1.0f, 1.0f, 1.0f}, {-1.0f, 1.0f, 0.0f}, {-1.0f, 1.0f, 1.0f},   // POSITIVE_Y 
-
-        {-1.0f, -1.0f, 0.0f}, {-1.0f, -1.0f, 1.0f}, {1.0f, -1.0f, 0.0f}, {1.0f, -1.0f, 1.0f}, {1.0f, 1.0f, 0.0f}, {1.0f, -1.0f, -1.0f}, {-1.0f, 1.0f, 0.0f}, {-1.0f, -1.0f, -1.0f}, // NEGATIVE_Y
-
-         {-1.0f, -1.0f, 0.0f}, {-1.0f, 1.0f, 1.0f}, {1.0f, -1.0f, 0.0f}, {1.0f, 1.0f, 1.0f}, {1.0f, 1.0f, 0.0f}, {1.0f, -1.0f, 1.0f}, {-1.0f, 1.0f, 0.0f}, {-1.0f, -1.0f, 1.0f},   // POSITIVE_Z
-
-        {-1.0f, -1.0f, 0.0f}, {1.0f, 1.0f, -1.0f}, {1.0f, -1.0f, 0.0f}, {-1.0f, 1.0f, -1.0f}, {1.0f, 1.0f, 0.0f}, {-1.0f, -1.0f, -1.0f}, {-1.0f, 1.0f, 0.0f}, {1.0f, -1.0f, -1.0f}, // NEGATIVE_Z
-    };
-
-    GLuint cubeIndices[] = {
-        0, 1, 2, 2, 3, 0,
-        4, 5, 6, 6, 7, 4,
-        8, 9, 10, 10, 11, 8,
-        12, 13, 14, 14, 15, 12,
-        16, 17, 18, 18, 19, 16,
-        20, 21, 22, 22, 23, 20
-    };
-
-    GLuint cubeVAO;
-    glGenVertexArrays(1, &cubeVAO);
-    glBindVertexArray(cubeVAO);
-
-    GLuint cubeVBO;
-    glGenBuffers(1, &cubeVBO);
-    glBindBuffer(GL_ARRAY_BUFFER, cubeVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(cubeVertices), cubeVertices, GL_STATIC_DRAW);
-
-    GLuint cubeIBO;
-    glGenBuffers(1, &cubeIBO);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cubeIBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(cubeIndices), cubeIndices, GL_STATIC_DRAW);
-
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 2 * sizeof(Vec3), 0);
-
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 2 * sizeof(Vec3), (const void*)(sizeof(Vec3)));
-
-    Convolute(argv[1], resolution, maxRadiance, cubeVAO);
-
-    return 0;
 }
 
-void Convolute(const char* hdriPath, int resolution, float maxRadiance, GLuint cubeVAO)
+int main(int argc, char** argv)
 {
-    int width, height, nrComponents;
-    stbi_set_flip_vertically_on_load(true);
-    float* data = stbi_loadf(hdriPath, &width, &height, &nrComponents, 0);
-    GLuint hdrTexture;
-    if (data)
+    Backend backend = Backend::GL;
+    GlContextKind contextKind = GlContextKind::Auto;
+    ConvoluteSettings settings;
+    std::string manifestPath;
+    std::string cacheDirectory;
+    std::uint64_t cacheMegabytes = 10240;
+    std::string outputRoot;
+    std::string reportPath;
+    bool brdfLut = false;
+    bool sheenLut = false;
+    bool validate = false;
+    int fileVersion = 0; // 0 until given, see below
+    BrdfLutSettings brdfLutSettings;
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; i++)
     {
-        assert(nrComponents == 3);
-        if (maxRadiance > 0.0f)
+        std::string arg = argv[i];
+        if (arg == "--backend" && i + 1 < argc)
         {
-            for (int i = 0; i < width * height; i++)
+            std::string value = argv[++i];
+            if (value == "gl")
+            {
+                backend = Backend::GL;
+            }
+            else if (value == "cpu")
+            {
+                backend = Backend::CPU;
+            }
+            else
             {
-                data[i] = std::clamp(data[i], 0.0f, maxRadiance);
+                std::cout << "Invalid backend: '" << value << "'\n";
+                return 0;
             }
         }
-        glGenTextures(1, &hdrTexture);
-        glBindTexture(GL_TEXTURE_2D, hdrTexture);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, width, height, 0, GL_RGB, GL_FLOAT, data);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        else if (arg == "--gl-pipeline" && i + 1 < argc)
+        {
+            std::string value = argv[++i];
+            if (value == "raster")
+            {
+                settings.glPipeline = GlPipeline::Raster;
+            }
+            else if (value == "compute")
+            {
+                settings.glPipeline = GlPipeline::Compute;
+            }
+            else
+            {
+                std::cout << "Invalid GL pipeline: '" << value << "'\n";
+                return 0;
+            }
+        }
+        else if (arg == "--gl-context" && i + 1 < argc)
+        {
+            std::string value = argv[++i];
+            if (value == "auto")
+            {
+                contextKind = GlContextKind::Auto;
+            }
+            else if (value == "egl")
+            {
+                contextKind = GlContextKind::EglSurfaceless;
+            }
+            else if (value == "egl-pbuffer")
+            {
+                contextKind = GlContextKind::EglPbuffer;
+            }
+            else if (value == "osmesa")
+            {
+                contextKind = GlContextKind::OSMesa;
+            }
+            else if (value == "glfw")
+            {
+                contextKind = GlContextKind::Glfw;
+            }
+            else
+            {
+                std::cout << "Invalid GL context: '" << value << "'\n";
+                return 0;
+            }
+        }
+        else if (arg == "--file-version" && i + 1 < argc)
+        {
+            fileVersion = std::atoi(argv[++i]);
+            if (fileVersion != 1 && fileVersion != 2)
+            {
+                std::cout << "Invalid file version: '" << argv[i] << "'\n";
+                return 0;
+            }
+        }
+        else if (arg == "--file-order" && i + 1 < argc)
+        {
+            std::string value = argv[++i];
+            if (value == "face-major")
+            {
+                settings.fileOrder = CubemapFileOrder::FaceMajor;
+            }
+            else if (value == "mip-major")
+            {
+                settings.fileOrder = CubemapFileOrder::MipMajor;
+            }
+            else
+            {
+                std::cout << "Invalid file order: '" << value << "'\n";
+                return 0;
+            }
+        }
+        else if (arg == "--irradiance" && i + 1 < argc)
+        {
+            std::string value = argv[++i];
+            if (value == "brute")
+            {
+                settings.irradianceMode = IrradianceMode::BruteForce;
+            }
+            else if (value == "sh")
+            {
+                settings.irradianceMode = IrradianceMode::SH;
+            }
+            else if (value == "sh-coefficients")
+            {
+                settings.irradianceMode = IrradianceMode::SHCoefficientsOnly;
+            }
+            else
+            {
+                std::cout << "Invalid irradiance mode: '" << value << "'\n";
+                return 0;
+            }
+        }
+        else if (arg == "--sh-bands" && i + 1 < argc)
+        {
+            settings.shBands = std::atoi(argv[++i]);
+            if (settings.shBands < 3 || settings.shBands > maxShBands)
+            {
+                std::cout << "Invalid SH band count: '" << argv[i] << "'\n";
+                return 0;
+            }
+        }
+        else if (arg == "--bc6h-quality" && i + 1 < argc)
+        {
+            std::string value = argv[++i];
+            if (value == "fast")
+            {
+                settings.compressionQuality = BC6HQuality::Fast;
+            }
+            else if (value == "basic")
+            {
+                settings.compressionQuality = BC6HQuality::Basic;
+            }
+            else if (value == "slow")
+            {
+                settings.compressionQuality = BC6HQuality::Slow;
+            }
+            else
+            {
+                std::cout << "Invalid BC6H quality: '" << value << "'\n";
+                return 0;
+            }
+        }
+        else if (arg == "--prefilter-quality" && i + 1 < argc)
+        {
+            std::string value = argv[++i];
+            if (value == "fast")
+            {
+                settings.prefilterErrorTarget = 0.05f;
+            }
+            else if (value == "balanced")
+            {
+                settings.prefilterErrorTarget = 0.01f;
+            }
+            else if (value == "reference")
+            {
+                settings.prefilterErrorTarget = 0.0f;
+            }
+            else
+            {
+                std::cout << "Invalid prefilter quality: '" << value << "'\n";
+                return 0;
+            }
+        }
+        else if (arg == "--equirect-filter" && i + 1 < argc)
+        {
+            std::string value = argv[++i];
+            if (value == "bilinear")
+            {
+                settings.equirectFilter = EquirectFilter::Bilinear;
+            }
+            else if (value == "box")
+            {
+                settings.equirectFilter = EquirectFilter::Box;
+            }
+            else if (value == "lanczos")
+            {
+                settings.equirectFilter = EquirectFilter::Lanczos;
+            }
+            else
+            {
+                std::cout << "Invalid equirect filter: '" << value << "'\n";
+                return 0;
+            }
+        }
+        else if (arg == "--mip-filter" && i + 1 < argc)
+        {
+            std::string value = argv[++i];
+            if (value == "box")
+            {
+                settings.mipFilter = MipFilter::Box;
+            }
+            else if (value == "seamless")
+            {
+                settings.mipFilter = MipFilter::Seamless;
+            }
+            else
+            {
+                std::cout << "Invalid mip filter: '" << value << "'\n";
+                return 0;
+            }
+        }
+        else if (arg == "--prefilter-error" && i + 1 < argc)
+        {
+            settings.prefilterErrorTarget = (float)std::atof(argv[++i]);
+            if (settings.prefilterErrorTarget < 0.0f)
+            {
+                std::cout << "Invalid prefilter error target: '" << argv[i] << "'\n";
+                return 0;
+            }
+        }
+        else if (arg == "--irradiance-resolution" && i + 1 < argc)
+        {
+            settings.irradianceResolution = std::atoi(argv[++i]);
+            // An odd size puts the centre texel of the +Y and -Y faces on the pole, where the tangent frame of
+            // convolute.frag degenerates.
+            if (!IsValidCubeResolution(settings.irradianceResolution) || settings.irradianceResolution % 2 != 0)
+            {
+                std::cout << "Invalid irradiance resolution: '" << argv[i] << "', it must be a power of two from 2 up\n";
+                return 0;
+            }
+        }
+        else if (arg == "--prefilter-resolution" && i + 1 < argc)
+        {
+            settings.prefilterResolution = std::atoi(argv[++i]);
+            if (!IsValidCubeResolution(settings.prefilterResolution))
+            {
+                std::cout << "Invalid prefilter resolution: '" << argv[i] << "', it must be a power of two\n";
+                return 0;
+            }
+        }
+        else if (arg == "--prefilter-mips" && i + 1 < argc)
+        {
+            settings.prefilterMipLevels = std::atoi(argv[++i]);
+            if (settings.prefilterMipLevels <= 0)
+            {
+                std::cout << "Invalid prefilter mip count: '" << argv[i] << "'\n";
+                return 0;
+            }
+        }
+        else if (arg == "--incremental")
+        {
+            settings.incremental = true;
+        }
+        else if (arg == "--stream")
+        {
+            settings.streamHdri = true;
+        }
+        else if (arg == "--supercompress")
+        {
+            settings.supercompress = true;
+        }
+        else if (arg == "--validate")
+        {
+            validate = true;
+            settings.writeUncompressed = true;
+        }
+        else if (arg == "--threads" && i + 1 < argc)
+        {
+            int threads = std::atoi(argv[++i]);
+            if (threads <= 0)
+            {
+                std::cout << "Invalid thread count: '" << argv[i] << "'\n";
+                return 0;
+            }
+            ThreadPool::SetGlobalThreadCount(threads);
+        }
+        else if (arg == "--brdf-lut")
+        {
+            brdfLut = true;
+        }
+        else if (arg == "--brdf-lut-multiscatter")
+        {
+            brdfLutSettings.multiScatter = true;
+        }
+        else if (arg == "--sheen-lut")
+        {
+            sheenLut = true;
+        }
+        else if (arg == "--brdf-lut-resolution" && i + 1 < argc)
+        {
+            brdfLutSettings.resolution = std::atoi(argv[++i]);
+            if (brdfLutSettings.resolution <= 0)
+            {
+                std::cout << "Invalid BRDF LUT resolution: '" << argv[i] << "'\n";
+                return 0;
+            }
+        }
+        else if (arg == "--brdf-lut-samples" && i + 1 < argc)
+        {
+            brdfLutSettings.sampleCount = std::atoi(argv[++i]);
+            if (brdfLutSettings.sampleCount <= 0)
+            {
+                std::cout << "Invalid BRDF LUT sample count: '" << argv[i] << "'\n";
+                return 0;
+            }
+        }
+        else if (arg == "--brdf-lut-format" && i + 1 < argc)
+        {
+            std::string value = argv[++i];
+            if (value == "half")
+            {
+                brdfLutSettings.format = BrdfLutFormat::Half;
+            }
+            else if (value == "float")
+            {
+                brdfLutSettings.format = BrdfLutFormat::Float;
+            }
+            else
+            {
+                std::cout << "Invalid BRDF LUT format: '" << value << "'\n";
+                return 0;
+            }
+        }
+        else if (arg == "--cache" && i + 1 < argc)
+        {
+            cacheDirectory = argv[++i];
+        }
+        else if (arg == "--cache-size" && i + 1 < argc)
+        {
+            long long megabytes = std::atoll(argv[++i]);
+            if (megabytes <= 0)
+            {
+                std::cout << "Invalid cache size: '" << argv[i] << "'\n";
+                return 0;
+            }
+            cacheMegabytes = megabytes;
+        }
+        else if (arg == "--manifest" && i + 1 < argc)
+        {
+            manifestPath = argv[++i];
+        }
+        else if (arg == "--output-dir" && i + 1 < argc)
+        {
+            outputRoot = argv[++i];
+        }
+        else if (arg == "--report" && i + 1 < argc)
+        {
+            reportPath = argv[++i];
+        }
+        else if (arg.size() > 2 && arg.compare(0, 2, "--") == 0)
+        {
+            std::cout << "Unknown option: '" << arg << "'\n";
+            return 0;
+        }
+        else
+        {
+            positional.push_back(arg);
+        }
+    }
 
-        stbi_image_free(data);
+    // Positional arguments are "hdri_path... resolutionPixels [maxRadiance]", where any path may be an @response_file.
+    size_t numberCount = 0;
+    if (positional.size() >= 3 && IsNumber(positional[positional.size() - 1]) && IsNumber(positional[positional.size() - 2]))
+    {
+        numberCount = 2;
     }
-    else
+    else if (positional.size() >= 2 && IsNumber(positional.back()))
     {
-        std::cout << "Failed to load HDR image at " << hdriPath << std::endl;
-        return;
+        numberCount = 1;
     }
 
-    GLuint environmentMap;
-    glGenTextures(1, &environmentMap);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, environmentMap);
-    for (unsigned int i = 0; i < 6; ++i)
+    // --brdf-lut or --sheen-lut on their own only write the tables.
+    bool tablesOnly = (brdfLut || sheenLut) && positional.empty() && manifestPath.empty();
+    if ((numberCount == 0 || positional.size() == numberCount) && manifestPath.empty() && !tablesOnly)
     {
-        // RGBA used because this is the format expected by the BC6 compressor being used (final result of BC6 compression doesn't include alpha)
-        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGBA16F,
-            resolution, resolution, 0, GL_RGBA, GL_FLOAT, nullptr);
+        std::cout << "Usage: ibl_convoluter [--backend gl|cpu] [--gl-pipeline raster|compute]\n"
+                     "                      [--gl-context auto|egl|egl-pbuffer|osmesa|glfw]\n"
+                     "                      [--irradiance brute|sh|sh-coefficients] [--sh-bands 3|4|5]\n"
+                     "                      [--bc6h-quality fast|basic|slow] [--prefilter-quality fast|balanced|reference]\n"
+                     "                      [--prefilter-error relative] [--irradiance-resolution pixels]\n"
+                     "                      [--prefilter-resolution pixels] [--prefilter-mips count] [--incremental]\n"
+                     "                      [--equirect-filter bilinear|box|lanczos] [--mip-filter box|seamless]\n"
+                     "                      [--stream] [--threads count] [--manifest file]\n"
+                     "                      [--file-version 1|2] [--file-order face-major|mip-major] [--supercompress]\n"
+                     "                      [--output-dir dir] [--cache dir] [--cache-size megabytes] [--report file|-]\n"
+                     "                      [--validate] [--brdf-lut] [--brdf-lut-multiscatter] [--sheen-lut]\n"
+                     "                      [--brdf-lut-resolution pixels] [--brdf-lut-samples count]\n"
+                     "                      [--brdf-lut-format half|float]\n"
+                     "                      hdri_path|@response_file... resolutionPixels [maxRadiance]\n";
+        return 0;
     }
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    GLuint captureFBO;
-    glGenFramebuffers(1, &captureFBO);
 
-    glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
-
-    Shader equirectToCubemapShader = Shader("Shaders/equirectToCubemap.vert", "Shaders/equirectToCubemap.frag");
-    equirectToCubemapShader.use();
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, hdrTexture);
-    equirectToCubemapShader.SetInt("equirectangularMap", 0);
+    // Version 1 stays the default for loaders that don't read version 2 yet, unless an option needs version 2.
+    bool needsVersion2 = settings.fileOrder == CubemapFileOrder::MipMajor || settings.supercompress;
+    if (fileVersion == 1 && needsVersion2)
+    {
+        std::cout << "--file-order mip-major and --supercompress need --file-version 2\n";
+        return 0;
+    }
+    settings.fileVersion = fileVersion != 0 ? fileVersion : needsVersion2 ? 2 : 1;
 
-    glViewport(0, 0, resolution, resolution);
-    for (unsigned int i = 0; i < 6; ++i)
+    if (settings.prefilterMipLevels > 1 + (int)std::log2(settings.prefilterResolution))
     {
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-            GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, environmentMap, 0);
-        glClear(GL_COLOR_BUFFER_BIT);
-        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, (const void*)(i * 6 * sizeof(GLuint)));
+        std::cout << "A " << settings.prefilterResolution << " pixel prefilter map has no more than "
+                  << 1 + (int)std::log2(settings.prefilterResolution) << " mips\n";
+        return 0;
     }
 
-     // TODO: look into compressonator mip map generation
-    glBindTexture(GL_TEXTURE_CUBE_MAP, environmentMap);
-    glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+    size_t inputCount = positional.size() - numberCount;
+    if (numberCount >= 1)
+    {
+        settings.resolution = std::atoi(positional[inputCount].c_str());
+        if (!IsValidCubeResolution(settings.resolution))
+        {
+            std::cout << "Invalid resolution: '" << positional[inputCount] << "', it must be a power of two\n";
+            return 0;
+        }
+    }
 
-    CubemapFile envMapFile;
-    envMapFile.header.resolution = resolution;
-    envMapFile.header.mipmapLevels = 1 + (int)std::log2(resolution);
-    int bytesPerFace = TextureSizeBC6(resolution, envMapFile.header.mipmapLevels);
-    envMapFile.pixels.resize(bytesPerFace * 6);
+    if (numberCount == 2)
+    {
+        settings.maxRadiance = (float)std::atof(positional[inputCount + 1].c_str());
+        if (settings.maxRadiance <= 0.0f)
+        {
+            std::cout << "Invalid max radiance: '" << positional[inputCount + 1] << "'\n";
+            return 0;
+        }
+    }
 
-    std::vector<std::uint8_t> uncompressedPixels(resolution * resolution * 8);
+    std::vector<std::string> inputs;
+    for (size_t i = 0; i < inputCount; i++)
+    {
+        if (positional[i][0] == '@')
+        {
+            if (!ReadResponseFile(positional[i].substr(1), inputs))
+            {
+                return -1;
+            }
+        }
+        else
+        {
+            inputs.push_back(positional[i]);
+        }
+    }
 
-    int faceOffsetBytes = 0;
-    for (unsigned int i = 0; i < 6; ++i)
+    std::vector<ConvoluteJob> jobs;
+    for (const std::string& input : inputs)
     {
-        int mipRes = envMapFile.header.resolution;
-        int mipLevelOffsetBytes = 0;
-        for (unsigned int j = 0; j < envMapFile.header.mipmapLevels; j++)
-        {
-            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-                GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, environmentMap, j);
-            glReadPixels(0, 0, mipRes, mipRes, GL_RGBA, GL_HALF_FLOAT, uncompressedPixels.data());
-            rgba_surface surface;
-            surface.ptr = uncompressedPixels.data();
-            surface.width = mipRes;
-            surface.height = mipRes;
-            surface.stride = surface.width * 8;
-            bc6h_enc_settings settings;
-            GetProfile_bc6h_basic(&settings);
-            CompressBlocksBC6H(&surface, &envMapFile.pixels[faceOffsetBytes + mipLevelOffsetBytes], &settings);
-            mipLevelOffsetBytes += mipRes * mipRes;
-            mipRes = std::max(mipRes / 2, 4);
-        }
-        faceOffsetBytes += bytesPerFace;
+        jobs.push_back({ input, settings });
+    }
+    if (!manifestPath.empty() && !ReadManifest(manifestPath, settings, jobs))
+    {
+        return -1;
+    }
+    if (jobs.empty() && !tablesOnly)
+    {
+        std::cout << "No inputs given\n";
+        return 0;
     }
-     
-    WriteCubemapFile(envMapFile, "envmap.cbmp");
 
-    const int irradianceRes = 32;
-    GLuint irradianceMap;
-    glGenTextures(1, &irradianceMap);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, irradianceMap);
-    for (unsigned int i = 0; i < 6; ++i)
+    AssignOutputDirectories(jobs, outputRoot);
+    if ((brdfLut || sheenLut) && !outputRoot.empty())
+    {
+        std::error_code error;
+        std::filesystem::create_directories(outputRoot, error);
+        if (error)
+        {
+            std::cout << "Failed to create output directory '" << outputRoot << "': " << error.message() << "\n";
+            return -1;
+        }
+    }
+    for (const ConvoluteJob& job : jobs)
     {
-        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGBA16F, irradianceRes, irradianceRes, 0,
-            GL_RGBA, GL_FLOAT, nullptr);
+        if (!job.settings.outputDirectory.empty())
+        {
+            std::error_code error;
+            std::filesystem::create_directories(job.settings.outputDirectory, error);
+            if (error)
+            {
+                std::cout << "Failed to create output directory '" << job.settings.outputDirectory << "': " << error.message() << "\n";
+                return -1;
+            }
+        }
     }
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-    glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
+    std::unique_ptr<BakeCache> cache;
+    if (!cacheDirectory.empty())
+    {
+        cache = std::make_unique<BakeCache>(cacheDirectory, cacheMegabytes << 20);
+    }
+    // Validation references take as long as several bakes, so they are always cached: in the bake cache when there
+    // is one, in the temporary directory otherwise.
+    std::unique_ptr<BakeCache> referenceCache;
+    if (validate && !cache)
+    {
+        std::error_code error;
+        std::filesystem::path directory = std::filesystem::temp_directory_path(error) / "ibl_convoluter_reference";
+        referenceCache = std::make_unique<BakeCache>(directory.string(), cacheMegabytes << 20);
+    }
 
-    Shader convolutionShader = Shader("Shaders/equirectToCubemap.vert", "Shaders/convolute.frag");
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, environmentMap);
-    convolutionShader.SetInt("environmentMap", 0);
+    // Timings are only collected when a report was asked for; the backends take a null StageTimings otherwise.
+    std::vector<JobTimings> jobTimings(reportPath.empty() ? 0 : jobs.size());
+    auto runStart = std::chrono::steady_clock::now();
+    auto runJob = [&](size_t index, auto&& bake)
+    {
+        if (jobs.size() > 1)
+        {
+            std::cout << "[" << index + 1 << "/" << jobs.size() << "] " << jobs[index].hdriPath << " -> " << jobs[index].settings.outputDirectory << std::endl;
+        }
+        // With a cache, a hit replaces the bake and a successful bake is added to it. Hashing and copying are
+        // reported as the "cache" stage.
+        auto convolute = [&](StageTimings* timings)
+        {
+            if (!cache)
+            {
+                return bake(timings);
+            }
+            const ConvoluteSettings& jobSettings = jobs[index].settings;
+            std::string key;
+            {
+                ScopedStageTimer timer(timings, "cache");
+                key = BakeCache::Key(jobs[index].hdriPath, jobSettings, backend == Backend::CPU ? "cpu" : "gl");
+                if (!key.empty() && cache->Restore(key, jobSettings))
+                {
+                    std::cout << "Cache hit " << key << " for " << jobs[index].hdriPath << std::endl;
+                    return true;
+                }
+            }
+            if (!bake(timings))
+            {
+                return false;
+            }
+            if (!key.empty())
+            {
+                ScopedStageTimer timer(timings, "cache");
+                cache->Store(key, jobSettings);
+            }
+            return true;
+        };
+        auto convoluteAndValidate = [&](StageTimings* timings)
+        {
+            return convolute(timings)
+                && (!validate || ValidateBake(jobs[index].hdriPath.c_str(), jobs[index].settings, cache ? *cache : *referenceCache, timings));
+        };
+        if (jobTimings.empty())
+        {
+            return convoluteAndValidate(nullptr);
+        }
+        JobTimings& timing = jobTimings[index];
+        timing.hdriPath = jobs[index].hdriPath;
+        timing.outputDirectory = jobs[index].settings.outputDirectory;
+        timing.resolution = jobs[index].settings.resolution;
+        auto start = std::chrono::steady_clock::now();
+        timing.succeeded = convoluteAndValidate(&timing.stages);
+        timing.totalMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        return timing.succeeded;
+    };
+    auto writeReport = [&](const char* backendName)
+    {
+        double totalMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - runStart).count();
+        return reportPath.empty() || WriteTimingReport(reportPath, backendName, jobTimings, totalMs);
+    };
+    // BRDF tables are the same for every input, so a run writes them once into outputRoot, and with a cache only
+    // ever integrates them once per parameter set.
+    auto bakeTable = [&](const char* fileName, const char* backendName, int channels, auto&& integrate)
+    {
+        std::string key;
+        if (cache)
+        {
+            key = BakeCache::BrdfLutKey(fileName, brdfLutSettings, backendName);
+            if (cache->Restore(key, { fileName }, outputRoot))
+            {
+                std::cout << "Cache hit " << key << " for " << fileName << std::endl;
+                return true;
+            }
+        }
+        std::vector<float> texels;
+        integrate(texels);
+        std::string path = (std::filesystem::path(outputRoot) / fileName).string();
+        if (WriteBrdfLutFile(brdfLutSettings, channels, texels, path) == 0)
+        {
+            std::cout << "Failed to write " << path << std::endl;
+            return false;
+        }
+        if (cache)
+        {
+            cache->Store(key, { fileName }, outputRoot);
+        }
+        return true;
+    };
 
-    glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
-    glViewport(0, 0, irradianceRes, irradianceRes);
-    uncompressedPixels.resize(irradianceRes * irradianceRes * 8);
-    CubemapFile irradianceMapFileData;
-    irradianceMapFileData.header.resolution = irradianceRes;
-    irradianceMapFileData.header.mipmapLevels = 1;
-    irradianceMapFileData.pixels.resize(irradianceRes * irradianceRes * 6);
-    int byteOffset = 0;
-    for (unsigned int i = 0; i < 6; ++i)
+    int failedJobs = 0;
+    // The sheen table has no shader, both backends integrate it on the CPU.
+    if (sheenLut)
+    {
+        failedJobs += bakeTable(sheenLutFileName, "cpu", 1, [&](std::vector<float>& texels) { IntegrateSheenLut(brdfLutSettings, texels); }) ? 0 : 1;
+    }
+    if (backend == Backend::CPU)
     {
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-            GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, irradianceMap, 0);
-        glClear(GL_COLOR_BUFFER_BIT);
-        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, (const void*)(i * 6 * sizeof(GLuint)));
-        glReadPixels(0, 0, irradianceRes, irradianceRes, GL_RGBA, GL_HALF_FLOAT, uncompressedPixels.data());
-        rgba_surface surface;
-        surface.ptr = uncompressedPixels.data();
-        surface.width = irradianceRes;
-        surface.height = irradianceRes;
-        surface.stride = surface.width * 8;
-        bc6h_enc_settings settings;
-        GetProfile_bc6h_basic(&settings);
-        CompressBlocksBC6H(&surface, &irradianceMapFileData.pixels[i * irradianceRes * irradianceRes], &settings);
+        if (brdfLut)
+        {
+            failedJobs += bakeTable(brdfLutFileName, "cpu", BrdfLutChannels(brdfLutSettings), [&](std::vector<float>& texels)
+            {
+                IntegrateBrdfLut(brdfLutSettings, texels);
+            }) ? 0 : 1;
+        }
+        for (size_t i = 0; i < jobs.size(); i++)
+        {
+            failedJobs += runJob(i, [&](StageTimings* timings) { return ConvoluteCpu(jobs[i].hdriPath.c_str(), jobs[i].settings, timings); }) ? 0 : 1;
+        }
+        if (!writeReport("cpu"))
+        {
+            return -1;
+        }
+        return failedJobs == 0 ? 0 : -1;
     }
-    
-    WriteCubemapFile(irradianceMapFileData, "irradiance.cbmp");
 
-    const int prefilterRes = 128;
-    GLuint prefilterMap;
-    glGenTextures(1, &prefilterMap);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, prefilterMap);
-    for (unsigned int i = 0; i < 6; ++i)
+    GlContext context;
+    if (!context.Create(contextKind))
     {
-        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGBA16F, prefilterRes, prefilterRes, 0, GL_RGBA, GL_FLOAT, nullptr);
+        return -1;
     }
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-    glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+    glEnable(GL_DEBUG_OUTPUT);
+    glDebugMessageCallback(MessageCallback, 0);
 
-    uncompressedPixels.resize(prefilterRes * prefilterRes * 8);
-    Shader prefilterShader = Shader("Shaders/equirectToCubemap.vert", "Shaders/prefilter.frag");
-    prefilterShader.use();
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, environmentMap);
-    prefilterShader.SetInt("environmentMap", 0);
-    prefilterShader.SetFloat("environmentMapResolution", resolution);
-    glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
-    const unsigned int mipLevels = 5;
-    CubemapFile prefilterFile;
-    prefilterFile.header.mipmapLevels = mipLevels;
-    prefilterFile.header.resolution = prefilterRes;
-    prefilterFile.pixels.resize(TextureSizeBC6(prefilterRes, mipLevels) * 6);
+    glEnable(GL_CULL_FACE);
+    glCullFace(GL_BACK);
+    glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
 
-    byteOffset = 0;
-    for (unsigned int i = 0; i < 6; ++i)
     {
-        int mipRes = prefilterRes;
-        for (unsigned int j = 0; j < mipLevels; j++)
-        {
-            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-                GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, prefilterMap, j);
-            glViewport(0, 0, mipRes, mipRes);
-            glClear(GL_COLOR_BUFFER_BIT);
-            float roughness = (float)j / (float)(mipLevels - 1);
-            prefilterShader.SetFloat("roughness", roughness);
-            glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, (const void*)(i * 6 * sizeof(GLuint)));
-            glReadPixels(0, 0, mipRes, mipRes, GL_RGBA, GL_HALF_FLOAT, uncompressedPixels.data());
-            rgba_surface surface;
-            surface.ptr = uncompressedPixels.data();
-            surface.width = mipRes;
-            surface.height = mipRes;
-            surface.stride = surface.width * 8;
-            bc6h_enc_settings settings;
-            GetProfile_bc6h_basic(&settings);
-            CompressBlocksBC6H(&surface, &prefilterFile.pixels[byteOffset], &settings);
-            byteOffset += mipRes >= 4 ? mipRes * mipRes : 4 * 4;
-            mipRes /= 2;
+        GlConvoluter convoluter;
+        if (brdfLut)
+        {
+            failedJobs += bakeTable(brdfLutFileName, "gl", BrdfLutChannels(brdfLutSettings), [&](std::vector<float>& texels)
+            {
+                convoluter.IntegrateBrdfLut(brdfLutSettings, texels);
+            }) ? 0 : 1;
+        }
+        for (size_t i = 0; i < jobs.size(); i++)
+        {
+            failedJobs += runJob(i, [&](StageTimings* timings) { return convoluter.Convolute(jobs[i].hdriPath.c_str(), jobs[i].settings, timings); }) ? 0 : 1;
         }
     }
 
-    WriteCubemapFile(prefilterFile, "prefilter.cbmp");
+    if (!writeReport("gl"))
+    {
+        return -1;
+    }
+    return failedJobs == 0 ? 0 : -1;
 }
 
 void GLAPIENTRY MessageCallback(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar* message, const void* userParam)
@@ -378,16 +809,3 @@ void GLAPIENTRY MessageCallback(GLenum source, GLenum type, GLuint id, GLenum se
             type, severity, message);
     }
 }
-
-int TextureSizeBC6(std::uint32_t resolution, std::uint32_t mipmapLevels)
-{
-    int bytesNeeded = resolution * resolution;
-
-    for (int i = 1; i < mipmapLevels; i++)
-    {
-        resolution = std::max(resolution / 2, 4u); // BC6 always works with 4x4 blocks
-        bytesNeeded += resolution * resolution;
-    }
-
-    return bytesNeeded;
-}
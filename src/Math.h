@@ -0,0 +1,69 @@
+#ifndef MATH_H
+#define MATH_H
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define IBL_SSE2 1
+#include <emmintrin.h>
+#endif
+
+constexpr float PI = 3.14159265359f;
+
+struct Vec3
+{
+    float x, y, z;
+};
+
+inline Vec3 operator+(Vec3 a, Vec3 b) { return { a.x + b.x, a.y + b.y, a.z + b.z }; }
+inline Vec3 operator-(Vec3 a, Vec3 b) { return { a.x - b.x, a.y - b.y, a.z - b.z }; }
+inline Vec3 operator*(Vec3 a, float s) { return { a.x * s, a.y * s, a.z * s }; }
+inline Vec3 operator*(float s, Vec3 a) { return a * s; }
+
+inline float Dot(Vec3 a, Vec3 b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+
+inline Vec3 Cross(Vec3 a, Vec3 b)
+{
+    return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+}
+
+inline Vec3 Normalize(Vec3 v)
+{
+    return v * (1.0f / std::sqrt(Dot(v, v)));
+}
+
+// Linear RGBA radiance. Kept 16 byte aligned so that filtering maps onto single SSE registers.
+struct alignas(16) Color
+{
+    float r, g, b, a;
+};
+
+#ifdef IBL_SSE2
+inline __m128 Load(const Color& c) { return _mm_load_ps(&c.r); }
+inline Color Store(__m128 v) { Color c; _mm_store_ps(&c.r, v); return c; }
+
+inline Color operator+(const Color& a, const Color& b) { return Store(_mm_add_ps(Load(a), Load(b))); }
+inline Color operator-(const Color& a, const Color& b) { return Store(_mm_sub_ps(Load(a), Load(b))); }
+inline Color operator*(const Color& a, float s) { return Store(_mm_mul_ps(Load(a), _mm_set1_ps(s))); }
+
+// a + (b - a) * t
+inline Color Lerp(const Color& a, const Color& b, float t)
+{
+    __m128 va = Load(a);
+    return Store(_mm_add_ps(va, _mm_mul_ps(_mm_sub_ps(Load(b), va), _mm_set1_ps(t))));
+}
+#else
+inline Color operator+(const Color& a, const Color& b) { return { a.r + b.r, a.g + b.g, a.b + b.b, a.a + b.a }; }
+inline Color operator-(const Color& a, const Color& b) { return { a.r - b.r, a.g - b.g, a.b - b.b, a.a - b.a }; }
+inline Color operator*(const Color& a, float s) { return { a.r * s, a.g * s, a.b * s, a.a * s }; }
+
+inline Color Lerp(const Color& a, const Color& b, float t)
+{
+    return a + (b - a) * t;
+}
+#endif
+
+inline Color& operator+=(Color& a, const Color& b) { a = a + b; return a; }
+
+#endif // !MATH_H
@@ -0,0 +1,145 @@
+#include "PrefilterSamples.h"
+
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+
+// DistributionGGX for a half vector with the given NdotH.
+static float DistributionGGX(float NdotH, float roughness)
+{
+    float a = roughness * roughness;
+    float a2 = a * a;
+    float NdotH2 = NdotH * NdotH;
+
+    float nom = a2;
+    float denom = (NdotH2 * (a2 - 1.0f) + 1.0f);
+    denom = PI * denom * denom;
+
+    return nom / denom;
+}
+
+std::vector<PrefilterSample> BuildPrefilterSamples(float roughness, int environmentMapResolution, std::uint32_t sampleCount)
+{
+    if (roughness == 0.0f)
+    {
+        return { { { 0.0f, 0.0f, 1.0f }, 0.0f } };
+    }
+
+    const float saTexel = 4.0f * PI / (6.0f * (float)environmentMapResolution * (float)environmentMapResolution);
+    const float a = roughness * roughness;
+
+    std::vector<PrefilterSample> samples;
+    samples.reserve(sampleCount);
+    for (std::uint32_t i = 0u; i < sampleCount; ++i)
+    {
+        float phi = 2.0f * PI * (float(i) / float(sampleCount));
+        float xi1 = RadicalInverse_VdC(i);
+        float cosTheta = std::sqrt((1.0f - xi1) / (1.0f + (a * a - 1.0f) * xi1));
+        float sinTheta = std::sqrt(1.0f - cosTheta * cosTheta);
+        Vec3 H = { std::cos(phi) * sinTheta, std::sin(phi) * sinTheta, cosTheta };
+
+        // L = reflect(-V, H) with V = N = +Z.
+        Vec3 L = Normalize(H * (2.0f * H.z) - Vec3{ 0.0f, 0.0f, 1.0f });
+        if (L.z <= 0.0f)
+        {
+            continue;
+        }
+
+        // NdotH and HdotV are both H.z here.
+        float NdotH = std::max(H.z, 0.0f);
+        float pdf = DistributionGGX(NdotH, roughness) * NdotH / (4.0f * NdotH) + 0.0001f;
+        float saSample = 1.0f / (float(sampleCount) * pdf + 0.0001f);
+        samples.push_back({ L, 0.5f * std::log2(saSample / saTexel) });
+    }
+    return samples;
+}
+
+Color PrefilterDirection(const CubemapImage& environmentMap, Vec3 N, const std::vector<PrefilterSample>& samples)
+{
+    Vec3 tangent, bitangent;
+    PrefilterTangentFrame(N, tangent, bitangent);
+    float totalWeight = 0.0f;
+    Color prefilteredColor = { 0.0f, 0.0f, 0.0f, 0.0f };
+    for (const PrefilterSample& sample : samples)
+    {
+        Vec3 L = tangent * sample.direction.x + bitangent * sample.direction.y + N * sample.direction.z;
+        prefilteredColor += environmentMap.SampleTrilinear(L, sample.lod) * sample.direction.z;
+        totalWeight += sample.direction.z;
+    }
+    prefilteredColor = prefilteredColor * (1.0f / totalWeight);
+    prefilteredColor.a = 1.0f;
+    return prefilteredColor;
+}
+
+std::vector<std::uint32_t> PrefilterSampleSchedule(const CubemapImage& proxy, int mipLevels, float errorTarget)
+{
+    const std::uint32_t minSamples = 16u;
+    const int probeCount = 96;
+
+    // Fibonacci sphere, so every face and the directions near the bright parts of the sky get probes.
+    std::vector<Vec3> probes(probeCount);
+    for (int i = 0; i < probeCount; i++)
+    {
+        float z = 1.0f - (2.0f * i + 1.0f) / probeCount;
+        float r = std::sqrt(1.0f - z * z);
+        float phi = 2.399963229728653f * i;
+        probes[i] = { r * std::cos(phi), r * std::sin(phi), z };
+    }
+
+    std::vector<std::uint32_t> schedule(mipLevels, maxPrefilterSamples);
+    std::vector<Color> reference(probeCount);
+    std::vector<Color> candidate(probeCount);
+    std::vector<double> probeError(probeCount);
+    std::vector<double> probeReference(probeCount);
+    for (int level = 0; level < mipLevels; level++)
+    {
+        float roughness = PrefilterRoughness(level, mipLevels);
+        if (roughness == 0.0f)
+        {
+            schedule[level] = 1u;
+            continue;
+        }
+        if (errorTarget <= 0.0f)
+        {
+            continue;
+        }
+
+        std::vector<PrefilterSample> samples = BuildPrefilterSamples(roughness, proxy.Resolution());
+        ParallelFor(probeCount, [&](int i) { reference[i] = PrefilterDirection(proxy, probes[i], samples); });
+        // Halve the count for as long as the error stays within the target. Going down from the top rather than
+        // taking the first small count that passes keeps a lucky low count from being picked.
+        for (std::uint32_t count = maxPrefilterSamples / 2; count >= minSamples; count /= 2)
+        {
+            samples = BuildPrefilterSamples(roughness, proxy.Resolution(), count);
+            ParallelFor(probeCount, [&](int i) { candidate[i] = PrefilterDirection(proxy, probes[i], samples); });
+            double squaredError = 0.0;
+            double squaredReference = 0.0;
+            for (int i = 0; i < probeCount; i++)
+            {
+                const Color& r = reference[i];
+                Color d = candidate[i] - r;
+                probeError[i] = d.r * d.r + d.g * d.g + d.b * d.b;
+                probeReference[i] = r.r * r.r + r.g * r.g + r.b * r.b;
+                squaredError += probeError[i];
+                squaredReference += probeReference[i];
+            }
+            // The probes only see part of the error, which sits mostly next to small bright lights, so test two
+            // standard errors above the measured ratio rather than the ratio itself.
+            double ratio = squaredError / squaredReference;
+            double variance = 0.0;
+            for (int i = 0; i < probeCount; i++)
+            {
+                double residual = probeError[i] - ratio * probeReference[i];
+                variance += residual * residual;
+            }
+            double standardError = std::sqrt(variance / ((double)probeCount * (probeCount - 1))) * probeCount / squaredReference;
+            if (ratio + 2.0 * standardError > (double)errorTarget * errorTarget)
+            {
+                break;
+            }
+            schedule[level] = count;
+        }
+    }
+    return schedule;
+}
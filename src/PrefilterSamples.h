@@ -0,0 +1,78 @@
+#ifndef PREFILTER_SAMPLES_H
+#define PREFILTER_SAMPLES_H
+
+#include "Cubemap.h"
+#include "Math.h"
+
+#include <cstdint>
+#include <vector>
+
+// Sample count prefilter.frag always used, and the reference the schedule measures error against.
+constexpr std::uint32_t maxPrefilterSamples = 4096u;
+
+// The sample schedule is measured on the environment mip closest to this size rather than the full cube.
+constexpr int prefilterProxyResolution = 128;
+
+inline int PrefilterProxyLevel(int resolution, int mipLevels)
+{
+    int level = 0;
+    while ((resolution >> level) > prefilterProxyResolution && level + 1 < mipLevels)
+    {
+        level++;
+    }
+    return level;
+}
+
+// Van der Corpus sequence, the second Hammersley coordinate of the shaders.
+inline float RadicalInverse_VdC(std::uint32_t bits)
+{
+    bits = (bits << 16u) | (bits >> 16u);
+    bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+    bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+    bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+    bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+    return float(bits) * 2.3283064365386963e-10f; // / 0x100000000
+}
+
+// One GGX importance sample of the prefilter in the tangent frame of the texel being filtered. The prefilter
+// assumes N = V = R, so with N = +Z nothing about a sample depends on the texel.
+struct PrefilterSample
+{
+    Vec3 direction; // L, unit length. direction.z is NdotL, which is also the sample's weight.
+    float lod;      // Source mip level the sample is fetched from.
+};
+static_assert(sizeof(PrefilterSample) == 16, "PrefilterSample is uploaded as a std430 vec4");
+
+// The Hammersley/GGX samples prefilter.frag used to generate per texel, for one roughness and source cube
+// resolution. Samples below the horizon (zero weight) are left out, and at roughness 0 the single mirror
+// direction stands in for all of them.
+std::vector<PrefilterSample> BuildPrefilterSamples(float roughness, int environmentMapResolution,
+    std::uint32_t sampleCount = maxPrefilterSamples);
+
+// The tangent frame prefilter.frag builds around N. A sample's world direction is
+// tangent * direction.x + bitangent * direction.y + N * direction.z.
+inline void PrefilterTangentFrame(Vec3 N, Vec3& tangent, Vec3& bitangent)
+{
+    Vec3 up = std::abs(N.z) < 0.999f ? Vec3{ 0.0f, 0.0f, 1.0f } : Vec3{ 1.0f, 0.0f, 0.0f };
+    tangent = Normalize(Cross(up, N));
+    bitangent = Cross(N, tangent);
+}
+
+// Prefiltered color around N, the body of prefilter.frag.
+Color PrefilterDirection(const CubemapImage& environmentMap, Vec3 N, const std::vector<PrefilterSample>& samples);
+
+// Roughness of each prefilter mip, increasing linearly from 0 at mip 0 to 1 at the last one.
+inline float PrefilterRoughness(int level, int mipLevels)
+{
+    return mipLevels > 1 ? (float)level / (float)(mipLevels - 1) : 0.0f;
+}
+
+// Sample count for each of mipLevels prefilter mips: the smallest power of two whose result stays within
+// errorTarget of the maxPrefilterSamples result, as RMS error over RMS value. That ratio is estimated on a fixed
+// set of probe directions and must hold with a margin of two standard errors of the estimate, so that it also
+// holds over every texel of the mip. proxy is the environment from PrefilterProxyLevel on down. Fewer samples are fetched from blurrier
+// mips, so the error this allows is mostly extra blur rather than noise. errorTarget <= 0 keeps
+// maxPrefilterSamples for every mip. Roughness 0 always gets the single mirror sample.
+std::vector<std::uint32_t> PrefilterSampleSchedule(const CubemapImage& proxy, int mipLevels, float errorTarget);
+
+#endif // !PREFILTER_SAMPLES_H
@@ -0,0 +1,340 @@
+#include "RadianceReader.h"
+
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define IBL_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// Scanlines decoded per ReadImage task.
+static const int rowsPerTask = 16;
+
+// Largest encoding of a scanline: a flat one at widths without run length encoding, otherwise the run length
+// header plus single texel runs of two bytes each.
+static size_t MaxScanlineBytes(int width)
+{
+    return (size_t)width * 8 + 4;
+}
+
+// Decodes the scanline at data into planes, or only measures it when planes is null. Returns the bytes it
+// takes, 0 if it is malformed or runs past size.
+static size_t DecodeScanline(const std::uint8_t* data, size_t size, int width, std::uint8_t* planes)
+{
+    // Run length encoding only exists for widths that fit its 15 bit length field, and a scanline not starting
+    // with its marker is flat: interleaved RGBE texels.
+    if (width < 8 || width >= 32768 || size < 4 || data[0] != 2 || data[1] != 2 || (data[2] & 0x80))
+    {
+        size_t bytes = (size_t)width * 4;
+        if (size < bytes)
+        {
+            return 0;
+        }
+        if (planes)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                for (int c = 0; c < 4; c++)
+                {
+                    planes[(size_t)c * width + x] = data[(size_t)x * 4 + c];
+                }
+            }
+        }
+        return bytes;
+    }
+    if (((data[2] << 8) | data[3]) != width)
+    {
+        return 0;
+    }
+
+    // Each channel is stored separately as runs and literal spans.
+    const std::uint8_t* position = data + 4;
+    const std::uint8_t* end = data + size;
+    for (int c = 0; c < 4; c++)
+    {
+        std::uint8_t* plane = planes ? planes + (size_t)c * width : nullptr;
+        int x = 0;
+        while (x < width)
+        {
+            if (position == end)
+            {
+                return 0;
+            }
+            int count = *position++;
+            if (count > 128)
+            {
+                count -= 128;
+                if (position == end || count > width - x)
+                {
+                    return 0;
+                }
+                if (plane)
+                {
+                    std::memset(plane + x, *position, count);
+                }
+                position++;
+            }
+            else
+            {
+                if (count == 0 || count > width - x || end - position < count)
+                {
+                    return 0;
+                }
+                if (plane)
+                {
+                    std::memcpy(plane + x, position, count);
+                }
+                position += count;
+            }
+            x += count;
+        }
+    }
+    return position - data;
+}
+
+// RGBE planes to RGB floats, texel * 2^(exponent - 136) like stbi_loadf.
+static void ConvertScanline(const std::uint8_t* planes, int width, float maxRadiance, float* rgb)
+{
+    const std::uint8_t* red = planes;
+    const std::uint8_t* green = planes + width;
+    const std::uint8_t* blue = planes + (size_t)width * 2;
+    const std::uint8_t* exponent = planes + (size_t)width * 3;
+    int x = 0;
+#ifdef IBL_SSE2
+    // Without a limit the clamp is a no-op: decoded values are never negative.
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 limit = _mm_set1_ps(maxRadiance > 0.0f ? maxRadiance : std::numeric_limits<float>::infinity());
+    auto widen = [](const std::uint8_t* bytes)
+    {
+        std::int32_t packed;
+        std::memcpy(&packed, bytes, sizeof(packed));
+        __m128i value = _mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), _mm_setzero_si128());
+        return _mm_unpacklo_epi16(value, _mm_setzero_si128());
+    };
+    for (; x + 4 <= width; x += 4)
+    {
+        // The scale is built as two powers of two, 2^((e >> 1) - 68) * 2^((e - (e >> 1)) - 68), that are normal
+        // floats for every exponent byte, where 2^(e - 136) itself would be denormal for small ones. Both products
+        // are exact, so the result matches ldexp bit for bit.
+        __m128i e = widen(exponent + x);
+        __m128i low = _mm_srli_epi32(e, 1);
+        __m128i high = _mm_sub_epi32(e, low);
+        __m128 scaleLow = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(low, _mm_set1_epi32(127 - 68)), 23));
+        __m128 scaleHigh = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(high, _mm_set1_epi32(127 - 68)), 23));
+        __m128 nonzero = _mm_castsi128_ps(_mm_cmpgt_epi32(e, _mm_setzero_si128()));
+        auto channel = [&](const std::uint8_t* bytes)
+        {
+            __m128 value = _mm_mul_ps(_mm_mul_ps(_mm_cvtepi32_ps(widen(bytes + x)), scaleLow), scaleHigh);
+            return _mm_min_ps(_mm_max_ps(_mm_and_ps(value, nonzero), zero), limit);
+        };
+        __m128 texel0 = channel(red);
+        __m128 texel1 = channel(green);
+        __m128 texel2 = channel(blue);
+        __m128 texel3 = zero;
+        _MM_TRANSPOSE4_PS(texel0, texel1, texel2, texel3);
+        // Each store spills one float into the next texel, which the following store overwrites; the last
+        // texel is stored as exactly three floats.
+        float* destination = rgb + (size_t)x * 3;
+        _mm_storeu_ps(destination, texel0);
+        _mm_storeu_ps(destination + 3, texel1);
+        _mm_storeu_ps(destination + 6, texel2);
+        _mm_storel_pi((__m64*)(destination + 9), texel3);
+        _mm_store_ss(destination + 11, _mm_movehl_ps(texel3, texel3));
+    }
+#endif
+    for (; x < width; x++)
+    {
+        float scale = exponent[x] != 0 ? (float)std::ldexp(1.0f, exponent[x] - (int)(128 + 8)) : 0.0f;
+        const std::uint8_t* channels[3] = { red, green, blue };
+        for (int c = 0; c < 3; c++)
+        {
+            float value = channels[c][x] * scale;
+            rgb[(size_t)x * 3 + c] = maxRadiance > 0.0f ? std::clamp(value, 0.0f, maxRadiance) : value;
+        }
+    }
+}
+
+RadianceReader::~RadianceReader()
+{
+    if (file)
+    {
+        std::fclose(file);
+    }
+}
+
+bool RadianceReader::Open(const char* path)
+{
+    file = std::fopen(path, "rb");
+    std::error_code error;
+    fileSize = std::filesystem::file_size(path, error);
+    if (!file || error)
+    {
+        return false;
+    }
+    buffer.resize(1 << 20);
+
+    char line[256];
+    if (!ReadLine(line, sizeof(line)) || (std::strcmp(line, "#?RADIANCE") != 0 && std::strcmp(line, "#?RGBE") != 0))
+    {
+        return false;
+    }
+
+    bool rgbe = false;
+    for (;;)
+    {
+        if (!ReadLine(line, sizeof(line)))
+        {
+            return false;
+        }
+        if (line[0] == 0)
+        {
+            break;
+        }
+        if (std::strcmp(line, "FORMAT=32-bit_rle_rgbe") == 0)
+        {
+            rgbe = true;
+        }
+    }
+
+    char* token = line;
+    if (!rgbe || !ReadLine(line, sizeof(line)) || std::strncmp(token, "-Y ", 3) != 0)
+    {
+        return false;
+    }
+    height = (int)std::strtol(token + 3, &token, 10);
+    while (*token == ' ')
+    {
+        token++;
+    }
+    if (std::strncmp(token, "+X ", 3) != 0)
+    {
+        return false;
+    }
+    width = (int)std::strtol(token + 3, nullptr, 10);
+    if (width <= 0 || height <= 0)
+    {
+        return false;
+    }
+
+    // Room for any single scanline, so that ReadScanlines can decode each one from the buffer in one go.
+    if (buffer.size() < MaxScanlineBytes(width))
+    {
+        buffer.resize(MaxScanlineBytes(width));
+    }
+    planes.resize((size_t)width * 4);
+    return true;
+}
+
+bool RadianceReader::ReadScanlines(int count, float maxRadiance, float* rgb)
+{
+    for (int row = 0; row < count; row++)
+    {
+        size_t available = Fill(MaxScanlineBytes(width));
+        size_t size = DecodeScanline(&buffer[bufferPosition], available, width, planes.data());
+        if (size == 0)
+        {
+            return false;
+        }
+        bufferPosition += size;
+        ConvertScanline(planes.data(), width, maxRadiance, rgb + (size_t)row * width * 3);
+    }
+    return true;
+}
+
+bool RadianceReader::ReadImage(float maxRadiance, float* rgb)
+{
+    // Whatever is buffered, then the rest of the file.
+    size_t buffered = bufferSize - bufferPosition;
+    std::vector<std::uint8_t> data(buffered + (size_t)(fileSize - fileBytesRead));
+    std::memcpy(data.data(), &buffer[bufferPosition], buffered);
+    bufferPosition = bufferSize;
+    data.resize(buffered + std::fread(data.data() + buffered, 1, data.size() - buffered, file));
+
+    // Scanlines have no index, so walk the run headers once to find where each starts. That touches a byte per
+    // run instead of decoding, and leaves the decoding itself free to run in parallel.
+    std::vector<size_t> starts(height);
+    size_t offset = 0;
+    for (int row = 0; row < height; row++)
+    {
+        size_t size = DecodeScanline(data.data() + offset, data.size() - offset, width, nullptr);
+        if (size == 0)
+        {
+            return false;
+        }
+        starts[row] = offset;
+        offset += size;
+    }
+
+    ParallelFor((height + rowsPerTask - 1) / rowsPerTask, [&](int task)
+    {
+        std::vector<std::uint8_t> taskPlanes((size_t)width * 4);
+        for (int row = task * rowsPerTask; row < std::min((task + 1) * rowsPerTask, height); row++)
+        {
+            DecodeScanline(data.data() + starts[row], data.size() - starts[row], width, taskPlanes.data());
+            ConvertScanline(taskPlanes.data(), width, maxRadiance, rgb + (size_t)(height - 1 - row) * width * 3);
+        }
+    });
+    return true;
+}
+
+size_t RadianceReader::Fill(size_t count)
+{
+    size_t available = bufferSize - bufferPosition;
+    if (available < count)
+    {
+        std::memmove(buffer.data(), buffer.data() + bufferPosition, available);
+        bufferPosition = 0;
+        bufferSize = available;
+        while (bufferSize < buffer.size())
+        {
+            size_t read = std::fread(buffer.data() + bufferSize, 1, buffer.size() - bufferSize, file);
+            if (read == 0)
+            {
+                break;
+            }
+            bufferSize += read;
+            fileBytesRead += read;
+        }
+        available = bufferSize;
+    }
+    return std::min(available, count);
+}
+
+int RadianceReader::ReadByte()
+{
+    if (Fill(1) == 0)
+    {
+        return -1;
+    }
+    return buffer[bufferPosition++];
+}
+
+bool RadianceReader::ReadLine(char* line, int capacity)
+{
+    int length = 0;
+    for (;;)
+    {
+        int c = ReadByte();
+        if (c < 0)
+        {
+            return false;
+        }
+        if (c == '\n')
+        {
+            break;
+        }
+        if (length < capacity - 1)
+        {
+            line[length++] = (char)c;
+        }
+    }
+    line[length] = 0;
+    return true;
+}
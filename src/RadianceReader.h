@@ -0,0 +1,55 @@
+#ifndef RADIANCE_READER_H
+#define RADIANCE_READER_H
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+// Decoder for Radiance RGBE (.hdr) files. ReadScanlines decodes incrementally, for inputs too large to hold as a
+// float image; ReadImage decodes the whole image at once with scanlines spread over the thread pool. Either way
+// a scanline is run length decoded into one plane per channel and converted with SSE2 where available, giving
+// exactly the floats stbi_loadf does. Only the standard "-Y height +X width" layout is supported, which is what
+// capture and stitching tools write.
+class RadianceReader
+{
+public:
+    RadianceReader() = default;
+    ~RadianceReader();
+
+    RadianceReader(const RadianceReader&) = delete;
+    RadianceReader& operator=(const RadianceReader&) = delete;
+
+    // Parses the header. Fails quietly for files that are not Radiance, so callers can fall back to stb_image.
+    bool Open(const char* path);
+
+    int Width() const { return width; }
+    int Height() const { return height; }
+
+    // Decodes the next count scanlines into rgb (3 floats per pixel), top to bottom as stored, clamping every
+    // channel to [0, maxRadiance] when maxRadiance > 0.
+    bool ReadScanlines(int count, float maxRadiance, float* rgb);
+
+    // Decodes every scanline into rgb like ReadScanlines, but bottom row first like HdrImage. Must directly
+    // follow Open. Reads the rest of the file into memory, finds where each scanline starts and then decodes
+    // them in parallel.
+    bool ReadImage(float maxRadiance, float* rgb);
+private:
+    // Makes at least count bytes available from bufferPosition, fewer only at the end of the file.
+    size_t Fill(size_t count);
+    int ReadByte();
+    bool ReadLine(char* line, int capacity);
+
+    std::FILE* file = nullptr;
+    std::uint64_t fileSize = 0;
+    std::uint64_t fileBytesRead = 0;
+    int width = 0;
+    int height = 0;
+
+    std::vector<std::uint8_t> buffer;
+    size_t bufferPosition = 0;
+    size_t bufferSize = 0;
+
+    std::vector<std::uint8_t> planes; // width bytes each of R, G, B and E
+};
+
+#endif // !RADIANCE_READER_H
@@ -63,6 +63,42 @@ Shader::Shader(const char * vertexPath, const char * fragmentPath)
 	use();
 }
 
+Shader::Shader(const char* computePath)
+{
+	static const std::string version = "#version 430 core\n";
+
+	unsigned int computeShader = glCreateShader(GL_COMPUTE_SHADER);
+
+	auto computeSource = get_file_contents(computePath);
+	const char* cShaderSources[2] = { version.c_str(), computeSource.c_str() };
+	glShaderSource(computeShader, 2, cShaderSources, NULL);
+	glCompileShader(computeShader);
+
+	int success;
+	char infoLog[512];
+	glGetShaderiv(computeShader, GL_COMPILE_STATUS, &success);
+	if (!success)
+	{
+		glGetShaderInfoLog(computeShader, sizeof(infoLog), NULL, infoLog);
+		std::cout << "Error compiling compute shader '" << computePath << "'\n" << infoLog << std::endl;
+	}
+
+	id = glCreateProgram();
+	glAttachShader(id, computeShader);
+	glLinkProgram(id);
+
+	glGetProgramiv(id, GL_LINK_STATUS, &success);
+	if (!success)
+	{
+		glGetProgramInfoLog(id, sizeof(infoLog), NULL, infoLog);
+		std::cout << "Error linking compute program '" << computePath << "'\n" << infoLog << std::endl;
+	}
+
+	glDeleteShader(computeShader);
+
+	use();
+}
+
 void Shader::use()
 {
 	glUseProgram(id);
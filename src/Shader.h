@@ -14,6 +14,8 @@ class Shader
 public:
 	unsigned int id;
 	Shader(const char* vertexPath, const char* fragmentPath);
+	// Compute program
+	explicit Shader(const char* computePath);
 
 	void use();
 
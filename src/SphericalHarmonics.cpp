@@ -0,0 +1,172 @@
+#include "SphericalHarmonics.h"
+
+#include "ThreadPool.h"
+
+#include <fstream>
+
+void EvaluateSH(Vec3 dir, int bands, float* basis)
+{
+    // cos(m phi) sin^m(theta) and sin(m phi) sin^m(theta) as the real and imaginary parts of (x + iy)^m,
+    // which leaves only polynomials in z for the associated Legendre part.
+    float cosTerms[maxShBands];
+    float sinTerms[maxShBands];
+    cosTerms[0] = 1.0f;
+    sinTerms[0] = 0.0f;
+    for (int m = 1; m < bands; m++)
+    {
+        cosTerms[m] = dir.x * cosTerms[m - 1] - dir.y * sinTerms[m - 1];
+        sinTerms[m] = dir.x * sinTerms[m - 1] + dir.y * cosTerms[m - 1];
+    }
+
+    double factorial[2 * maxShBands];
+    factorial[0] = 1.0;
+    for (int i = 1; i < 2 * maxShBands; i++)
+    {
+        factorial[i] = factorial[i - 1] * i;
+    }
+
+    const float sqrt2 = 1.41421356237f;
+    float z = dir.z;
+    for (int m = 0; m < bands; m++)
+    {
+        // Legendre recurrence in l for fixed m, with the (1 - z^2)^(m/2) factor already folded into the xy terms.
+        float pmm = 1.0f;
+        for (int i = 1; i <= m; i++)
+        {
+            pmm *= (float)(2 * i - 1);
+        }
+        float previous = 0.0f;
+        float current = pmm;
+        for (int l = m; l < bands; l++)
+        {
+            if (l == m + 1)
+            {
+                previous = current;
+                current = z * (2 * m + 1) * pmm;
+            }
+            else if (l > m + 1)
+            {
+                float next = (z * (2 * l - 1) * current - (l + m - 1) * previous) / (l - m);
+                previous = current;
+                current = next;
+            }
+
+            float k = (float)std::sqrt((2 * l + 1) / (4.0 * PI) * factorial[l - m] / factorial[l + m]);
+            int center = l * (l + 1);
+            if (m == 0)
+            {
+                basis[center] = k * current;
+            }
+            else
+            {
+                basis[center + m] = sqrt2 * k * cosTerms[m] * current;
+                basis[center - m] = sqrt2 * k * sinTerms[m] * current;
+            }
+        }
+    }
+}
+
+static float AreaElement(float x, float y)
+{
+    return std::atan2(x * y, std::sqrt(x * x + y * y + 1.0f));
+}
+
+ShCoefficients ProjectToSH(const CubemapImage& cubemap, int level, int bands)
+{
+    int coefficientCount = bands * bands;
+    int mipRes = cubemap.MipResolution(level);
+
+    // One partial sum per row keeps the reduction order, and so the result, independent of the thread count.
+    std::vector<Color> rowSums((size_t)6 * mipRes * coefficientCount, Color{ 0.0f, 0.0f, 0.0f, 0.0f });
+    ParallelFor(6 * mipRes, [&](int row)
+    {
+        int face = row / mipRes;
+        int y = row % mipRes;
+        const Color* texels = cubemap.Face(level, face) + y * mipRes;
+        Color* sums = &rowSums[(size_t)row * coefficientCount];
+        float basis[maxShBands * maxShBands];
+
+        float t0 = 2.0f * y / mipRes - 1.0f;
+        float t1 = 2.0f * (y + 1) / mipRes - 1.0f;
+        for (int x = 0; x < mipRes; x++)
+        {
+            float s0 = 2.0f * x / mipRes - 1.0f;
+            float s1 = 2.0f * (x + 1) / mipRes - 1.0f;
+            float solidAngle = AreaElement(s0, t0) - AreaElement(s0, t1) - AreaElement(s1, t0) + AreaElement(s1, t1);
+
+            EvaluateSH(Normalize(CubeTexelDirection(face, x, y, mipRes)), bands, basis);
+            for (int i = 0; i < coefficientCount; i++)
+            {
+                sums[i] += texels[x] * (basis[i] * solidAngle);
+            }
+        }
+    });
+
+    ShCoefficients sh;
+    sh.bands = bands;
+    sh.coefficients.assign(coefficientCount, Color{ 0.0f, 0.0f, 0.0f, 0.0f });
+    for (int row = 0; row < 6 * mipRes; row++)
+    {
+        for (int i = 0; i < coefficientCount; i++)
+        {
+            sh.coefficients[i] += rowSums[(size_t)row * coefficientCount + i];
+        }
+    }
+    return sh;
+}
+
+ShCoefficients RadianceToIrradianceSH(const ShCoefficients& radiance)
+{
+    // Clamped cosine lobe in SH (Ramamoorthi and Hanrahan): pi, 2pi/3, pi/4, 0, -pi/24 for bands 0 to 4.
+    const float cosineLobe[maxShBands] = { PI, 2.0f * PI / 3.0f, PI / 4.0f, 0.0f, -PI / 24.0f };
+
+    ShCoefficients irradiance = radiance;
+    for (int l = 0; l < radiance.bands; l++)
+    {
+        for (int m = -l; m <= l; m++)
+        {
+            irradiance.coefficients[l * (l + 1) + m] = radiance.coefficients[l * (l + 1) + m] * (cosineLobe[l] / PI);
+        }
+    }
+    return irradiance;
+}
+
+void ReconstructFromSH(const ShCoefficients& sh, CubemapImage& cubemap)
+{
+    int resolution = cubemap.Resolution();
+    int coefficientCount = sh.bands * sh.bands;
+    ParallelFor(6 * resolution, [&](int row)
+    {
+        int face = row / resolution;
+        int y = row % resolution;
+        Color* destination = cubemap.Face(0, face) + y * resolution;
+        float basis[maxShBands * maxShBands];
+        for (int x = 0; x < resolution; x++)
+        {
+            EvaluateSH(Normalize(CubeTexelDirection(face, x, y, resolution)), sh.bands, basis);
+            Color sum = { 0.0f, 0.0f, 0.0f, 0.0f };
+            for (int i = 0; i < coefficientCount; i++)
+            {
+                sum += sh.coefficients[i] * basis[i];
+            }
+            // Low band counts ring below zero opposite bright sources; BC6H is unsigned.
+            destination[x] = { std::max(sum.r, 0.0f), std::max(sum.g, 0.0f), std::max(sum.b, 0.0f), 1.0f };
+        }
+    });
+    cubemap.QuantizeToHalf(0);
+}
+
+std::uint64_t WriteShFile(const ShCoefficients& sh, const std::string& file_path)
+{
+    ShFile shFile;
+    shFile.header.bands = sh.bands;
+    for (const Color& coefficient : sh.coefficients)
+    {
+        shFile.coefficients.insert(shFile.coefficients.end(), { coefficient.r, coefficient.g, coefficient.b });
+    }
+
+    std::ofstream file(file_path, std::ios::binary);
+    file.write((const char*)&shFile.header, sizeof(ShFile::Header));
+    file.write((const char*)shFile.coefficients.data(), shFile.coefficients.size() * sizeof(float));
+    return file ? sizeof(ShFile::Header) + shFile.coefficients.size() * sizeof(float) : 0;
+}
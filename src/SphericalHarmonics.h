@@ -0,0 +1,60 @@
+#ifndef SPHERICAL_HARMONICS_H
+#define SPHERICAL_HARMONICS_H
+
+#include "Cubemap.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Real spherical harmonics up to band 4 (25 coefficients), no Condon-Shortley phase, indexed l * (l + 1) + m.
+constexpr int maxShBands = 5;
+
+// Projection reads the environment mip closest to this size; band 4 needs nowhere near more texels than this.
+constexpr int shSourceResolution = 64;
+
+inline int ShSourceLevel(int resolution, int mipLevels)
+{
+    int level = 0;
+    while ((resolution >> level) > shSourceResolution && level + 1 < mipLevels)
+    {
+        level++;
+    }
+    return level;
+}
+
+struct ShCoefficients
+{
+    int bands = 0;
+    std::vector<Color> coefficients; // bands * bands entries, alpha unused
+};
+
+void EvaluateSH(Vec3 dir, int bands, float* basis);
+
+// Integrates the given level of a cube map against the SH basis, weighting every texel by its solid angle.
+ShCoefficients ProjectToSH(const CubemapImage& cubemap, int level, int bands);
+
+// Convolves radiance coefficients with the clamped cosine lobe and divides by pi, so that evaluating the result
+// gives the same quantity convolute.frag writes (irradiance / pi).
+ShCoefficients RadianceToIrradianceSH(const ShCoefficients& radiance);
+
+// Evaluates coefficients at every texel center of mip 0.
+void ReconstructFromSH(const ShCoefficients& sh, CubemapImage& cubemap);
+
+struct ShFile
+{
+    // "SHIR" in file byte order.
+    static constexpr std::uint32_t correctMagicNumber = ('R' << 24) | ('I' << 16) | ('H' << 8) | 'S';
+    struct Header
+    {
+        std::uint32_t magicNumber = correctMagicNumber;
+        std::uint32_t bands;
+    };
+    Header header;
+    std::vector<float> coefficients; // RGB triplets, bands * bands of them
+};
+
+// Returns the number of bytes written, 0 if the file couldn't be written.
+std::uint64_t WriteShFile(const ShCoefficients& sh, const std::string& file_path);
+
+#endif // !SPHERICAL_HARMONICS_H
@@ -0,0 +1,191 @@
+#include "Supercompression.h"
+
+#include <algorithm>
+#include <bit>
+
+// Byte-wise renormalized rANS after Fabian Giesen's rans_byte: the state stays in [ransLow, ransLow << 8) and
+// moves a byte at a time. The encoder runs backwards so the decoder reads the stream front to back. Consecutive
+// bytes go to different states, which share the byte stream, so the decoder has independent dependency chains
+// to overlap.
+static const std::uint32_t ransLow = 1u << 23;
+static const int interleave = 4;
+static const std::uint32_t probabilityScale = 1u << RansModel::probabilityBits;
+
+void RansModel::Build(const std::uint8_t* data, std::size_t size, int contextCount)
+{
+    this->contextCount = std::bit_floor((unsigned int)std::clamp(contextCount, 1, maxContexts));
+    contexts.assign(this->contextCount, Context());
+
+    std::vector<std::uint64_t> counts((size_t)this->contextCount * 256, 0);
+    for (std::size_t i = 0; i < size; i++)
+    {
+        counts[(i % this->contextCount) * 256 + data[i]]++;
+    }
+
+    for (int c = 0; c < this->contextCount; c++)
+    {
+        std::uint64_t* count = &counts[(size_t)c * 256];
+        std::uint16_t* frequency = contexts[c].frequency;
+        std::uint64_t total = 0;
+        for (int s = 0; s < 256; s++)
+        {
+            total += count[s];
+        }
+        if (total == 0)
+        {
+            // Never used; any valid distribution will do.
+            std::fill(frequency, frequency + 256, (std::uint16_t)(probabilityScale / 256));
+            continue;
+        }
+
+        // Scale to the probability range keeping every seen symbol codable, then hand the rounding error to
+        // (or take it from) the most frequent symbols, where it costs the least.
+        std::uint32_t sum = 0;
+        for (int s = 0; s < 256; s++)
+        {
+            frequency[s] = count[s] == 0 ? 0 : (std::uint16_t)std::max<std::uint64_t>(1, count[s] * probabilityScale / total);
+            sum += frequency[s];
+        }
+        while (sum != probabilityScale)
+        {
+            int largest = (int)(std::max_element(frequency, frequency + 256) - frequency);
+            if (sum < probabilityScale)
+            {
+                frequency[largest] += (std::uint16_t)(probabilityScale - sum);
+                sum = probabilityScale;
+            }
+            else
+            {
+                std::uint32_t take = std::min<std::uint32_t>(sum - probabilityScale, frequency[largest] - 1u);
+                if (take == 0)
+                {
+                    break;
+                }
+                frequency[largest] -= (std::uint16_t)take;
+                sum -= take;
+            }
+        }
+    }
+    Finalize();
+}
+
+bool RansModel::Finalize()
+{
+    for (Context& context : contexts)
+    {
+        std::uint32_t start = 0;
+        for (int s = 0; s < 256; s++)
+        {
+            context.start[s] = (std::uint16_t)start;
+            if (start + context.frequency[s] > probabilityScale)
+            {
+                return false;
+            }
+            std::fill(context.symbol + start, context.symbol + start + context.frequency[s], (std::uint8_t)s);
+            start += context.frequency[s];
+        }
+        if (start != probabilityScale)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void RansModel::Serialize(std::uint8_t* destination) const
+{
+    for (const Context& context : contexts)
+    {
+        for (int s = 0; s < 256; s++)
+        {
+            *destination++ = (std::uint8_t)(context.frequency[s] & 0xFF);
+            *destination++ = (std::uint8_t)(context.frequency[s] >> 8);
+        }
+    }
+}
+
+bool RansModel::Deserialize(const std::uint8_t* data, std::size_t size, int contextCount)
+{
+    if (contextCount < 1 || contextCount > maxContexts || !std::has_single_bit((unsigned int)contextCount)
+        || size < (std::size_t)contextCount * 256 * 2)
+    {
+        return false;
+    }
+    this->contextCount = contextCount;
+    contexts.assign(contextCount, Context());
+    for (Context& context : contexts)
+    {
+        for (int s = 0; s < 256; s++)
+        {
+            context.frequency[s] = (std::uint16_t)(data[0] | data[1] << 8);
+            data += 2;
+        }
+    }
+    return Finalize();
+}
+
+std::vector<std::uint8_t> RansModel::Encode(const std::uint8_t* data, std::size_t size) const
+{
+    // Bytes are produced last to first, so collect them reversed and flip at the end.
+    std::vector<std::uint8_t> reversed;
+    reversed.reserve(size + 4 * interleave);
+    std::uint32_t states[interleave];
+    std::fill(states, states + interleave, ransLow);
+    std::size_t contextMask = contextCount - 1;
+    for (std::size_t i = size; i-- > 0;)
+    {
+        const Context& context = contexts[i & contextMask];
+        std::uint32_t& state = states[i % interleave];
+        std::uint32_t frequency = context.frequency[data[i]];
+        std::uint32_t limit = ((ransLow >> RansModel::probabilityBits) << 8) * frequency;
+        while (state >= limit)
+        {
+            reversed.push_back((std::uint8_t)(state & 0xFF));
+            state >>= 8;
+        }
+        state = ((state / frequency) << RansModel::probabilityBits) + (state % frequency) + context.start[data[i]];
+    }
+    for (int j = interleave - 1; j >= 0; j--)
+    {
+        for (int shift = 24; shift >= 0; shift -= 8)
+        {
+            reversed.push_back((std::uint8_t)(states[j] >> shift));
+        }
+    }
+    return std::vector<std::uint8_t>(reversed.rbegin(), reversed.rend());
+}
+
+bool RansModel::Decode(const std::uint8_t* data, std::size_t size, std::uint8_t* destination, std::size_t destinationSize) const
+{
+    if (size < 4 * interleave)
+    {
+        return false;
+    }
+    const std::uint8_t* end = data + size;
+    std::uint32_t states[interleave];
+    for (int j = 0; j < interleave; j++)
+    {
+        states[j] = data[0] | data[1] << 8 | data[2] << 16 | (std::uint32_t)data[3] << 24;
+        data += 4;
+    }
+    std::uint32_t mask = probabilityScale - 1;
+    std::size_t contextMask = contextCount - 1;
+    for (std::size_t i = 0; i < destinationSize; i++)
+    {
+        const Context& context = contexts[i & contextMask];
+        std::uint32_t& state = states[i % interleave];
+        std::uint8_t symbol = context.symbol[state & mask];
+        destination[i] = symbol;
+        state = context.frequency[symbol] * (state >> RansModel::probabilityBits) + (state & mask) - context.start[symbol];
+        while (state < ransLow)
+        {
+            if (data == end)
+            {
+                return false;
+            }
+            state = state << 8 | *data++;
+        }
+    }
+    // A well formed stream ends exactly where the encoder started, every state back at its initial value.
+    return data == end && std::all_of(states, states + interleave, [](std::uint32_t state) { return state == ransLow; });
+}
@@ -0,0 +1,47 @@
+#ifndef SUPERCOMPRESSION_H
+#define SUPERCOMPRESSION_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Static order-0 rANS model for GPU texture payloads. Byte i of a payload is coded with the frequencies of
+// context i % contextCount, contextCount being the block (or texel) size and a power of two, so each byte
+// position of a BC6H block (mode and endpoint bits, partition bits, indices) gets statistics of its own. One
+// model covers a whole file and every chunk coded with it can be decoded on its own.
+class RansModel
+{
+public:
+    static constexpr int probabilityBits = 12;
+    static constexpr int maxContexts = 16;
+
+    // Counts the bytes of data and normalizes the counts of every context to 1 << probabilityBits. contextCount
+    // is rounded down to a power of two.
+    void Build(const std::uint8_t* data, std::size_t size, int contextCount);
+
+    int ContextCount() const { return contextCount; }
+
+    // contextCount * 256 little endian uint16 frequencies.
+    std::size_t SerializedSize() const { return (std::size_t)contextCount * 256 * 2; }
+    void Serialize(std::uint8_t* destination) const;
+    bool Deserialize(const std::uint8_t* data, std::size_t size, int contextCount);
+
+    // Codes size bytes, which must only contain symbols seen by Build, into a self-contained stream.
+    std::vector<std::uint8_t> Encode(const std::uint8_t* data, std::size_t size) const;
+    // Decodes exactly destinationSize bytes. False if the stream is truncated or corrupt.
+    bool Decode(const std::uint8_t* data, std::size_t size, std::uint8_t* destination, std::size_t destinationSize) const;
+private:
+    struct Context
+    {
+        std::uint16_t frequency[256];
+        std::uint16_t start[256];
+        std::uint8_t symbol[1 << probabilityBits]; // slot to symbol, for decoding
+    };
+
+    bool Finalize();
+
+    int contextCount = 0;
+    std::vector<Context> contexts;
+};
+
+#endif // !SUPERCOMPRESSION_H
@@ -0,0 +1,120 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <atomic>
+
+static unsigned int globalThreadCount = 0;
+
+ThreadPool::ThreadPool(unsigned int threadCount)
+{
+    if (threadCount == 0)
+    {
+        threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    workers.reserve(threadCount);
+    for (unsigned int i = 0; i < threadCount; i++)
+    {
+        workers.emplace_back([this] { WorkerLoop(); });
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    taskAvailable.notify_all();
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+}
+
+void ThreadPool::Submit(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push_back(std::move(task));
+    }
+    taskAvailable.notify_one();
+}
+
+ThreadPool& ThreadPool::Global()
+{
+    static ThreadPool pool(globalThreadCount);
+    return pool;
+}
+
+void ThreadPool::SetGlobalThreadCount(unsigned int threadCount)
+{
+    globalThreadCount = threadCount;
+}
+
+void ThreadPool::WorkerLoop()
+{
+    while (true)
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            taskAvailable.wait(lock, [this] { return stopping || !tasks.empty(); });
+            if (tasks.empty())
+            {
+                return;
+            }
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        task();
+    }
+}
+
+void TaskGroup::Run(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending++;
+    }
+    pool.Submit([this, task = std::move(task)]
+    {
+        task();
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--pending == 0)
+        {
+            finished.notify_all();
+        }
+    });
+}
+
+void TaskGroup::Wait()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [this] { return pending == 0; });
+}
+
+void ParallelFor(int count, const std::function<void(int)>& body)
+{
+    if (count <= 0)
+    {
+        return;
+    }
+
+    ThreadPool& pool = ThreadPool::Global();
+    std::atomic<int> next = 0;
+    auto worker = [&]
+    {
+        for (int i = next++; i < count; i = next++)
+        {
+            body(i);
+        }
+    };
+
+    TaskGroup group(pool);
+    int helpers = std::min((int)pool.ThreadCount(), count);
+    for (int i = 0; i < helpers; i++)
+    {
+        group.Run(worker);
+    }
+    group.Wait();
+}
@@ -0,0 +1,55 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+    explicit ThreadPool(unsigned int threadCount);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void Submit(std::function<void()> task);
+    unsigned int ThreadCount() const { return (unsigned int)workers.size(); }
+
+    // Process wide pool used by the CPU stages. Size it with SetGlobalThreadCount before first use.
+    static ThreadPool& Global();
+    static void SetGlobalThreadCount(unsigned int threadCount);
+private:
+    void WorkerLoop();
+
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable taskAvailable;
+    bool stopping = false;
+};
+
+// Tracks a batch of tasks submitted to a pool so the submitting thread can wait for just those.
+class TaskGroup
+{
+public:
+    explicit TaskGroup(ThreadPool& pool = ThreadPool::Global()) : pool(pool) {}
+    ~TaskGroup() { Wait(); }
+
+    void Run(std::function<void()> task);
+    void Wait();
+private:
+    ThreadPool& pool;
+    std::mutex mutex;
+    std::condition_variable finished;
+    int pending = 0;
+};
+
+// Calls body(i) for every i in [0, count), spread over the global pool. Must not be nested.
+void ParallelFor(int count, const std::function<void(int)>& body);
+
+#endif // !THREAD_POOL_H
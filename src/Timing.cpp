@@ -0,0 +1,207 @@
+#include "Timing.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+void StageTimings::AddTime(const char* stage, double ms)
+{
+    Find(stage).ms += ms;
+}
+
+void StageTimings::AddGpuTime(const char* stage, double ms)
+{
+    Stage& entry = Find(stage);
+    entry.gpuMs = std::max(entry.gpuMs, 0.0) + ms;
+}
+
+void StageTimings::AddThreadTime(const char* stage, double ms)
+{
+    Stage& entry = Find(stage);
+    entry.threadMs = std::max(entry.threadMs, 0.0) + ms;
+}
+
+void StageTimings::AddMegapixels(const char* stage, double megapixels)
+{
+    Find(stage).megapixels += megapixels;
+}
+
+void StageTimings::AddBytesWritten(const char* stage, std::uint64_t bytes)
+{
+    Find(stage).bytesWritten += bytes;
+}
+
+StageTimings::Stage& StageTimings::Find(const char* stage)
+{
+    for (Stage& entry : stages)
+    {
+        if (entry.name == stage)
+        {
+            return entry;
+        }
+    }
+    stages.push_back({ stage });
+    return stages.back();
+}
+
+ScopedStageTimer::ScopedStageTimer(StageTimings* timings, const char* stage)
+    : timings(timings), stage(stage), start(std::chrono::steady_clock::now())
+{
+}
+
+ScopedStageTimer::~ScopedStageTimer()
+{
+    if (timings)
+    {
+        timings->AddTime(stage, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
+}
+
+void ScopedStageTimer::AddMegapixels(double megapixels)
+{
+    if (timings)
+    {
+        timings->AddMegapixels(stage, megapixels);
+    }
+}
+
+void ScopedStageTimer::AddBytesWritten(std::uint64_t bytes)
+{
+    if (timings)
+    {
+        timings->AddBytesWritten(stage, bytes);
+    }
+}
+
+std::uint64_t PeakResidentBytes()
+{
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    {
+        return counters.PeakWorkingSetSize;
+    }
+    return 0;
+#else
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+    {
+        return 0;
+    }
+#if defined(__APPLE__)
+    return (std::uint64_t)usage.ru_maxrss; // bytes on macOS
+#else
+    return (std::uint64_t)usage.ru_maxrss * 1024; // kilobytes elsewhere
+#endif
+#endif
+}
+
+std::string JsonString(const std::string& value)
+{
+    std::string quoted = "\"";
+    for (char c : value)
+    {
+        switch (c)
+        {
+        case '"':
+            quoted += "\\\"";
+            break;
+        case '\\':
+            quoted += "\\\\";
+            break;
+        case '\n':
+            quoted += "\\n";
+            break;
+        case '\t':
+            quoted += "\\t";
+            break;
+        default:
+            if ((unsigned char)c < 0x20)
+            {
+                char escaped[8];
+                std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                quoted += escaped;
+            }
+            else
+            {
+                quoted += c;
+            }
+        }
+    }
+    return quoted + "\"";
+}
+
+static void WriteReport(std::ostream& out, const char* backend, const std::vector<JobTimings>& jobs, double totalMs)
+{
+    out << "{\n";
+    out << "  \"backend\": " << JsonString(backend) << ",\n";
+    out << "  \"total_ms\": " << totalMs << ",\n";
+    out << "  \"peak_rss_bytes\": " << PeakResidentBytes() << ",\n";
+    out << "  \"jobs\": [";
+    for (size_t j = 0; j < jobs.size(); j++)
+    {
+        const JobTimings& job = jobs[j];
+        std::uint64_t jobBytes = 0;
+        out << (j == 0 ? "\n" : ",\n");
+        out << "    {\n";
+        out << "      \"hdri\": " << JsonString(job.hdriPath) << ",\n";
+        out << "      \"output_directory\": " << JsonString(job.outputDirectory) << ",\n";
+        out << "      \"resolution\": " << job.resolution << ",\n";
+        out << "      \"succeeded\": " << (job.succeeded ? "true" : "false") << ",\n";
+        out << "      \"total_ms\": " << job.totalMs << ",\n";
+        out << "      \"stages\": [";
+        const std::vector<StageTimings::Stage>& stages = job.stages.Stages();
+        for (size_t s = 0; s < stages.size(); s++)
+        {
+            const StageTimings::Stage& stage = stages[s];
+            // Throughput over the pool's busy time when the work ran on it, the stage's wall time otherwise.
+            double busyMs = stage.threadMs >= 0.0 ? stage.threadMs : stage.ms;
+            out << (s == 0 ? "\n" : ",\n");
+            out << "        { \"name\": " << JsonString(stage.name) << ", \"ms\": " << stage.ms;
+            if (stage.gpuMs >= 0.0)
+            {
+                out << ", \"gpu_ms\": " << stage.gpuMs;
+            }
+            if (stage.threadMs >= 0.0)
+            {
+                out << ", \"thread_ms\": " << stage.threadMs;
+            }
+            out << ", \"megapixels\": " << stage.megapixels;
+            out << ", \"mpix_per_s\": " << (busyMs > 0.0 ? stage.megapixels / (busyMs / 1000.0) : 0.0);
+            out << ", \"bytes_written\": " << stage.bytesWritten << " }";
+            jobBytes += stage.bytesWritten;
+        }
+        out << (stages.empty() ? "],\n" : "\n      ],\n");
+        out << "      \"bytes_written\": " << jobBytes << "\n";
+        out << "    }";
+    }
+    out << (jobs.empty() ? "]\n" : "\n  ]\n");
+    out << "}\n";
+}
+
+bool WriteTimingReport(const std::string& path, const char* backend, const std::vector<JobTimings>& jobs, double totalMs)
+{
+    if (path == "-")
+    {
+        WriteReport(std::cout, backend, jobs, totalMs);
+        return true;
+    }
+
+    std::ofstream file(path);
+    if (!file)
+    {
+        std::cout << "Failed to write report to '" << path << "'\n";
+        return false;
+    }
+    WriteReport(file, backend, jobs, totalMs);
+    return true;
+}
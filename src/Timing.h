@@ -0,0 +1,85 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Where the time of one job went, stage by stage in the order the stages first ran. A stage that runs several
+// times (once per output, or once per face) accumulates.
+//   ms           wall time the converting thread spent in the stage
+//   gpuMs        GL_TIME_ELAPSED of the GL commands issued for it, negative when not measured
+//   threadMs     busy time of pool tasks doing the stage's work, summed over threads, negative when not measured
+//   megapixels   pixels produced or consumed by the stage
+//   bytesWritten output file bytes
+class StageTimings
+{
+public:
+    struct Stage
+    {
+        std::string name;
+        double ms = 0.0;
+        double gpuMs = -1.0;
+        double threadMs = -1.0;
+        double megapixels = 0.0;
+        std::uint64_t bytesWritten = 0;
+    };
+
+    void AddTime(const char* stage, double ms);
+    void AddGpuTime(const char* stage, double ms);
+    void AddThreadTime(const char* stage, double ms);
+    void AddMegapixels(const char* stage, double megapixels);
+    void AddBytesWritten(const char* stage, std::uint64_t bytes);
+
+    const std::vector<Stage>& Stages() const { return stages; }
+private:
+    Stage& Find(const char* stage);
+
+    std::vector<Stage> stages;
+};
+
+// Adds the wall time of its scope to a stage. Does nothing when timings is null, so call sites don't need to
+// check whether a report was requested.
+class ScopedStageTimer
+{
+public:
+    ScopedStageTimer(StageTimings* timings, const char* stage);
+    ~ScopedStageTimer();
+
+    ScopedStageTimer(const ScopedStageTimer&) = delete;
+    ScopedStageTimer& operator=(const ScopedStageTimer&) = delete;
+
+    void AddMegapixels(double megapixels);
+    void AddBytesWritten(std::uint64_t bytes);
+private:
+    StageTimings* timings;
+    const char* stage;
+    std::chrono::steady_clock::time_point start;
+};
+
+inline double Megapixels(long long pixels)
+{
+    return pixels / 1e6;
+}
+
+struct JobTimings
+{
+    std::string hdriPath;
+    std::string outputDirectory;
+    int resolution = 0;
+    bool succeeded = false;
+    double totalMs = 0.0;
+    StageTimings stages;
+};
+
+// Peak resident set size of the process so far, 0 where the platform doesn't report it.
+std::uint64_t PeakResidentBytes();
+
+// value as a quoted, escaped JSON string.
+std::string JsonString(const std::string& value);
+
+// Writes the JSON run report requested with --report. A path of "-" writes to stdout.
+bool WriteTimingReport(const std::string& path, const char* backend, const std::vector<JobTimings>& jobs, double totalMs);
+
+#endif // !TIMING_H
@@ -0,0 +1,366 @@
+#include "Validation.h"
+
+#include "BC6HEncoder.h"
+#include "CpuConvolute.h"
+#include "Half.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <sstream>
+
+namespace fs = std::filesystem;
+
+void ErrorAccumulator::Add(double reference, double value)
+{
+    double error = std::abs(value - reference);
+    squaredError += error * error;
+    // A NaN texel has to survive into the maximum, std::max would drop it.
+    if (!std::isnan(maxError))
+    {
+        maxError = std::isnan(error) ? error : std::max(maxError, error);
+    }
+    peak = std::max(peak, reference);
+    count++;
+}
+
+void ErrorAccumulator::Add(const ErrorAccumulator& other)
+{
+    squaredError += other.squaredError;
+    if (!std::isnan(maxError))
+    {
+        maxError = std::isnan(other.maxError) ? other.maxError : std::max(maxError, other.maxError);
+    }
+    peak = std::max(peak, other.peak);
+    count += other.count;
+}
+
+double ErrorAccumulator::Rmse() const
+{
+    return count > 0 ? std::sqrt(squaredError / count) : 0.0;
+}
+
+double ErrorAccumulator::Psnr() const
+{
+    double rmse = Rmse();
+    if (!std::isfinite(rmse))
+    {
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+    return rmse > 0.0 ? 20.0 * std::log10(peak / rmse) : std::numeric_limits<double>::infinity();
+}
+
+// RGBA16F texels of one face of one mip, decoding BC6H blocks. Mips smaller than a block take its top left corner.
+static void SubresourceTexels(const CubemapFile& file, int face, int level, std::vector<std::uint16_t>& texels)
+{
+    int mipRes = std::max((int)file.header.resolution >> level, 1);
+    texels.resize((size_t)mipRes * mipRes * 4);
+    const std::uint8_t* pixels = file.SubresourcePixels(face, level);
+    if (file.header.pixelFormat == CubemapPixelFormat::RGBA16F)
+    {
+        std::copy_n((const std::uint16_t*)pixels, texels.size(), texels.data());
+        return;
+    }
+    int blocksPerRow = std::max(mipRes / 4, 1);
+    std::uint16_t block[64];
+    for (int by = 0; by < blocksPerRow; by++)
+    {
+        for (int bx = 0; bx < blocksPerRow; bx++)
+        {
+            DecodeBlockBC6H(pixels + ((size_t)by * blocksPerRow + bx) * 16, block);
+            for (int y = 0; y < std::min(mipRes, 4); y++)
+            {
+                for (int x = 0; x < std::min(mipRes, 4); x++)
+                {
+                    std::copy_n(&block[(y * 4 + x) * 4], 4, &texels[((size_t)(by * 4 + y) * mipRes + bx * 4 + x) * 4]);
+                }
+            }
+        }
+    }
+}
+
+bool CompareCubemaps(const CubemapFile& reference, const CubemapFile& value, std::vector<SubresourceError>& errors)
+{
+    if (reference.header.resolution != value.header.resolution || reference.header.mipmapLevels != value.header.mipmapLevels)
+    {
+        return false;
+    }
+    int mipLevels = (int)reference.header.mipmapLevels;
+    errors.resize(6 * mipLevels);
+    ParallelFor(6 * mipLevels, [&](int i)
+    {
+        SubresourceError& error = errors[i];
+        error.face = i / mipLevels;
+        error.level = i % mipLevels;
+
+        std::vector<std::uint16_t> referenceHalves;
+        std::vector<std::uint16_t> valueHalves;
+        SubresourceTexels(reference, error.face, error.level, referenceHalves);
+        SubresourceTexels(value, error.face, error.level, valueHalves);
+        std::vector<float> referenceTexels(referenceHalves.size());
+        std::vector<float> valueTexels(valueHalves.size());
+        HalfToFloat(referenceHalves.data(), referenceTexels.data(), referenceHalves.size());
+        HalfToFloat(valueHalves.data(), valueTexels.data(), valueHalves.size());
+
+        // Alpha is ignored, BC6H doesn't store it.
+        for (size_t t = 0; t < referenceTexels.size(); t += 4)
+        {
+            for (size_t c = t; c < t + 3; c++)
+            {
+                error.linear.Add(referenceTexels[c], valueTexels[c]);
+                error.log.Add(std::log2(1.0 + std::max(referenceTexels[c], 0.0f)), std::log2(1.0 + std::max(valueTexels[c], 0.0f)));
+            }
+        }
+    });
+    return true;
+}
+
+std::string ReferenceKey(const std::string& hdriPath, const ConvoluteSettings& settings)
+{
+    ContentHash hash;
+    std::ostringstream parameters;
+    parameters << std::hexfloat
+        << "reference"
+        << ";build=" << BuildIdentifier()
+        << ";resolution=" << settings.resolution
+        << ";maxRadiance=" << settings.maxRadiance
+        << ";irradianceResolution=" << settings.irradianceResolution
+        << ";irradianceDelta=" << referenceIrradianceSampleDelta
+        << ";prefilterResolution=" << settings.prefilterResolution
+        << ";prefilterMips=" << settings.prefilterMipLevels
+        << ";prefilterSamples=" << referencePrefilterSamples
+        << ";equirectFilter=" << (int)settings.equirectFilter
+        << ";mipFilter=" << (int)settings.mipFilter;
+    hash.Update(parameters.str());
+    if (!hash.UpdateFile(hdriPath))
+    {
+        return std::string();
+    }
+    return hash.Hex();
+}
+
+static bool BakeReference(const char* hdriPath, const ConvoluteSettings& settings)
+{
+    int resolution = settings.resolution;
+    CubemapImage environmentMap(resolution, 1 + (int)std::log2(resolution));
+    if (!BakeEnvironmentMap(hdriPath, settings, environmentMap))
+    {
+        return false;
+    }
+    CubemapImage irradianceMap(settings.irradianceResolution, 1);
+    ConvoluteIrradiance(environmentMap, irradianceMap, referenceIrradianceSampleDelta);
+    CubemapImage prefilterMap(settings.prefilterResolution, settings.prefilterMipLevels);
+    PrefilterEnvironment(environmentMap, prefilterMap, std::vector<std::uint32_t>(settings.prefilterMipLevels, referencePrefilterSamples));
+
+    const CubemapImage* maps[] = { &environmentMap, &irradianceMap, &prefilterMap };
+    for (int i = 0; i < 3; i++)
+    {
+        if (WriteCubemapFile(ToHalfCubemapFile(*maps[i]), settings.OutputPath(referenceFileNames[i])) == 0)
+        {
+            std::cout << "Failed to write " << settings.OutputPath(referenceFileNames[i]) << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+// Combines the faces of every mip.
+static std::vector<SubresourceError> MipErrors(const std::vector<SubresourceError>& errors)
+{
+    std::vector<SubresourceError> mips;
+    for (const SubresourceError& error : errors)
+    {
+        if (error.level >= (int)mips.size())
+        {
+            mips.resize(error.level + 1);
+        }
+        SubresourceError& mip = mips[error.level];
+        mip.face = -1;
+        mip.level = error.level;
+        mip.linear.Add(error.linear);
+        mip.log.Add(error.log);
+    }
+    return mips;
+}
+
+static std::string FormatPsnr(double psnr)
+{
+    if (std::isinf(psnr))
+    {
+        return "inf";
+    }
+    std::ostringstream text;
+    text << std::fixed << std::setprecision(1) << psnr;
+    return text.str();
+}
+
+static void PrintErrors(std::ostream& out, const char* label, const SubresourceError& error)
+{
+    out << label << " rmse " << error.linear.Rmse() << " max " << error.linear.maxError
+        << " psnr " << FormatPsnr(error.linear.Psnr()) << " dB, log psnr " << FormatPsnr(error.log.Psnr()) << " dB";
+}
+
+static void PrintSummary(const std::vector<OutputValidation>& outputs)
+{
+    for (const OutputValidation& output : outputs)
+    {
+        std::vector<SubresourceError> uncompressed = MipErrors(output.uncompressed);
+        std::vector<SubresourceError> compressed = MipErrors(output.compressed);
+        for (size_t level = 0; level < compressed.size(); level++)
+        {
+            std::ostringstream line;
+            line << std::setprecision(3) << "  " << output.fileName << " mip " << level << ":";
+            if (level < uncompressed.size())
+            {
+                PrintErrors(line, " rgba16f", uncompressed[level]);
+                line << ";";
+            }
+            PrintErrors(line, " bc6h", compressed[level]);
+            std::cout << line.str() << "\n";
+        }
+    }
+    std::cout << std::flush;
+}
+
+// JSON has no infinity or NaN, both are written as null.
+static void WriteNumber(std::ostream& out, double value)
+{
+    if (std::isfinite(value))
+    {
+        out << value;
+    }
+    else
+    {
+        out << "null";
+    }
+}
+
+static void WriteMetrics(std::ostream& out, const char* name, const ErrorAccumulator& error)
+{
+    out << "\"" << name << "\": { \"rmse\": ";
+    WriteNumber(out, error.Rmse());
+    out << ", \"max_error\": ";
+    WriteNumber(out, error.maxError);
+    out << ", \"psnr\": ";
+    WriteNumber(out, error.Psnr());
+    out << " }";
+}
+
+static void WriteErrors(std::ostream& out, const char* name, const std::vector<SubresourceError>& errors)
+{
+    out << "      \"" << name << "\": [";
+    for (size_t i = 0; i < errors.size(); i++)
+    {
+        out << (i == 0 ? "\n" : ",\n");
+        out << "        { \"face\": " << errors[i].face << ", \"mip\": " << errors[i].level << ", ";
+        WriteMetrics(out, "linear", errors[i].linear);
+        out << ", ";
+        WriteMetrics(out, "log", errors[i].log);
+        out << " }";
+    }
+    out << (errors.empty() ? "]" : "\n      ]");
+}
+
+static bool WriteValidationReport(const std::string& path, const char* hdriPath, const std::string& key, const std::vector<OutputValidation>& outputs)
+{
+    std::ofstream out(path);
+    if (!out)
+    {
+        std::cout << "Failed to write validation report to '" << path << "'\n";
+        return false;
+    }
+    out << "{\n";
+    out << "  \"hdri\": " << JsonString(hdriPath) << ",\n";
+    out << "  \"reference\": { \"key\": " << JsonString(key) << ", \"irradiance_sample_delta\": " << referenceIrradianceSampleDelta
+        << ", \"prefilter_samples\": " << referencePrefilterSamples << " },\n";
+    out << "  \"outputs\": [";
+    for (size_t i = 0; i < outputs.size(); i++)
+    {
+        out << (i == 0 ? "\n" : ",\n");
+        out << "    {\n";
+        out << "      \"file\": " << JsonString(outputs[i].fileName) << ",\n";
+        WriteErrors(out, "uncompressed", outputs[i].uncompressed);
+        out << ",\n";
+        WriteErrors(out, "compressed", outputs[i].compressed);
+        out << "\n    }";
+    }
+    out << (outputs.empty() ? "]\n" : "\n  ]\n");
+    out << "}\n";
+    return true;
+}
+
+bool ValidateBake(const char* hdriPath, const ConvoluteSettings& settings, BakeCache& cache, StageTimings* timings)
+{
+    std::vector<std::string> referenceFiles(std::begin(referenceFileNames), std::end(referenceFileNames));
+    std::string key;
+    {
+        ScopedStageTimer timer(timings, "reference");
+        key = ReferenceKey(hdriPath, settings);
+        if (key.empty())
+        {
+            std::cout << "Failed to read " << hdriPath << "\n";
+            return false;
+        }
+        if (!cache.Restore(key, referenceFiles, settings.outputDirectory))
+        {
+            std::cout << "Computing validation reference " << key << " for " << hdriPath << std::endl;
+            if (!BakeReference(hdriPath, settings))
+            {
+                return false;
+            }
+            cache.Store(key, referenceFiles, settings.outputDirectory);
+        }
+    }
+
+    ScopedStageTimer timer(timings, "validate");
+    const char* outputNames[] = { "envmap.cbmp", "irradiance.cbmp", "prefilter.cbmp" };
+    std::vector<OutputValidation> outputs;
+    for (int i = 0; i < 3; i++)
+    {
+        if (i == 1 && settings.irradianceMode == IrradianceMode::SHCoefficientsOnly)
+        {
+            continue;
+        }
+        OutputValidation output;
+        output.fileName = outputNames[i];
+        CubemapFile reference;
+        CubemapFile compressed;
+        if (!ReadCubemapFile(settings.OutputPath(referenceFileNames[i]), reference)
+            || !ReadCubemapFile(settings.OutputPath(outputNames[i]), compressed))
+        {
+            return false;
+        }
+        if (!CompareCubemaps(reference, compressed, output.compressed))
+        {
+            std::cout << settings.OutputPath(outputNames[i]) << " doesn't match the size of its reference\n";
+            return false;
+        }
+        std::string uncompressedPath = settings.OutputPath(UncompressedFileName(outputNames[i]).c_str());
+        CubemapFile uncompressed;
+        std::error_code error;
+        if (!fs::exists(uncompressedPath, error))
+        {
+            if (settings.writeUncompressed)
+            {
+                std::cout << uncompressedPath << " is missing, " << outputNames[i] << " is only compared after compression\n";
+            }
+        }
+        else if (ReadCubemapFile(uncompressedPath, uncompressed) && !CompareCubemaps(reference, uncompressed, output.uncompressed))
+        {
+            std::cout << uncompressedPath << " doesn't match the size of its reference, " << outputNames[i]
+                << " is only compared after compression\n";
+        }
+        timer.AddMegapixels(Megapixels((long long)reference.pixels.size() / 8 * (output.uncompressed.empty() ? 1 : 2)));
+        outputs.push_back(std::move(output));
+    }
+
+    std::cout << "Error against the reference (" << referencePrefilterSamples << " prefilter samples, irradiance step "
+        << referenceIrradianceSampleDelta << ") for " << hdriPath << ":\n";
+    PrintSummary(outputs);
+    return WriteValidationReport(settings.OutputPath("validation.json"), hdriPath, key, outputs);
+}
@@ -0,0 +1,70 @@
+#ifndef VALIDATION_H
+#define VALIDATION_H
+
+#include "BakeCache.h"
+#include "ConvoluteSettings.h"
+#include "CubemapFile.h"
+#include "PrefilterSamples.h"
+#include "Timing.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// --validate: measures a bake's outputs against a reference made on the CPU with four times the samples, both the
+// RGBA16F data the bake compressed (see ConvoluteSettings::writeUncompressed) and the BC6H data it wrote.
+// The reference environment map is resampled and mipmapped like the bake's, so its error is the backend's and the
+// compression's, while the irradiance and prefilter errors include those of the sample counts.
+
+// convolute.frag steps by irradianceSampleDelta; half the step in both angles is four times the samples.
+constexpr float referenceIrradianceSampleDelta = 0.0125f;
+constexpr std::uint32_t referencePrefilterSamples = 4 * maxPrefilterSamples;
+
+// Reference cube maps, RGBA16F, kept in the output directory next to what they are compared with.
+constexpr const char* referenceFileNames[] = { "reference_envmap.cbmp", "reference_irradiance.cbmp", "reference_prefilter.cbmp" };
+
+// Squared error sums of the RGB channels over some texels; faces and mips are combined by adding them up.
+struct ErrorAccumulator
+{
+    double squaredError = 0.0;
+    double maxError = 0.0;
+    double peak = 0.0; // largest reference value
+    long long count = 0;
+
+    void Add(double reference, double value);
+    void Add(const ErrorAccumulator& other);
+
+    double Rmse() const;
+    // dB of peak over the RMSE, infinite when the two are identical and NaN when the RMSE is. validation.json
+    // holds null for both.
+    double Psnr() const;
+};
+
+struct SubresourceError
+{
+    int face;
+    int level;
+    ErrorAccumulator linear;
+    ErrorAccumulator log; // on log2(1 + value), so dark texels weigh as much as bright ones
+};
+
+struct OutputValidation
+{
+    std::string fileName;
+    std::vector<SubresourceError> uncompressed; // empty when the RGBA16F copy isn't there
+    std::vector<SubresourceError> compressed;
+};
+
+// Error of every face and mip of value against reference, which must have the same size. Either may be RGBA16F
+// or BC6H.
+bool CompareCubemaps(const CubemapFile& reference, const CubemapFile& value, std::vector<SubresourceError>& errors);
+
+// Key of the reference for a bake: the HDRI bytes, the settings the reference depends on and the build.
+// Empty if the HDRI can't be read.
+std::string ReferenceKey(const std::string& hdriPath, const ConvoluteSettings& settings);
+
+// Restores the reference for the bake from cache, or computes and stores it, into settings.outputDirectory, then
+// compares every output with it. Prints a per mip summary and writes the per face numbers to validation.json.
+bool ValidateBake(const char* hdriPath, const ConvoluteSettings& settings, BakeCache& cache, StageTimings* timings = nullptr);
+
+#endif // !VALIDATION_H